@@ -0,0 +1,137 @@
+// Builds expressions through the C code generator and checks them against
+// evaluate(). Each expression is emitted with emit_c_function(), compiled
+// into a shared object with $CC (default: cc) at -O3, loaded with dlopen()
+// and run on random rows. Rows that divide by zero are skipped because
+// evaluate() aborts on them.
+//
+// Usage: aot_check [EXPR...]
+
+#define MPC_INTERPRETER_NO_MAIN
+#include "interpreter.c"
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+#define AOT_CHECK_ROWS 100000
+
+typedef int (*GeneratedRow)(int32_t a, int32_t b, int32_t c, int32_t d, int32_t* result);
+typedef int (*GeneratedBatch)(const int32_t* a, const int32_t* b, const int32_t* c,
+                              const int32_t* d, int32_t* out, size_t n);
+
+static const char* default_expressions[] = {
+    "max(a * b, c + 5)",
+    "ifelse(greater_than(a * b, c), a * b, c)",
+    "min(absolute(a - b), d) * 3",
+    "a / b + c / 8 - d * 16",
+    "equal(a, b) + greater_than(c, d) * 2",
+    "max(min(a, b), min(c, d)) / absolute(d)",
+    "while(greater_than(a, x * x), x + 1, 16) + d",
+};
+
+uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+int32_t random_value(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    // Mix full-range values with small ones so comparisons and divisions
+    // see both overflowing and ordinary operands.
+    switch (rng_state % 4) {
+        case 0: return (int32_t)(rng_state >> 32);
+        case 1: return (int32_t)((rng_state >> 32) % 2001) - 1000;
+        case 2: return (int32_t)((rng_state >> 32) % 17) - 8;
+        default: return (rng_state >> 40) & 1 ? INT32_MIN : INT32_MAX;
+    }
+}
+
+bool check_expression(const char* dir, const char* expression, int index) {
+    char source_path[512], library_path[512], command[2048];
+    snprintf(source_path, sizeof(source_path), "%s/expr%d.c", dir, index);
+    snprintf(library_path, sizeof(library_path), "%s/expr%d.so", dir, index);
+
+    NodeArena arena = { NULL };
+    ExprNode* ast = parse(expression, &arena);
+    Program* prog = compile(prepare_expression(ast, &arena));
+
+    FILE* out = fopen(source_path, "w");
+    if (!out) {
+        printf("Error: Cannot write '%s'.\n", source_path);
+        exit(1);
+    }
+    emit_c_function(out, prog, "mpc_expr", expression);
+    fclose(out);
+
+    const char* cc = getenv("CC") ? getenv("CC") : "cc";
+    snprintf(command, sizeof(command), "%s -O3 -shared -fPIC -o %s %s", cc, library_path, source_path);
+    if (system(command) != 0) {
+        printf("Error: Failed to build generated code: %s\n", command);
+        exit(1);
+    }
+
+    void* lib = dlopen(library_path, RTLD_NOW);
+    if (!lib) {
+        printf("Error: dlopen failed: %s\n", dlerror());
+        exit(1);
+    }
+    GeneratedRow row_fn = (GeneratedRow)dlsym(lib, "mpc_expr");
+    GeneratedBatch batch_fn = (GeneratedBatch)dlsym(lib, "mpc_expr_batch");
+
+    int32_t* cols = malloc(6 * AOT_CHECK_ROWS * sizeof(int32_t));
+    int32_t *a = cols, *b = a + AOT_CHECK_ROWS, *c = b + AOT_CHECK_ROWS, *d = c + AOT_CHECK_ROWS;
+    int32_t *batch_out = d + AOT_CHECK_ROWS, *row_out = batch_out + AOT_CHECK_ROWS;
+    for (size_t i = 0; i < AOT_CHECK_ROWS; i++) {
+        a[i] = random_value();
+        b[i] = random_value();
+        c[i] = random_value();
+        d[i] = random_value();
+    }
+    batch_fn(a, b, c, d, batch_out, AOT_CHECK_ROWS);
+
+    size_t mismatches = 0, skipped = 0;
+    for (size_t i = 0; i < AOT_CHECK_ROWS; i++) {
+        if (row_fn(a[i], b[i], c[i], d[i], &row_out[i]) != 0) {
+            skipped++;
+            continue;
+        }
+        int expected = evaluate(ast, a[i], b[i], c[i], d[i]);
+        if (row_out[i] != expected || batch_out[i] != expected) {
+            if (mismatches++ < 5) {
+                printf("  mismatch at a=%d b=%d c=%d d=%d: expected %d, got %d (batch %d)\n",
+                       a[i], b[i], c[i], d[i], expected, row_out[i], batch_out[i]);
+            }
+        }
+    }
+
+    printf("%-50s %s (%d rows, %zu skipped for division by zero)\n", expression,
+           mismatches ? "FAIL" : "ok", AOT_CHECK_ROWS, skipped);
+
+    free(cols);
+    dlclose(lib);
+    unlink(source_path);
+    unlink(library_path);
+    free_program(prog);
+    arena_release(&arena);
+    return mismatches == 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char** expressions = default_expressions;
+    int count = (int)(sizeof(default_expressions) / sizeof(default_expressions[0]));
+    if (argc > 1) {
+        expressions = (const char**)&argv[1];
+        count = argc - 1;
+    }
+
+    char dir[] = "/tmp/mpc_aot_XXXXXX";
+    if (!mkdtemp(dir)) {
+        printf("Error: Cannot create a temporary directory.\n");
+        return 1;
+    }
+
+    bool all_ok = true;
+    for (int i = 0; i < count; i++) {
+        all_ok &= check_expression(dir, expressions[i], i);
+    }
+    rmdir(dir);
+    return all_ok ? 0 : 1;
+}
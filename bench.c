@@ -0,0 +1,605 @@
+// Benchmark harness for the arithmetic primitives and evaluation engines.
+// Every result is printed as a table row and appended as one JSON object
+// per line to the output file (default bench_output.txt) for regression
+// tracking; each run starts with a {"suite": "run"} record giving its start
+// time, so successive runs can be told apart. Cycle counts come from rdtsc
+// where available.
+//
+// Usage: bench [--quick] [--output FILE] [SUITE...]
+//   suites: primitives, engines, shared, circuits, parallel, mapped (default: all)
+
+#define MPC_INTERPRETER_NO_MAIN
+#include "interpreter.c"
+
+#include <time.h>
+
+// The standalone primitive files are pulled in under new names so their
+// unrolled / masked variants can be compared with the interpreter's.
+#define subtract subtract_bitwise
+#include "Substract.c"
+#undef subtract
+
+#define multiply multiply_unrolled
+#include "Multiply.c"
+#undef multiply
+
+#define mpc_divide_unsigned mpc_divide_unsigned_unrolled
+#include "devision.c"
+#undef mpc_divide_unsigned
+
+#define greater_than greater_than_masked
+#include "Greater_than.c"
+#undef greater_than
+
+#define equal equal_masked
+#include "equal.c"
+#undef equal
+
+#define PRIMITIVE_INPUTS 4096
+#define ENGINE_ROWS (1 << 16)
+#define SHARED_ROWS 4096
+#define PARALLEL_ROWS (1 << 20)
+#define MAPPED_ROWS (1 << 22)
+
+typedef struct {
+    double min_seconds;
+    FILE* output;
+} BenchConfig;
+
+BenchConfig bench_config = { 0.25, NULL };
+
+double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+uint64_t read_cycles(void) {
+#ifdef MPC_HAVE_X86_SIMD
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+uint64_t bench_rng = 0x2545F4914F6CDD1DULL;
+
+uint32_t bench_random(void) {
+    bench_rng ^= bench_rng << 13;
+    bench_rng ^= bench_rng >> 7;
+    bench_rng ^= bench_rng << 17;
+    return (uint32_t)(bench_rng >> 16);
+}
+
+void report(const char* suite, const char* name, double ns_per_op, double cycles_per_op) {
+    printf("  %-64s %10.2f ns/op %14.0f ops/s %10.1f cycles/op\n",
+           name, ns_per_op, 1e9 / ns_per_op, cycles_per_op);
+    if (bench_config.output) {
+        fprintf(bench_config.output,
+                "{\"suite\": \"%s\", \"name\": \"%s\", \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f, \"cycles_per_op\": %.2f}\n",
+                suite, name, ns_per_op, 1e9 / ns_per_op, cycles_per_op);
+    }
+}
+
+// Repeats `run(ctx)` (which performs `ops_per_run` operations) until at
+// least min_seconds have elapsed, then reports and returns the
+// per-operation cost in nanoseconds.
+double measure(const char* suite, const char* name, void (*run)(void*), void* ctx, double ops_per_run) {
+    run(ctx);  // warm-up
+
+    uint64_t runs = 0;
+    double start = now_seconds();
+    uint64_t cycles_start = read_cycles();
+    double elapsed;
+    do {
+        run(ctx);
+        runs++;
+        elapsed = now_seconds() - start;
+    } while (elapsed < bench_config.min_seconds);
+    uint64_t cycles = read_cycles() - cycles_start;
+
+    double ops = (double)runs * ops_per_run;
+    report(suite, name, elapsed * 1e9 / ops, (double)cycles / ops);
+    return elapsed * 1e9 / ops;
+}
+
+// --- Primitives ---
+
+typedef int (*BinaryPrimitive)(int a, int b);
+
+typedef struct {
+    BinaryPrimitive fn;
+    const int* x;
+    const int* y;
+    volatile int sink;
+} PrimitiveRun;
+
+int bench_subtract(int a, int b) { return subtract(a, b); }
+int bench_subtract_bitwise(int a, int b) { return subtract_bitwise(a, b); }
+int bench_multiply(int a, int b) { return multiply(a, b); }
+int bench_multiply_unrolled(int a, int b) { return multiply_unrolled(a, b); }
+int bench_divide_early_exit(int a, int b) { return (int)mpc_divide_unsigned((uint32_t)a, (uint32_t)b); }
+int bench_divide_unrolled(int a, int b) { return (int)mpc_divide_unsigned_unrolled((uint32_t)a, (uint32_t)b); }
+int bench_divide_signed(int a, int b) { return divide_signed(a, b); }
+int bench_multiply_public(int a, int b) { return multiply_public(a, b); }
+int bench_divide_public(int a, int b) { return divide_public(a, b); }
+int bench_divide_oblivious(int a, int b) { return divide_signed_oblivious(a, b); }
+int bench_greater_than(int a, int b) { return greater_than(a, b); }
+int bench_greater_than_masked(int a, int b) { return greater_than_masked(a, b); }
+int bench_equal(int a, int b) { return equal(a, b); }
+int bench_equal_masked(int a, int b) { return equal_masked(a, b); }
+int bench_ifelse(int a, int b) { return ifelse(a, b, (a ^ b) & 1); }
+int bench_absolute(int a, int b) { return absolute(a) ^ b; }
+int bench_max(int a, int b) { return max(a, b); }
+int bench_min(int a, int b) { return min(a, b); }
+
+void run_primitive(void* ctx) {
+    PrimitiveRun* r = ctx;
+    BinaryPrimitive fn = r->fn;
+    int acc = 0;
+    for (int i = 0; i < PRIMITIVE_INPUTS; i++) acc ^= fn(r->x[i], r->y[i]);
+    r->sink = acc;
+}
+
+void bench_primitives(void) {
+    static const struct { const char* name; BinaryPrimitive fn; } primitives[] = {
+        { "subtract (interpreter.c)", bench_subtract },
+        { "subtract (Substract.c, bitwise)", bench_subtract_bitwise },
+        { "multiply (interpreter.c, loop)", bench_multiply },
+        { "multiply (Multiply.c, unrolled)", bench_multiply_unrolled },
+        { "mpc_divide_unsigned (interpreter.c)", bench_divide_early_exit },
+        { "mpc_divide_unsigned (devision.c)", bench_divide_unrolled },
+        { "divide_signed", bench_divide_signed },
+        { "multiply_public (native)", bench_multiply_public },
+        { "divide_public (native)", bench_divide_public },
+        { "divide_signed_oblivious", bench_divide_oblivious },
+        { "greater_than (interpreter.c)", bench_greater_than },
+        { "greater_than (Greater_than.c)", bench_greater_than_masked },
+        { "equal (interpreter.c)", bench_equal },
+        { "equal (equal.c)", bench_equal_masked },
+        { "ifelse", bench_ifelse },
+        { "absolute", bench_absolute },
+        { "max", bench_max },
+        { "min", bench_min },
+    };
+
+    int* x = malloc(PRIMITIVE_INPUTS * sizeof(int));
+    int* y = malloc(PRIMITIVE_INPUTS * sizeof(int));
+    for (int i = 0; i < PRIMITIVE_INPUTS; i++) {
+        x[i] = (int)bench_random();
+        y[i] = (int)(bench_random() >> (bench_random() % 31)) | 1;
+    }
+
+    printf("primitives (%d inputs per run, called through a function pointer):\n", PRIMITIVE_INPUTS);
+    for (size_t k = 0; k < sizeof(primitives) / sizeof(primitives[0]); k++) {
+        PrimitiveRun run = { primitives[k].fn, x, y, 0 };
+        measure("primitives", primitives[k].name, run_primitive, &run, PRIMITIVE_INPUTS);
+    }
+
+    free(x);
+    free(y);
+}
+
+// --- Engines ---
+
+// Representative expressions; divisors are kept nonzero so every engine
+// runs to completion on random rows.
+const char* bench_expressions[] = {
+    "max(a * b, c + 5)",
+    "ifelse(greater_than(a * b, c), a * b, c)",
+    "min(absolute(a - b), d) * 3 + equal(c, d)",
+    "a / (absolute(b) + 1) + c / 8",
+    "max(min(a, b), min(c, d)) - absolute(a * d - b * c)",
+    "while(greater_than(absolute(a), x * x), x + 1, 16)",
+};
+
+typedef struct {
+    const char* expression;
+    ExprNode* ast;
+    Program* prog;
+    JitProgram* jit;
+    const BatchKernels* kernels;
+    const BitsliceCircuits* circuits;
+    ExprCache* cache;
+    const int32_t* cols[NUM_VARIABLES];
+    int32_t* out;
+    size_t rows;
+    int parties;
+    bool levelized;
+    ParallelPool* pool;
+    MpcStats stats;
+    volatile int sink;
+} EngineRun;
+
+void run_engine_tree(void* ctx) {
+    EngineRun* r = ctx;
+    int acc = 0;
+    for (size_t i = 0; i < r->rows; i++) {
+        acc ^= evaluate(r->ast, r->cols[0][i], r->cols[1][i], r->cols[2][i], r->cols[3][i]);
+    }
+    r->sink = acc;
+}
+
+void run_engine_bytecode(void* ctx) {
+    EngineRun* r = ctx;
+    int acc = 0;
+    for (size_t i = 0; i < r->rows; i++) {
+        acc ^= run_program(r->prog, r->cols[0][i], r->cols[1][i], r->cols[2][i], r->cols[3][i]);
+    }
+    r->sink = acc;
+}
+
+void run_engine_batch(void* ctx) {
+    EngineRun* r = ctx;
+    run_program_batch_with(r->prog, r->kernels, r->cols[0], r->cols[1], r->cols[2], r->cols[3], r->out, r->rows);
+}
+
+void run_engine_bitsliced(void* ctx) {
+    EngineRun* r = ctx;
+    run_program_bitsliced_with(r->prog, r->circuits, r->cols[0], r->cols[1], r->cols[2], r->cols[3], r->out,
+                               r->rows);
+}
+
+void run_engine_jit(void* ctx) {
+    EngineRun* r = ctx;
+    run_jit_batch(r->jit, r->cols[0], r->cols[1], r->cols[2], r->cols[3], r->out, r->rows);
+}
+
+void run_engine_parallel(void* ctx) {
+    EngineRun* r = ctx;
+    run_program_parallel_with(r->pool, r->prog, r->kernels, r->cols, r->out, r->rows);
+}
+
+void run_engine_shared(void* ctx) {
+    EngineRun* r = ctx;
+    run_program_shared_with(r->prog, r->levelized, r->parties, r->cols[0], r->cols[1], r->cols[2], r->cols[3],
+                            r->out, r->rows, &r->stats);
+}
+
+// One parse + prepare + compile + single-row evaluation, as the interactive
+// loop did before caching.
+void run_engine_cold(void* ctx) {
+    EngineRun* r = ctx;
+    NodeArena arena = { NULL };
+    Program* prog = compile(prepare_expression(parse(r->expression, &arena), &arena));
+    r->sink = run_program(prog, r->cols[0][0], r->cols[1][0], r->cols[2][0], r->cols[3][0]);
+    free_program(prog);
+    arena_release(&arena);
+}
+
+void run_engine_cached(void* ctx) {
+    EngineRun* r = ctx;
+    CacheEntry* entry = expr_cache_get(r->cache, r->expression, ALL_VARIABLES_SECRET);
+    r->sink = run_program(entry->prog, r->cols[0][0], r->cols[1][0], r->cols[2][0], r->cols[3][0]);
+}
+
+void bench_engines(void) {
+    int32_t* data = malloc((NUM_VARIABLES + 1) * ENGINE_ROWS * sizeof(int32_t));
+    for (size_t i = 0; i < NUM_VARIABLES * ENGINE_ROWS; i++) {
+        data[i] = (int32_t)(bench_random() >> (bench_random() % 24));
+    }
+
+    const BatchKernels* kernels[3];
+    int kernel_count = supported_batch_kernels(kernels);
+    ExprCache cache;
+    expr_cache_init(&cache, EXPR_CACHE_DEFAULT_BYTES);
+
+    for (size_t e = 0; e < sizeof(bench_expressions) / sizeof(bench_expressions[0]); e++) {
+        NodeArena arena = { NULL };
+        EngineRun run = { 0 };
+        run.expression = bench_expressions[e];
+        run.ast = parse(run.expression, &arena);
+        run.prog = compile(prepare_expression(parse(run.expression, &arena), &arena));
+        run.jit = jit_compile(run.prog);
+        run.cache = &cache;
+        for (int v = 0; v < NUM_VARIABLES; v++) run.cols[v] = data + (size_t)v * ENGINE_ROWS;
+        run.out = data + (size_t)NUM_VARIABLES * ENGINE_ROWS;
+        run.rows = ENGINE_ROWS;
+
+        printf("engines: %s (%d instructions, per row)\n", run.expression, run.prog->count);
+        char name[128];
+        snprintf(name, sizeof(name), "%s | parse+compile+evaluate", run.expression);
+        measure("end_to_end", name, run_engine_cold, &run, 1);
+        snprintf(name, sizeof(name), "%s | cached+evaluate", run.expression);
+        measure("end_to_end", name, run_engine_cached, &run, 1);
+
+        snprintf(name, sizeof(name), "%s | tree", run.expression);
+        measure("engines", name, run_engine_tree, &run, ENGINE_ROWS);
+        snprintf(name, sizeof(name), "%s | bytecode", run.expression);
+        measure("engines", name, run_engine_bytecode, &run, ENGINE_ROWS);
+        for (int k = 0; k < kernel_count; k++) {
+            run.kernels = kernels[k];
+            snprintf(name, sizeof(name), "%s | batch %s", run.expression, kernels[k]->name);
+            measure("engines", name, run_engine_batch, &run, ENGINE_ROWS);
+        }
+        run.circuits = &ripple_circuits;
+        snprintf(name, sizeof(name), "%s | bitsliced x%d", run.expression, BITSLICE_LANES);
+        measure("engines", name, run_engine_bitsliced, &run, ENGINE_ROWS);
+        run.circuits = &prefix_circuits;
+        snprintf(name, sizeof(name), "%s | bitsliced x%d depth", run.expression, BITSLICE_LANES);
+        measure("engines", name, run_engine_bitsliced, &run, ENGINE_ROWS);
+        if (run.jit) {
+            snprintf(name, sizeof(name), "%s | jit", run.expression);
+            measure("engines", name, run_engine_jit, &run, ENGINE_ROWS);
+        }
+
+        jit_free(run.jit);
+        free_program(run.prog);
+        arena_release(&arena);
+    }
+
+    expr_cache_clear(&cache);
+    free(data);
+}
+
+// Secret-shared evaluation among 2-4 party threads, with the levelized
+// schedule and, for two parties, with gates taken one at a time. Rounds,
+// bytes and the preprocessing figures are per evaluation of SHARED_ROWS
+// rows, written as their own JSON lines.
+void bench_shared_run(EngineRun* run) {
+    char name[128];
+    snprintf(name, sizeof(name), "%s | %d parties%s", run->expression, run->parties,
+             run->levelized ? "" : " serial");
+    measure("shared", name, run_engine_shared, run, SHARED_ROWS);
+    printf("  %-64s %10llu rounds %14llu bytes %8.2f ms prefill %6llu stalls\n", "",
+           (unsigned long long)run->stats.rounds, (unsigned long long)run->stats.bytes,
+           run->stats.prefill_seconds * 1e3, (unsigned long long)run->stats.stalls);
+    if (bench_config.output) {
+        fprintf(bench_config.output,
+                "{\"suite\": \"shared\", \"name\": \"%s\", \"rounds\": %llu, \"levels\": %llu, "
+                "\"gates\": %llu, \"bytes\": %llu, \"prefill_ms\": %.3f, \"online_ms\": %.3f, \"stalls\": %llu}\n",
+                name, (unsigned long long)run->stats.rounds, (unsigned long long)run->stats.levels,
+                (unsigned long long)run->stats.gates, (unsigned long long)run->stats.bytes,
+                run->stats.prefill_seconds * 1e3, run->stats.online_seconds * 1e3,
+                (unsigned long long)run->stats.stalls);
+    }
+}
+
+void bench_shared(void) {
+    int32_t* data = malloc((NUM_VARIABLES + 1) * SHARED_ROWS * sizeof(int32_t));
+    for (size_t i = 0; i < NUM_VARIABLES * SHARED_ROWS; i++) {
+        data[i] = (int32_t)(bench_random() >> (bench_random() % 24));
+    }
+
+    for (size_t e = 0; e < sizeof(bench_expressions) / sizeof(bench_expressions[0]); e++) {
+        NodeArena arena = { NULL };
+        EngineRun run = { 0 };
+        run.expression = bench_expressions[e];
+        run.prog = compile(prepare_expression(parse(run.expression, &arena), &arena));
+        for (int v = 0; v < NUM_VARIABLES; v++) run.cols[v] = data + (size_t)v * SHARED_ROWS;
+        run.out = data + (size_t)NUM_VARIABLES * SHARED_ROWS;
+        run.rows = SHARED_ROWS;
+
+        printf("shared: %s (%d rows per evaluation, per row)\n", run.expression, SHARED_ROWS);
+        run.parties = 2;
+        run.levelized = false;
+        bench_shared_run(&run);
+        run.levelized = true;
+        for (run.parties = 2; run.parties <= 4; run.parties++) bench_shared_run(&run);
+
+        free_program(run.prog);
+        arena_release(&arena);
+    }
+
+    free(data);
+}
+
+// The batch engine on 1, 2, 4, ... threads up to the pool size
+// (MPC_THREADS, default all online CPUs), with speedup and scaling
+// efficiency against one thread written as their own JSON lines.
+void bench_parallel(void) {
+    int32_t* data = malloc((NUM_VARIABLES + 1) * (size_t)PARALLEL_ROWS * sizeof(int32_t));
+    for (size_t i = 0; i < NUM_VARIABLES * (size_t)PARALLEL_ROWS; i++) {
+        data[i] = (int32_t)(bench_random() >> (bench_random() % 24));
+    }
+
+    int max_threads = parallel_default_threads();
+    int counts[32];
+    int num_counts = 0;
+    for (int t = 1; t < max_threads && num_counts < 31; t *= 2) counts[num_counts++] = t;
+    counts[num_counts++] = max_threads;
+
+    for (size_t e = 0; e < sizeof(bench_expressions) / sizeof(bench_expressions[0]); e++) {
+        NodeArena arena = { NULL };
+        EngineRun run = { 0 };
+        run.expression = bench_expressions[e];
+        run.prog = compile(prepare_expression(parse(run.expression, &arena), &arena));
+        run.kernels = batch_kernels();
+        for (int v = 0; v < NUM_VARIABLES; v++) run.cols[v] = data + (size_t)v * PARALLEL_ROWS;
+        run.out = data + (size_t)NUM_VARIABLES * PARALLEL_ROWS;
+        run.rows = PARALLEL_ROWS;
+
+        printf("parallel: %s (%d rows, batch %s, per row)\n", run.expression, PARALLEL_ROWS, run.kernels->name);
+        double single = 0;
+        for (int k = 0; k < num_counts; k++) {
+            run.pool = parallel_pool_create(counts[k]);
+            char name[128];
+            snprintf(name, sizeof(name), "%s | %d threads", run.expression, counts[k]);
+            double ns = measure("parallel", name, run_engine_parallel, &run, PARALLEL_ROWS);
+            if (k == 0) single = ns;
+            double speedup = single / ns;
+            printf("  %-64s %10.2fx speedup %8.1f%% efficiency\n", "", speedup, 100.0 * speedup / counts[k]);
+            if (bench_config.output) {
+                fprintf(bench_config.output,
+                        "{\"suite\": \"parallel\", \"name\": \"%s\", \"threads\": %d, \"speedup\": %.3f, "
+                        "\"efficiency\": %.3f}\n",
+                        name, counts[k], speedup, speedup / counts[k]);
+            }
+            parallel_pool_free(run.pool);
+        }
+
+        free_program(run.prog);
+        arena_release(&arena);
+    }
+
+    free(data);
+}
+
+// Size of each expression as a Bristol Fashion netlist, for the fewest ANDs
+// and for the least AND depth. Nothing is timed; the counts are written as
+// their own JSON lines.
+void bench_circuits(void) {
+    for (size_t e = 0; e < sizeof(bench_expressions) / sizeof(bench_expressions[0]); e++) {
+        NodeArena arena = { NULL };
+        const char* expression = bench_expressions[e];
+        Program* prog = compile(prepare_expression(parse(expression, &arena), &arena));
+
+        printf("circuits: %s\n", expression);
+        for (int depth = 0; depth <= 1; depth++) {
+            Netlist* net = build_netlist(prog, depth);
+            Netlist* optimized = optimize_netlist(net);
+            NetlistStats stats = netlist_stats(net);
+            NetlistStats after = netlist_stats(optimized);
+            char name[128];
+            snprintf(name, sizeof(name), "%s | %s", expression, depth ? "depth" : "gates");
+            printf("  %-64s %8d -> %8d ANDs %6d -> %6d AND depth %8d -> %8d XORs\n", name, stats.and_gates,
+                   after.and_gates, stats.and_depth, after.and_depth, stats.xor_gates, after.xor_gates);
+            if (bench_config.output) {
+                fprintf(bench_config.output,
+                        "{\"suite\": \"circuits\", \"name\": \"%s\", \"and_gates\": %d, \"and_depth\": %d, "
+                        "\"xor_gates\": %d, \"optimized_and_gates\": %d, \"optimized_and_depth\": %d, "
+                        "\"optimized_xor_gates\": %d}\n",
+                        name, stats.and_gates, stats.and_depth, stats.xor_gates, after.and_gates, after.and_depth,
+                        after.xor_gates);
+            }
+            free_netlist(optimized);
+            free_netlist(net);
+        }
+
+        free_program(prog);
+        arena_release(&arena);
+    }
+}
+
+// --- Mapped Columns ---
+
+typedef struct {
+    Program* prog;
+    const char* input;
+    const char* output;
+} FileRun;
+
+void run_file_buffered(void* ctx) {
+    FileRun* r = ctx;
+    FILE* in = fopen(r->input, "rb");
+    FILE* out = fopen(r->output, "wb");
+    if (!in || !out) {
+        printf("Error: Cannot open '%s'.\n", !in ? r->input : r->output);
+        exit(1);
+    }
+    stream_evaluate(r->prog, 0, in, out, STREAM_COLUMNS);
+    fclose(in);
+    fclose(out);
+}
+
+void run_file_mapped(void* ctx) {
+    FileRun* r = ctx;
+    mapped_evaluate(r->prog, 0, r->input, r->output);
+}
+
+// File-to-file evaluation of MAPPED_ROWS rows: the buffered path streams a
+// plain columnar file through read buffers, the mapped path evaluates a
+// mapped column file in place. Both files sit in the page cache after the
+// warm-up run, so this measures the copying rather than the disk.
+void bench_mapped(void) {
+    const char* dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char columns_path[512], mapped_path[512], columns_out[512], mapped_out[512];
+    snprintf(columns_path, sizeof(columns_path), "%s/mpc_bench_%d.cols", dir, (int)getpid());
+    snprintf(mapped_path, sizeof(mapped_path), "%s/mpc_bench_%d.mapped", dir, (int)getpid());
+    snprintf(columns_out, sizeof(columns_out), "%s/mpc_bench_%d.cols.out", dir, (int)getpid());
+    snprintf(mapped_out, sizeof(mapped_out), "%s/mpc_bench_%d.mapped.out", dir, (int)getpid());
+
+    MappedColumns data = mapped_create(mapped_path, MAPPED_ROWS, NUM_VARIABLES);
+    FILE* columns = fopen(columns_path, "wb");
+    if (!columns) {
+        printf("Error: Cannot open '%s' for writing.\n", columns_path);
+        exit(1);
+    }
+    for (int v = 0; v < NUM_VARIABLES; v++) {
+        for (size_t i = 0; i < MAPPED_ROWS; i++) data.columns[v][i] = (int32_t)(bench_random() >> (bench_random() % 24));
+        fwrite(data.columns[v], sizeof(int32_t), MAPPED_ROWS, columns);
+    }
+    fclose(columns);
+    mapped_close(&data);
+
+    for (size_t e = 0; e < sizeof(bench_expressions) / sizeof(bench_expressions[0]); e++) {
+        NodeArena arena = { NULL };
+        const char* expression = bench_expressions[e];
+        Program* prog = compile(prepare_expression(parse(expression, &arena), &arena));
+
+        printf("mapped: %s (%d rows, file to file, per row)\n", expression, MAPPED_ROWS);
+        char name[128];
+        FileRun buffered_run = { prog, columns_path, columns_out };
+        snprintf(name, sizeof(name), "%s | buffered", expression);
+        double buffered = measure("mapped", name, run_file_buffered, &buffered_run, MAPPED_ROWS);
+
+        FileRun mapped_run = { prog, mapped_path, mapped_out };
+        snprintf(name, sizeof(name), "%s | mapped", expression);
+        double mapped = measure("mapped", name, run_file_mapped, &mapped_run, MAPPED_ROWS);
+        printf("  %-64s %10.2fx speedup\n", "", buffered / mapped);
+        if (bench_config.output) {
+            fprintf(bench_config.output, "{\"suite\": \"mapped\", \"name\": \"%s\", \"speedup\": %.3f}\n", name,
+                    buffered / mapped);
+        }
+
+        free_program(prog);
+        arena_release(&arena);
+    }
+
+    remove(columns_out);
+    remove(mapped_out);
+    remove(columns_path);
+    remove(mapped_path);
+}
+
+// --- Main ---
+
+typedef struct {
+    const char* name;
+    void (*run)(void);
+} BenchSuite;
+
+const BenchSuite bench_suites[] = {
+    { "primitives", bench_primitives },
+    { "engines", bench_engines },
+    { "shared", bench_shared },
+    { "circuits", bench_circuits },
+    { "parallel", bench_parallel },
+    { "mapped", bench_mapped },
+};
+
+int main(int argc, char* argv[]) {
+    const char* output_path = "bench_output.txt";
+    const char* selected[16];
+    int selected_count = 0;
+    bool quick = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            bench_config.min_seconds = 0.02;
+            quick = true;
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (selected_count < 16) {
+            selected[selected_count++] = argv[i];
+        }
+    }
+
+    bench_config.output = fopen(output_path, "a");
+    if (!bench_config.output) {
+        printf("Error: Cannot open '%s' for writing.\n", output_path);
+        return 1;
+    }
+    fprintf(bench_config.output, "{\"suite\": \"run\", \"time\": %lld, \"quick\": %s}\n", (long long)time(NULL),
+            quick ? "true" : "false");
+
+    for (size_t s = 0; s < sizeof(bench_suites) / sizeof(bench_suites[0]); s++) {
+        bool run = selected_count == 0;
+        for (int i = 0; i < selected_count; i++) run |= strcmp(selected[i], bench_suites[s].name) == 0;
+        if (run) bench_suites[s].run();
+    }
+
+    fclose(bench_config.output);
+    printf("Results appended to %s\n", output_path);
+    return 0;
+}
@@ -0,0 +1,236 @@
+// dudect-style constant-time check for the primitives. Each primitive is
+// timed on two interleaved input classes: a fixed pair chosen to hit any
+// data-dependent fast path, and uniformly random pairs. Welch's t-test on
+// the two timing distributions reports whether they differ; |t| above
+// CT_THRESHOLD is treated as a timing leak. Measurements above a
+// percentile of the distribution are also tested separately, as dudect
+// does, since interrupts and cache misses only ever add time. Only the
+// primitives that secret values go through are tested; multiply_public()
+// and divide_public() are variable-time by design.
+//
+// The original mpc_divide_unsigned() and divide_signed() exit early when
+// the numerator is below the divisor. They stay in the list as controls
+// that are expected to leak, so that a tester which has gone blind fails
+// instead of passing everything.
+//
+// Usage: ct_test [--quick] [NAME...]
+// Exits with status 1 if any tested primitive leaks, or a control does not.
+
+#define MPC_INTERPRETER_NO_MAIN
+#include "interpreter.c"
+
+#include <math.h>
+#include <time.h>
+
+#define CT_THRESHOLD 4.5
+#define CT_PERCENTILES 5
+
+typedef int (*CtTarget)(int a, int b);
+
+typedef struct {
+    const char* name;
+    CtTarget fn;
+    int fixed_a;
+    int fixed_b;
+    bool expect_leak;  // a control: reported, and a failure only if it stops leaking
+} CtCase;
+
+typedef struct {
+    double mean[2];
+    double m2[2];
+    double n[2];
+} Welch;
+
+uint64_t ct_rng = 0xD1B54A32D192ED03ULL;
+
+uint32_t ct_random(void) {
+    ct_rng ^= ct_rng << 13;
+    ct_rng ^= ct_rng >> 7;
+    ct_rng ^= ct_rng << 17;
+    return (uint32_t)(ct_rng >> 16);
+}
+
+static inline uint64_t ct_cycles(void) {
+#ifdef MPC_HAVE_X86_SIMD
+    _mm_lfence();
+    uint64_t t = __rdtsc();
+    _mm_lfence();
+    return t;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+void welch_push(Welch* w, int cls, double x) {
+    w->n[cls]++;
+    double delta = x - w->mean[cls];
+    w->mean[cls] += delta / w->n[cls];
+    w->m2[cls] += delta * (x - w->mean[cls]);
+}
+
+double welch_t(const Welch* w) {
+    if (w->n[0] < 2 || w->n[1] < 2) return 0;
+    double v0 = w->m2[0] / (w->n[0] - 1);
+    double v1 = w->m2[1] / (w->n[1] - 1);
+    double se = sqrt(v0 / w->n[0] + v1 / w->n[1]);
+    return se > 0 ? (w->mean[0] - w->mean[1]) / se : 0;
+}
+
+int compare_u64(const void* x, const void* y) {
+    uint64_t a = *(const uint64_t*)x, b = *(const uint64_t*)y;
+    return (a > b) - (a < b);
+}
+
+int ct_leaky_divide_unsigned(int a, int b) { return (int)mpc_divide_unsigned((uint32_t)a, (uint32_t)b); }
+int ct_leaky_divide_signed(int a, int b) { return divide_signed(a, b); }
+int ct_subtract(int a, int b) { return subtract(a, b); }
+int ct_multiply(int a, int b) { return multiply(a, b); }
+int ct_divide_unsigned(int a, int b) { return (int)divide_unsigned_oblivious((uint32_t)a, (uint32_t)b); }
+int ct_divide_signed(int a, int b) { return divide_signed_oblivious(a, b); }
+int ct_greater_than(int a, int b) { return greater_than(a, b); }
+int ct_equal(int a, int b) { return equal(a, b); }
+int ct_ifelse(int a, int b) { return ifelse(a, b, b & 1); }
+int ct_absolute(int a, int b) { return absolute(a) ^ b; }
+int ct_max(int a, int b) { return max(a, b); }
+int ct_min(int a, int b) { return min(a, b); }
+int ct_shift_left(int a, int b) { return shift_left(a, b & 31); }
+int ct_divide_pow2(int a, int b) { return divide_pow2(a, (b & 15) + 1); }
+
+// The widest batch kernels, driven one SIMD register's worth at a time.
+int ct_batch_divide(int a, int b) {
+    int32_t x[16], y[16], out[16];
+    for (int i = 0; i < 16; i++) {
+        x[i] = a;
+        y[i] = b | 1;
+    }
+    batch_kernels()->divide(x, y, out, 16);
+    return out[0];
+}
+
+int ct_batch_greater_than(int a, int b) {
+    int32_t x[16], y[16], out[16];
+    for (int i = 0; i < 16; i++) {
+        x[i] = a;
+        y[i] = b;
+    }
+    batch_kernels()->greater_than(x, y, out, 16);
+    return out[0];
+}
+
+const CtCase ct_cases[] = {
+    { "subtract", ct_subtract, 0, 0, false },
+    { "multiply", ct_multiply, 0, 0, false },
+    { "divide_unsigned_oblivious", ct_divide_unsigned, 1, 0x7FFFFFFF, false },
+    { "divide_signed_oblivious", ct_divide_signed, 1, 0x7FFFFFFF, false },
+    { "greater_than", ct_greater_than, 0, 0, false },
+    { "equal", ct_equal, 0, 0, false },
+    { "ifelse", ct_ifelse, 0, 0, false },
+    { "absolute", ct_absolute, 0, 0, false },
+    { "max", ct_max, 0, 0, false },
+    { "min", ct_min, 0, 0, false },
+    { "shift_left", ct_shift_left, 0, 0, false },
+    { "divide_pow2", ct_divide_pow2, 0, 0, false },
+    { "batch divide", ct_batch_divide, 1, 0x7FFFFFFF, false },
+    { "batch greater_than", ct_batch_greater_than, 0, 0, false },
+    { "mpc_divide_unsigned", ct_leaky_divide_unsigned, 1, 0x7FFFFFFF, true },
+    { "divide_signed", ct_leaky_divide_signed, 1, 0x7FFFFFFF, true },
+};
+
+volatile int ct_sink;
+
+// Returns the largest |t| over the uncropped test and the cropped ones.
+double run_case(const CtCase* c, size_t measurements) {
+    uint8_t* classes = malloc(measurements);
+    int* xs = malloc(measurements * sizeof(int));
+    int* ys = malloc(measurements * sizeof(int));
+    uint64_t* cycles = malloc(measurements * sizeof(uint64_t));
+
+    for (size_t i = 0; i < measurements; i++) {
+        classes[i] = ct_random() & 1;
+        xs[i] = classes[i] ? (int)ct_random() : c->fixed_a;
+        ys[i] = classes[i] ? (int)ct_random() : c->fixed_b;
+    }
+
+    CtTarget fn = c->fn;
+    for (size_t i = 0; i < measurements; i++) {
+        uint64_t start = ct_cycles();
+        ct_sink = fn(xs[i], ys[i]);
+        cycles[i] = ct_cycles() - start;
+    }
+
+    uint64_t* sorted = malloc(measurements * sizeof(uint64_t));
+    memcpy(sorted, cycles, measurements * sizeof(uint64_t));
+    qsort(sorted, measurements, sizeof(uint64_t), compare_u64);
+
+    Welch tests[1 + CT_PERCENTILES];
+    uint64_t thresholds[1 + CT_PERCENTILES];
+    memset(tests, 0, sizeof(tests));
+    thresholds[0] = UINT64_MAX;
+    for (int p = 0; p < CT_PERCENTILES; p++) {
+        // 50th, 75th, 87.5th, ... percentiles, following dudect.
+        double fraction = 1.0 - pow(0.5, p + 1);
+        thresholds[p + 1] = sorted[(size_t)(fraction * (double)(measurements - 1))];
+    }
+
+    // The first 1% warms caches and predictors and is not counted.
+    for (size_t i = measurements / 100; i < measurements; i++) {
+        for (int t = 0; t <= CT_PERCENTILES; t++) {
+            if (cycles[i] <= thresholds[t]) welch_push(&tests[t], classes[i], (double)cycles[i]);
+        }
+    }
+
+    double worst = 0;
+    printf("  %-26s", c->name);
+    for (int t = 0; t <= CT_PERCENTILES; t++) {
+        double value = welch_t(&tests[t]);
+        printf(" %8.2f", value);
+        if (fabs(value) > worst) worst = fabs(value);
+    }
+    if (c->expect_leak) {
+        printf("   %s\n", worst > CT_THRESHOLD ? "leak, as expected" : "NO LEAK (expected one)");
+    } else {
+        printf("   %s\n", worst > CT_THRESHOLD ? "LEAK" : "ok");
+    }
+
+    free(classes);
+    free(xs);
+    free(ys);
+    free(cycles);
+    free(sorted);
+    return worst;
+}
+
+int main(int argc, char* argv[]) {
+    size_t measurements = 2000000;
+    const char* selected[32];
+    int selected_count = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--quick") == 0) measurements = 200000;
+        else if (selected_count < 32) selected[selected_count++] = argv[i];
+    }
+
+    printf("Welch t-statistics, fixed vs random inputs (%zu measurements, |t| > %.1f is a leak)\n",
+           measurements, CT_THRESHOLD);
+    printf("  %-26s %8s %8s %8s %8s %8s %8s\n", "primitive", "all", "p50", "p75", "p87", "p94", "p97");
+
+    int leaks = 0, controls = 0, missed = 0;
+    for (size_t k = 0; k < sizeof(ct_cases) / sizeof(ct_cases[0]); k++) {
+        bool run = selected_count == 0;
+        for (int i = 0; i < selected_count; i++) run |= strcmp(selected[i], ct_cases[k].name) == 0;
+        if (!run) continue;
+        bool leaked = run_case(&ct_cases[k], measurements) > CT_THRESHOLD;
+        if (ct_cases[k].expect_leak) {
+            controls++;
+            missed += !leaked;
+        } else {
+            leaks += leaked;
+        }
+    }
+
+    if (controls) printf("%d of %d expected leak(s) detected\n", controls - missed, controls);
+    printf("%d primitive(s) with timing leaks\n", leaks);
+    return leaks || missed ? 1 : 0;
+}
@@ -0,0 +1,230 @@
+// Checks the evaluation engines against evaluate(). Random expressions over
+// a, b, c and d, with a random set of public variables, are compiled and
+// run on random rows; rows that divide by zero are dropped first, since
+// evaluate() aborts on them. Engines:
+// - kernels: the batch engine with every kernel set this CPU supports.
+// - jit: the x86-64 JIT, where it is built in.
+// - bitsliced: the bitsliced engine with the ripple and the prefix
+//   circuits.
+// - shared: secret-shared evaluation among 2, 3 and 4 parties, with the
+//   levelized schedule and with MPC_SCHEDULE=serial.
+//
+// Usage: engine_check [--count N] [ENGINE...]   (default: every engine)
+
+#define MPC_INTERPRETER_NO_MAIN
+#include "interpreter.c"
+
+#define ENGINE_CHECK_ROWS 600
+
+typedef struct {
+    const char* name;
+    int count;  // expressions to draw
+    // Runs `prog` over the rows and returns the number of mismatches, after
+    // printing up to a few of them.
+    size_t (*run)(const Program* prog, const int32_t* const* cols, const int32_t* expected, size_t rows);
+} Engine;
+
+uint64_t rng_state = 0x2545F4914F6CDD1DULL;
+
+uint32_t random_bits(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 32);
+}
+
+int32_t random_value(void) {
+    uint32_t r = random_bits();
+    switch (r % 4) {
+        case 0: return (int32_t)random_bits();
+        case 1: return (int32_t)(random_bits() % 2001) - 1000;
+        case 2: return (int32_t)(random_bits() % 17) - 8;
+        default: return r & 4 ? INT32_MIN : INT32_MAX;
+    }
+}
+
+// Writes a random expression of at most 3^(3 - depth) leaves.
+void random_expression(char* out, size_t size, int depth) {
+    char left[1024], right[1024], third[1024];
+    int kind = depth >= 3 ? (int)(random_bits() % 2) : (int)(random_bits() % 12);
+    if (kind >= 2) random_expression(left, sizeof(left), depth + 1);
+    if (kind >= 4) random_expression(right, sizeof(right), depth + 1);
+    switch (kind) {
+        case 0: snprintf(out, size, "%c", "abcd"[random_bits() % 4]); break;
+        case 1: snprintf(out, size, "%d", (int)(random_bits() % 200) - 100); break;
+        case 2: snprintf(out, size, "absolute(%s)", left); break;
+        case 3: snprintf(out, size, "%s %c %d", left, "*/"[random_bits() % 2], 1 << (random_bits() % 6)); break;
+        case 4: snprintf(out, size, "(%s %c %s)", left, "+-*/"[random_bits() % 4], right); break;
+        case 5: snprintf(out, size, "max(%s, %s)", left, right); break;
+        case 6: snprintf(out, size, "min(%s, %s)", left, right); break;
+        case 7: snprintf(out, size, "equal(%s, %s)", left, right); break;
+        case 8: snprintf(out, size, "greater_than(%s, %s)", left, right); break;
+        case 9: snprintf(out, size, "while(greater_than(%s, x), x + 1, 3) - %s", left, right); break;
+        default:
+            random_expression(third, sizeof(third), depth + 1);
+            snprintf(out, size, "ifelse(greater_than(%s, %s), %s, 7)", left, right, third);
+            break;
+    }
+}
+
+size_t compare(const char* label, const int32_t* const* cols, const int32_t* expected, const int32_t* got,
+               size_t rows) {
+    size_t mismatches = 0;
+    for (size_t i = 0; i < rows; i++) {
+        if (got[i] == expected[i]) continue;
+        if (mismatches++ < 3) {
+            printf("  %s mismatch at a=%d b=%d c=%d d=%d: expected %d, got %d\n", label, cols[0][i], cols[1][i],
+                   cols[2][i], cols[3][i], expected[i], got[i]);
+        }
+    }
+    return mismatches;
+}
+
+size_t check_kernels(const Program* prog, const int32_t* const* cols, const int32_t* expected, size_t rows) {
+    size_t mismatches = 0;
+    int32_t* got = malloc(rows * sizeof(int32_t));
+    const BatchKernels* kernels[3];
+    int count = supported_batch_kernels(kernels);
+    for (int k = 0; k < count; k++) {
+        run_program_columns_with(prog, kernels[k], cols, got, rows);
+        mismatches += compare(kernels[k]->name, cols, expected, got, rows);
+    }
+    free(got);
+    return mismatches;
+}
+
+size_t check_jit(const Program* prog, const int32_t* const* cols, const int32_t* expected, size_t rows) {
+    JitProgram* jit = jit_compile(prog);
+    if (!jit) {
+#ifdef MPC_HAVE_JIT
+        printf("  jit_compile() declined the program\n");
+        return rows;
+#else
+        return 0;
+#endif
+    }
+    int32_t* got = malloc(rows * sizeof(int32_t));
+    run_jit_batch(jit, cols[0], cols[1], cols[2], cols[3], got, rows);
+    size_t mismatches = compare("jit", cols, expected, got, rows);
+    free(got);
+    jit_free(jit);
+    return mismatches;
+}
+
+size_t check_bitsliced(const Program* prog, const int32_t* const* cols, const int32_t* expected, size_t rows) {
+    static const BitsliceCircuits* circuits[] = { &ripple_circuits, &prefix_circuits };
+    size_t mismatches = 0;
+    int32_t* got = malloc(rows * sizeof(int32_t));
+    for (int k = 0; k < 2; k++) {
+        run_program_bitsliced_with(prog, circuits[k], cols[0], cols[1], cols[2], cols[3], got, rows);
+        mismatches += compare(k ? "prefix" : "ripple", cols, expected, got, rows);
+    }
+    free(got);
+    return mismatches;
+}
+
+size_t check_shared(const Program* prog, const int32_t* const* cols, const int32_t* expected, size_t rows) {
+    size_t mismatches = 0;
+    int32_t* got = malloc(rows * sizeof(int32_t));
+    for (int parties = 2; parties <= 4; parties++) {
+        for (int serial = 0; serial <= 1; serial++) {
+            char label[64];
+            snprintf(label, sizeof(label), "%d parties, %s", parties, serial ? "serial" : "levelized");
+            setenv("MPC_SCHEDULE", serial ? "serial" : "levelized", 1);
+            run_program_shared(prog, parties, cols[0], cols[1], cols[2], cols[3], got, rows, NULL);
+            mismatches += compare(label, cols, expected, got, rows);
+        }
+    }
+    unsetenv("MPC_SCHEDULE");
+    free(got);
+    return mismatches;
+}
+
+Engine engines[] = {
+    { "kernels", 300, check_kernels },
+    { "jit", 300, check_jit },
+    { "bitsliced", 200, check_bitsliced },
+    { "shared", 100, check_shared },
+};
+
+#define NUM_ENGINES (int)(sizeof(engines) / sizeof(engines[0]))
+
+// Draws an expression and rows, keeps the rows that do not divide by zero
+// and runs `engine` on them; false on any mismatch.
+bool check_expression(const Engine* engine) {
+    char expression[8192];
+    random_expression(expression, sizeof(expression), 0);
+    char public_names[5] = { 0 };
+    for (int v = 0, k = 0; v < NUM_VARIABLES; v++) {
+        if (random_bits() % 3 == 0) public_names[k++] = (char)('a' + v);
+    }
+
+    NodeArena arena = { NULL };
+    unsigned secret_vars = secret_variables(public_names);
+    ExprNode* ast = parse_with_secrecy(expression, &arena, secret_vars);
+    Program* prog = compile(prepare_expression(parse_with_secrecy(expression, &arena, secret_vars), &arena));
+
+    int32_t* data = malloc((NUM_VARIABLES + 1) * ENGINE_CHECK_ROWS * sizeof(int32_t));
+    int32_t* cols[NUM_VARIABLES];
+    for (int v = 0; v < NUM_VARIABLES; v++) cols[v] = data + (size_t)v * ENGINE_CHECK_ROWS;
+    int32_t* expected = data + NUM_VARIABLES * ENGINE_CHECK_ROWS;
+
+    // The batch engine's soft trap finds the rows that divide by zero
+    // without ending the process.
+    size_t rows = 0;
+    batch_trap_soft = true;
+    for (size_t i = 0; i < ENGINE_CHECK_ROWS; i++) {
+        const int32_t* row[NUM_VARIABLES];
+        for (int v = 0; v < NUM_VARIABLES; v++) {
+            cols[v][rows] = random_value();
+            row[v] = &cols[v][rows];
+        }
+        int32_t ignored;
+        batch_trapped = false;
+        run_program_columns(prog, row, &ignored, 1);
+        if (batch_trapped) continue;
+        expected[rows] = evaluate(ast, cols[0][rows], cols[1][rows], cols[2][rows], cols[3][rows]);
+        rows++;
+    }
+    batch_trap_soft = false;
+
+    size_t mismatches = rows ? engine->run(prog, (const int32_t* const*)cols, expected, rows) : 0;
+    if (mismatches) {
+        printf("%s: %zu mismatch(es) in %s (public: %s)\n", engine->name, mismatches, expression,
+               public_names[0] ? public_names : "none");
+    }
+
+    free(data);
+    free_program(prog);
+    arena_release(&arena);
+    return mismatches == 0;
+}
+
+int main(int argc, char* argv[]) {
+    int count = 0;
+    bool selected[NUM_ENGINES] = { false }, any = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            count = atoi(argv[++i]);
+            continue;
+        }
+        int e = 0;
+        while (e < NUM_ENGINES && strcmp(argv[i], engines[e].name) != 0) e++;
+        if (e == NUM_ENGINES) {
+            printf("Usage: %s [--count N] [ENGINE...]\n", argv[0]);
+            return 1;
+        }
+        selected[e] = any = true;
+    }
+
+    bool all_ok = true;
+    for (int e = 0; e < NUM_ENGINES; e++) {
+        if (any && !selected[e]) continue;
+        int n = count ? count : engines[e].count, failed = 0;
+        double start = mpc_seconds();
+        for (int i = 0; i < n; i++) failed += !check_expression(&engines[e]);
+        printf("%-10s %d expression(s), %d failed (%.1f s)\n", engines[e].name, n, failed, mpc_seconds() - start);
+        all_ok &= failed == 0;
+    }
+    return all_ok ? 0 : 1;
+}
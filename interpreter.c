@@ -1,9 +1,46 @@
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE  // CPU affinity for the parallel batch workers
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stddef.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define MPC_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MPC_HAVE_THREADS
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
+
+#if defined(__linux__) && defined(MPC_HAVE_THREADS)
+#define MPC_HAVE_SERVER
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#if defined(__x86_64__) && defined(__linux__)
+#define MPC_HAVE_JIT
+#include <sys/mman.h>
+#endif
 
 // Function Prototypes (Declarations) for functions used by others
 int absolute(int a);
@@ -73,6 +110,53 @@ int divide_signed(int a, int b) {
     return result;
 }
 
+// Variable-time versions for operands that are public: the native
+// instructions, returning exactly what multiply() and divide_signed() do.
+int multiply_public(int a, int b) {
+    return (int)((unsigned int)a * (unsigned int)b);
+}
+
+int divide_public(int a, int b) {
+    if (b == 0) return 0;
+    if (b == -1) return (int)(0u - (unsigned int)a);  // INT_MIN / -1 traps in hardware
+    return a / b;
+}
+
+// Restoring division in a fixed 32 steps with no data-dependent branches,
+// for secret operands. The carry out of the shifted remainder keeps it
+// exact for denominators above 2^31.
+uint32_t divide_unsigned_oblivious(uint32_t numerator, uint32_t denominator) {
+    uint32_t quotient = 0;
+    uint32_t remainder = 0;
+
+    for (int i = 31; i >= 0; i--) {
+        uint32_t carry = remainder >> 31;
+        remainder = (remainder << 1) | ((numerator >> i) & 1);
+        uint32_t ge = -(carry | (uint32_t)(remainder >= denominator));
+        remainder -= denominator & ge;
+        quotient |= (ge & 1u) << i;
+    }
+
+    return quotient & -(uint32_t)(denominator != 0);
+}
+
+int divide_signed_oblivious(int a, int b) {
+    uint32_t sign = (uint32_t)((a ^ b) >> 31);
+    uint32_t q = divide_unsigned_oblivious((uint32_t)absolute(a), (uint32_t)absolute(b));
+    return (int)((q ^ sign) - sign);
+}
+
+int shift_left(int a, int k) {
+    return (int)((unsigned int)a << k);
+}
+
+// a / 2^k rounded toward zero like divide_signed(): negative values are
+// biased by 2^k - 1 before the arithmetic shift, without branching.
+int divide_pow2(int a, int k) {
+    int bias = (a >> 31) & (int)((1u << k) - 1);
+    return (a + bias) >> k;
+}
+
 int absolute(int a) {
     int mask = a >> 31;
     return (a + mask) ^ mask;
@@ -110,18 +194,25 @@ typedef enum {
 } NodeType;
 
 typedef enum {
-    OP_ADD, OP_SUB, OP_MUL, OP_DIV
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV,
+    OP_SHIFT_LEFT, OP_DIVIDE_POW2  // introduced by optimize(); right operand is a constant
 } OperatorType;
 
 typedef enum {
     FUNC_MAX, FUNC_MIN, FUNC_EQUAL, FUNC_GREATER_THAN,
-    FUNC_IFELSE, FUNC_ABSOLUTE
+    FUNC_IFELSE, FUNC_ABSOLUTE,
+    FUNC_WHILE  // while(cond, body, n); expanded by prepare_expression()
 } FunctionType;
 
+// Every node records whether its value depends on a secret variable;
+// constants are public and an operator or function is secret when any
+// operand is. Secret nodes are evaluated with the oblivious primitives,
+// public ones may use the faster variable-time versions.
 typedef struct ExprNode {
     NodeType type;
+    bool secret;
     union {
-        char var_name;
+        int slot;  // variable: its index in the row, or LOOP_STATE_SLOT
         int constant;
         struct {
             OperatorType op;
@@ -136,6 +227,104 @@ typedef struct ExprNode {
     };
 } ExprNode;
 
+// while(cond, body, n) is an oblivious loop over one value, named x in cond
+// and body, that starts at 0: n times over, x becomes body where cond is
+// nonzero and keeps its value otherwise. n must be a literal. In nested
+// loops x is the innermost loop's value.
+#define LOOP_STATE "x"
+#define LOOP_STATE_SLOT -1
+#define WHILE_MAX_ITERATIONS 64
+
+// Bit i of a secrecy mask marks the variable in slot i secret; a, b, c and
+// d are slots 0-3. Variables in slots past 31 are always secret.
+#define ALL_VARIABLES_SECRET 0xFFFFFFFFu
+
+bool variable_is_secret(int slot, unsigned secret_vars) {
+    if (slot < 0 || slot >= 32) return true;
+    return (secret_vars >> slot) & 1;
+}
+
+// Secrecy mask with every variable secret except those named in `names`
+// (e.g. "ab"), as given by MPC_PUBLIC.
+unsigned secret_variables(const char* names) {
+    unsigned secret_vars = ALL_VARIABLES_SECRET;
+    for (; names && *names; names++) {
+        if (*names >= 'a' && *names <= 'd') secret_vars &= ~(1u << (*names - 'a'));
+    }
+    return secret_vars;
+}
+
+// --- Symbol Table ---
+
+// Maps variable names to dense slots: a variable is loaded as row[slot] by
+// evaluate_row() and is register `slot` of a compiled program, so lookups
+// by name happen only while parsing. Every table starts with a, b, c and d
+// in slots 0-3, which keeps the four-argument entry points working; any
+// other identifier takes the next slot the first time it is parsed. The
+// loop state x is never entered.
+
+#define NUM_VARIABLES 4  // a, b, c, d: the slots every table starts with
+
+typedef struct {
+    char** names;  // by slot
+    int count;
+    int capacity;
+    int* index;  // open addressing by name hash: slot + 1, or 0 when free
+    int index_capacity;
+} SymbolTable;
+
+uint64_t symbol_hash(const char* name) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *name; name++) h = (h ^ (unsigned char)*name) * 0x100000001b3ULL;
+    return h;
+}
+
+// The index position holding `name`, or the free one where it would go.
+int symbol_position(const SymbolTable* table, const char* name) {
+    int mask = table->index_capacity - 1;
+    int k = (int)(symbol_hash(name) & (uint64_t)mask);
+    while (table->index[k] && strcmp(table->names[table->index[k] - 1], name) != 0) k = (k + 1) & mask;
+    return k;
+}
+
+int symbol_lookup(const SymbolTable* table, const char* name) {
+    return table->index_capacity ? table->index[symbol_position(table, name)] - 1 : -1;
+}
+
+int symbol_intern(SymbolTable* table, const char* name) {
+    if (2 * (table->count + 1) > table->index_capacity) {
+        free(table->index);
+        table->index_capacity = table->index_capacity ? table->index_capacity * 2 : 16;
+        table->index = calloc((size_t)table->index_capacity, sizeof(int));
+        for (int slot = 0; slot < table->count; slot++) {
+            table->index[symbol_position(table, table->names[slot])] = slot + 1;
+        }
+    }
+
+    int k = symbol_position(table, name);
+    if (table->index[k]) return table->index[k] - 1;
+    if (table->count == table->capacity) {
+        table->capacity = table->capacity ? table->capacity * 2 : 16;
+        table->names = realloc(table->names, (size_t)table->capacity * sizeof(char*));
+    }
+    table->names[table->count] = strcpy(malloc(strlen(name) + 1), name);
+    table->index[k] = ++table->count;
+    return table->count - 1;
+}
+
+void symbol_table_init(SymbolTable* table) {
+    memset(table, 0, sizeof(*table));
+    const char* fixed[] = { "a", "b", "c", "d" };
+    for (int v = 0; v < NUM_VARIABLES; v++) symbol_intern(table, fixed[v]);
+}
+
+void symbol_table_free(SymbolTable* table) {
+    for (int slot = 0; slot < table->count; slot++) free(table->names[slot]);
+    free(table->names);
+    free(table->index);
+    memset(table, 0, sizeof(*table));
+}
+
 typedef enum {
     TOKEN_VARIABLE, TOKEN_NUMBER, TOKEN_OPERATOR, TOKEN_LPAREN, TOKEN_RPAREN,
     TOKEN_FUNCTION, TOKEN_COMMA, TOKEN_EOF
@@ -146,16 +335,80 @@ typedef struct {
     char value[32];
 } Token;
 
+#define MAX_TOKENS 1024
+
+// --- Node Arena ---
+
+// AST nodes for one parse are bump-allocated from a chain of contiguous
+// chunks and released together. arena_reset() keeps the first chunk, so a
+// long-running loop stops touching malloc once it has seen its largest tree.
+
+#define ARENA_FIRST_CHUNK 64
+
+typedef struct ArenaChunk {
+    struct ArenaChunk* next;
+    int used;
+    int capacity;
+    ExprNode nodes[];
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk* head;
+} NodeArena;
+
+ExprNode* arena_alloc(NodeArena* arena) {
+    ArenaChunk* chunk = arena->head;
+    if (!chunk || chunk->used == chunk->capacity) {
+        int capacity = chunk ? chunk->capacity * 2 : ARENA_FIRST_CHUNK;
+        ArenaChunk* fresh = malloc(sizeof(ArenaChunk) + (size_t)capacity * sizeof(ExprNode));
+        if (!fresh) {
+            printf("Error: Out of memory allocating expression nodes.\n");
+            exit(1);
+        }
+        fresh->next = chunk;
+        fresh->used = 0;
+        fresh->capacity = capacity;
+        arena->head = chunk = fresh;
+    }
+    return &chunk->nodes[chunk->used++];
+}
+
+// Drops every node allocated so far but keeps the largest chunk for reuse.
+void arena_reset(NodeArena* arena) {
+    ArenaChunk* chunk = arena->head;
+    if (!chunk) return;
+
+    ArenaChunk* rest = chunk->next;
+    while (rest) {
+        ArenaChunk* next = rest->next;
+        free(rest);
+        rest = next;
+    }
+    chunk->next = NULL;
+    chunk->used = 0;
+}
+
+void arena_release(NodeArena* arena) {
+    arena_reset(arena);
+    free(arena->head);
+    arena->head = NULL;
+}
+
 typedef struct {
     Token* tokens;
     int count;
     int pos;
+    NodeArena* arena;
+    unsigned secret_vars;
+    int loop_depth;  // enclosing while() calls, where 'x' is defined
+    SymbolTable* symbols;  // NULL: only a, b, c and d
 } Parser;
 
 bool is_function_name(const char* word) {
     return strcmp(word, "max") == 0 || strcmp(word, "min") == 0 ||
            strcmp(word, "equal") == 0 || strcmp(word, "greater_than") == 0 ||
-           strcmp(word, "ifelse") == 0 || strcmp(word, "absolute") == 0;
+           strcmp(word, "ifelse") == 0 || strcmp(word, "absolute") == 0 ||
+           strcmp(word, "while") == 0;
 }
 
 int tokenize(const char* expr, Token tokens[]) {
@@ -166,11 +419,20 @@ int tokenize(const char* expr, Token tokens[]) {
             pos++;
             continue;
         }
+        if (count == MAX_TOKENS - 1) {
+            printf("Error: Expression too long (max %d tokens).\n", MAX_TOKENS - 1);
+            exit(1);
+        }
         
-        if (isalpha(expr[pos])) {
+        if (isalpha(expr[pos]) || expr[pos] == '_') {
             int start = pos;
             while (isalnum(expr[pos]) || expr[pos] == '_') pos++;
             int len = pos - start;
+            if (len >= (int)sizeof(tokens[count].value)) {
+                printf("Error: Name '%.*s' is too long (max %d characters).\n", len, &expr[start],
+                       (int)sizeof(tokens[count].value) - 1);
+                exit(1);
+            }
             strncpy(tokens[count].value, &expr[start], len);
             tokens[count].value[len] = '\0';
             tokens[count].type = is_function_name(tokens[count].value) ?
@@ -182,6 +444,10 @@ int tokenize(const char* expr, Token tokens[]) {
             if (expr[pos] == '-') pos++;
             while (isdigit(expr[pos])) pos++;
             int len = pos - start;
+            if (len >= (int)sizeof(tokens[count].value)) {
+                printf("Error: Number '%.*s' is too long.\n", len, &expr[start]);
+                exit(1);
+            }
             strncpy(tokens[count].value, &expr[start], len);
             tokens[count].value[len] = '\0';
             tokens[count++].type = TOKEN_NUMBER;
@@ -205,36 +471,41 @@ int tokenize(const char* expr, Token tokens[]) {
     return count;
 }
 
-ExprNode* create_node_variable(char var_name) {
-    ExprNode* node = malloc(sizeof(ExprNode));
+ExprNode* create_node_variable(NodeArena* arena, int slot, bool secret) {
+    ExprNode* node = arena_alloc(arena);
     node->type = NODE_VARIABLE;
-    node->var_name = var_name;
+    node->secret = secret;
+    node->slot = slot;
     return node;
 }
 
-ExprNode* create_node_constant(int value) {
-    ExprNode* node = malloc(sizeof(ExprNode));
+ExprNode* create_node_constant(NodeArena* arena, int value) {
+    ExprNode* node = arena_alloc(arena);
     node->type = NODE_CONSTANT;
+    node->secret = false;
     node->constant = value;
     return node;
 }
 
-ExprNode* create_node_operator(OperatorType op, ExprNode* left, ExprNode* right) {
-    ExprNode* node = malloc(sizeof(ExprNode));
+ExprNode* create_node_operator(NodeArena* arena, OperatorType op, ExprNode* left, ExprNode* right) {
+    ExprNode* node = arena_alloc(arena);
     node->type = NODE_OPERATOR;
+    node->secret = left->secret || right->secret;
     node->operation.op = op;
     node->operation.left = left;
     node->operation.right = right;
     return node;
 }
 
-ExprNode* create_node_function(FunctionType func, ExprNode** args, int argc) {
-    ExprNode* node = malloc(sizeof(ExprNode));
+ExprNode* create_node_function(NodeArena* arena, FunctionType func, ExprNode** args, int argc) {
+    ExprNode* node = arena_alloc(arena);
     node->type = NODE_FUNCTION;
     node->function.func = func;
     node->function.argc = argc;
+    node->secret = false;
     for (int i = 0; i < argc; i++) {
         node->function.args[i] = args[i];
+        node->secret |= args[i]->secret;
     }
     return node;
 }
@@ -258,6 +529,7 @@ FunctionType func_type(const char* name) {
     if (strcmp(name, "greater_than") == 0) return FUNC_GREATER_THAN;
     if (strcmp(name, "ifelse") == 0) return FUNC_IFELSE;
     if (strcmp(name, "absolute") == 0) return FUNC_ABSOLUTE;
+    if (strcmp(name, "while") == 0) return FUNC_WHILE;
     printf("Error: Unknown function: %s\n", name);
     exit(1);
 }
@@ -287,6 +559,8 @@ ExprNode* parse_function(Parser* p) {
     
     ExprNode* args[3];
     int argc = 0;
+    bool loop = strcmp(func_token.value, "while") == 0;
+    p->loop_depth += loop;
     
     if (current_token(p).type != TOKEN_RPAREN) {
         args[argc++] = parse_expression(p);
@@ -300,6 +574,7 @@ ExprNode* parse_function(Parser* p) {
             args[argc++] = parse_expression(p);
         }
     }
+    p->loop_depth -= loop;
 
     if (strcmp(func_token.value, "max") == 0 || strcmp(func_token.value, "min") == 0 ||
         strcmp(func_token.value, "equal") == 0 || strcmp(func_token.value, "greater_than") == 0) {
@@ -307,11 +582,16 @@ ExprNode* parse_function(Parser* p) {
             printf("Error: Function '%s' expects 2 arguments, but got %d.\n", func_token.value, argc);
             exit(1);
         }
-    } else if (strcmp(func_token.value, "ifelse") == 0) {
+    } else if (strcmp(func_token.value, "ifelse") == 0 || loop) {
         if (argc != 3) {
             printf("Error: Function '%s' expects 3 arguments, but got %d.\n", func_token.value, argc);
             exit(1);
         }
+        if (loop && (args[2]->type != NODE_CONSTANT || args[2]->constant < 0 ||
+                     args[2]->constant > WHILE_MAX_ITERATIONS)) {
+            printf("Error: The bound of 'while' must be a number from 0 to %d.\n", WHILE_MAX_ITERATIONS);
+            exit(1);
+        }
     } else if (strcmp(func_token.value, "absolute") == 0) {
         if (argc != 1) {
             printf("Error: Function '%s' expects 1 argument, but got %d.\n", func_token.value, argc);
@@ -325,7 +605,7 @@ ExprNode* parse_function(Parser* p) {
     }
     advance_token(p);
     
-    return create_node_function(func_type(func_token.value), args, argc);
+    return create_node_function(p->arena, func_type(func_token.value), args, argc);
 }
 
 ExprNode* parse_factor(Parser* p) {
@@ -334,15 +614,27 @@ ExprNode* parse_factor(Parser* p) {
     switch (token.type) {
         case TOKEN_NUMBER:
             advance_token(p);
-            return create_node_constant(atoi(token.value));
+            return create_node_constant(p->arena, atoi(token.value));
             
-        case TOKEN_VARIABLE:
+        case TOKEN_VARIABLE: {
             advance_token(p);
-            if (strlen(token.value) != 1) {
-                printf("Error: Variables must be single characters (a, b, c, d). Invalid variable: '%s'.\n", token.value);
+            if (strcmp(token.value, LOOP_STATE) == 0) {
+                if (p->loop_depth == 0) {
+                    printf("Error: '%s' is the state of a while() loop and cannot be used outside one.\n", LOOP_STATE);
+                    exit(1);
+                }
+                return create_node_variable(p->arena, LOOP_STATE_SLOT, true);
+            }
+            int slot = p->symbols ? symbol_intern(p->symbols, token.value) : -1;
+            if (!p->symbols && strlen(token.value) == 1 && token.value[0] >= 'a' && token.value[0] <= 'd') {
+                slot = token.value[0] - 'a';
+            }
+            if (slot < 0) {
+                printf("Error: Variables must be a, b, c or d. Invalid variable: '%s'.\n", token.value);
                 exit(1);
             }
-            return create_node_variable(token.value[0]);
+            return create_node_variable(p->arena, slot, variable_is_secret(slot, p->secret_vars));
+        }
             
         case TOKEN_FUNCTION:
             return parse_function(p);
@@ -371,7 +663,7 @@ ExprNode* parse_term(Parser* p) {
         if (op_token.value[0] == '*' || op_token.value[0] == '/') {
             advance_token(p);
             ExprNode* right = parse_factor(p);
-            left = create_node_operator(op_type(op_token.value[0]), left, right);
+            left = create_node_operator(p->arena, op_type(op_token.value[0]), left, right);
         } else {
             break;
         }
@@ -388,7 +680,7 @@ ExprNode* parse_expression(Parser* p) {
         if (op_token.value[0] == '+' || op_token.value[0] == '-') {
             advance_token(p);
             ExprNode* right = parse_term(p);
-            left = create_node_operator(op_type(op_token.value[0]), left, right);
+            left = create_node_operator(p->arena, op_type(op_token.value[0]), left, right);
         } else {
             break;
         }
@@ -397,11 +689,13 @@ ExprNode* parse_expression(Parser* p) {
     return left;
 }
 
-ExprNode* parse(const char* expression) {
-    Token tokens[100];
+// Parses with variables named by `symbols`, which gains an entry for every
+// new name; with no table only a, b, c and d are accepted.
+ExprNode* parse_with_symbols(const char* expression, NodeArena* arena, SymbolTable* symbols, unsigned secret_vars) {
+    Token tokens[MAX_TOKENS];
     int token_count = tokenize(expression, tokens);
     
-    Parser parser = { tokens, token_count, 0 };
+    Parser parser = { tokens, token_count, 0, arena, secret_vars, 0, symbols };
     ExprNode* ast = parse_expression(&parser);
 
     if (parser.pos < parser.count - 1) {
@@ -411,48 +705,65 @@ ExprNode* parse(const char* expression) {
     return ast;
 }
 
+ExprNode* parse_with_secrecy(const char* expression, NodeArena* arena, unsigned secret_vars) {
+    return parse_with_symbols(expression, arena, NULL, secret_vars);
+}
+
+// Parses with every variable secret.
+ExprNode* parse(const char* expression, NodeArena* arena) {
+    return parse_with_secrecy(expression, arena, ALL_VARIABLES_SECRET);
+}
+
 // --- Evaluation ---
 
-int evaluate(ExprNode* node, int a, int b, int c, int d) {
+// `row` holds the variables by slot; `state` is the value of x in the
+// innermost enclosing while().
+int evaluate_in_loop(ExprNode* node, const int32_t* row, int state) {
     if (!node) return 0;
     
     switch (node->type) {
         case NODE_VARIABLE:
-            switch (node->var_name) {
-                case 'a': return a;
-                case 'b': return b;
-                case 'c': return c;
-                case 'd': return d;
-                default:
-                    printf("Error: Unknown variable: '%c'.\n", node->var_name);
-                    exit(1);
-            }
+            return node->slot == LOOP_STATE_SLOT ? state : row[node->slot];
             
         case NODE_CONSTANT:
             return node->constant;
             
         case NODE_OPERATOR: {
-            int left_val = evaluate(node->operation.left, a, b, c, d);
-            int right_val = evaluate(node->operation.right, a, b, c, d);
+            int left_val = evaluate_in_loop(node->operation.left, row, state);
+            int right_val = evaluate_in_loop(node->operation.right, row, state);
             
             switch (node->operation.op) {
                 case OP_ADD: return left_val + right_val;
                 case OP_SUB: return subtract(left_val, right_val);
-                case OP_MUL: return multiply(left_val, right_val);
+                case OP_MUL:
+                    return node->secret ? multiply(left_val, right_val) : multiply_public(left_val, right_val);
                 case OP_DIV: 
                     if (right_val == 0) {
                         printf("Error: Division by zero.\n");
                         exit(1);
                     }
-                    return divide_signed(left_val, right_val);
+                    return node->secret ? divide_signed_oblivious(left_val, right_val)
+                                        : divide_public(left_val, right_val);
+                case OP_SHIFT_LEFT: return shift_left(left_val, right_val);
+                case OP_DIVIDE_POW2: return divide_pow2(left_val, right_val);
                 default: return 0;
             }
         }
         
         case NODE_FUNCTION: {
+            if (node->function.func == FUNC_WHILE) {
+                // Every iteration runs the body, as the unrolled program does.
+                int x = 0;
+                for (int i = 0; i < node->function.args[2]->constant; i++) {
+                    int running = evaluate_in_loop(node->function.args[0], row, x);
+                    x = ifelse(evaluate_in_loop(node->function.args[1], row, x), x, running != 0);
+                }
+                return x;
+            }
+
             int args[3];
             for (int i = 0; i < node->function.argc; i++) {
-                args[i] = evaluate(node->function.args[i], a, b, c, d);
+                args[i] = evaluate_in_loop(node->function.args[i], row, state);
             }
             
             switch (node->function.func) {
@@ -475,95 +786,6509 @@ int evaluate(ExprNode* node, int a, int b, int c, int d) {
     }
 }
 
-// --- Memory Management ---
+int evaluate_row(ExprNode* node, const int32_t* row) {
+    return evaluate_in_loop(node, row, 0);
+}
 
-void free_tree(ExprNode* node) {
-    if (!node) return;
-    
+int evaluate(ExprNode* node, int a, int b, int c, int d) {
+    const int32_t row[NUM_VARIABLES] = { a, b, c, d };
+    return evaluate_in_loop(node, row, 0);
+}
+
+// --- Optimization ---
+
+// Rewrites a parsed tree before compilation: folds constant subtrees,
+// applies algebraic identities and turns multiplication/division by powers
+// of two into shifts. Every decision depends only on the tree's shape and
+// its literal constants, never on variable values, so the rewritten tree is
+// as data-oblivious as the original. Subtrees that may divide by zero are
+// never dropped, so optimized trees fail exactly where the original would.
+
+bool is_constant(const ExprNode* node, int value) {
+    return node->type == NODE_CONSTANT && node->constant == value;
+}
+
+// Exponent k when `node` is the constant 2^k with 1 <= k <= 30, otherwise -1.
+int power_of_two_exponent(const ExprNode* node) {
+    if (node->type != NODE_CONSTANT || node->constant < 2) return -1;
+    unsigned int value = (unsigned int)node->constant;
+    if (value & (value - 1)) return -1;
+    return __builtin_ctz(value);
+}
+
+bool trees_equal(const ExprNode* x, const ExprNode* y) {
+    if (x == y) return true;
+    if (x->type != y->type) return false;
+
+    switch (x->type) {
+        case NODE_VARIABLE: return x->slot == y->slot && x->secret == y->secret;
+        case NODE_CONSTANT: return x->constant == y->constant;
+        case NODE_OPERATOR:
+            return x->operation.op == y->operation.op &&
+                   trees_equal(x->operation.left, y->operation.left) &&
+                   trees_equal(x->operation.right, y->operation.right);
+        case NODE_FUNCTION:
+            if (x->function.func != y->function.func || x->function.argc != y->function.argc) return false;
+            for (int i = 0; i < x->function.argc; i++) {
+                if (!trees_equal(x->function.args[i], y->function.args[i])) return false;
+            }
+            return true;
+        default: return false;
+    }
+}
+
+// True when evaluating `node` can abort with a division by zero.
+bool may_trap(const ExprNode* node) {
+    switch (node->type) {
+        case NODE_OPERATOR:
+            return (node->operation.op == OP_DIV && !(node->operation.right->type == NODE_CONSTANT &&
+                                                      node->operation.right->constant != 0)) ||
+                   may_trap(node->operation.left) || may_trap(node->operation.right);
+        case NODE_FUNCTION:
+            for (int i = 0; i < node->function.argc; i++) {
+                if (may_trap(node->function.args[i])) return true;
+            }
+            return false;
+        default: return false;
+    }
+}
+
+bool all_constant_children(const ExprNode* node) {
+    if (node->type == NODE_OPERATOR) {
+        return node->operation.left->type == NODE_CONSTANT && node->operation.right->type == NODE_CONSTANT;
+    }
+    for (int i = 0; i < node->function.argc; i++) {
+        if (node->function.args[i]->type != NODE_CONSTANT) return false;
+    }
+    return true;
+}
+
+ExprNode* optimize_operator(ExprNode* node, NodeArena* arena) {
+    ExprNode* left = node->operation.left;
+    ExprNode* right = node->operation.right;
+    int k;
+
+    switch (node->operation.op) {
+        case OP_ADD:
+            if (is_constant(right, 0)) return left;
+            if (is_constant(left, 0)) return right;
+            break;
+        case OP_SUB:
+            if (is_constant(right, 0)) return left;
+            if (trees_equal(left, right) && !may_trap(left)) return create_node_constant(arena, 0);
+            break;
+        case OP_MUL:
+            if (is_constant(right, 1)) return left;
+            if (is_constant(left, 1)) return right;
+            if (is_constant(right, 0) && !may_trap(left)) return right;
+            if (is_constant(left, 0) && !may_trap(right)) return left;
+            if ((k = power_of_two_exponent(right)) > 0) {
+                return create_node_operator(arena, OP_SHIFT_LEFT, left, create_node_constant(arena, k));
+            }
+            if ((k = power_of_two_exponent(left)) > 0) {
+                return create_node_operator(arena, OP_SHIFT_LEFT, right, create_node_constant(arena, k));
+            }
+            break;
+        case OP_DIV:
+            if (is_constant(right, 1)) return left;
+            if ((k = power_of_two_exponent(right)) > 0) {
+                return create_node_operator(arena, OP_DIVIDE_POW2, left, create_node_constant(arena, k));
+            }
+            break;
+        default:
+            break;
+    }
+    return node;
+}
+
+ExprNode* optimize_function(ExprNode* node, NodeArena* arena) {
+    ExprNode** args = node->function.args;
+
+    switch (node->function.func) {
+        case FUNC_MAX:
+        case FUNC_MIN:
+            if (trees_equal(args[0], args[1])) return args[0];
+            break;
+        case FUNC_EQUAL:
+            if (trees_equal(args[0], args[1]) && !may_trap(args[0])) return create_node_constant(arena, 1);
+            break;
+        case FUNC_GREATER_THAN:
+            if (trees_equal(args[0], args[1]) && !may_trap(args[0])) return create_node_constant(arena, 0);
+            break;
+        case FUNC_IFELSE:
+            // A literal condition is public, so picking a branch here leaks nothing.
+            if (args[2]->type == NODE_CONSTANT) {
+                ExprNode* kept = args[2]->constant != 0 ? args[0] : args[1];
+                ExprNode* dropped = args[2]->constant != 0 ? args[1] : args[0];
+                if (!may_trap(dropped)) return kept;
+            }
+            if (trees_equal(args[0], args[1]) && !may_trap(args[2])) return args[0];
+            break;
+        case FUNC_ABSOLUTE:
+            if (args[0]->type == NODE_FUNCTION && args[0]->function.func == FUNC_ABSOLUTE) return args[0];
+            break;
+        default:
+            break;
+    }
+    return node;
+}
+
+// Optimizes bottom-up. New nodes come from `arena`; the input tree is
+// rewritten in place and may share nodes with the result.
+ExprNode* optimize(ExprNode* node, NodeArena* arena) {
     if (node->type == NODE_OPERATOR) {
-        free_tree(node->operation.left);
-        free_tree(node->operation.right);
+        node->operation.left = optimize(node->operation.left, arena);
+        node->operation.right = optimize(node->operation.right, arena);
     } else if (node->type == NODE_FUNCTION) {
         for (int i = 0; i < node->function.argc; i++) {
-            free_tree(node->function.args[i]);
+            node->function.args[i] = optimize(node->function.args[i], arena);
         }
+    } else {
+        return node;
     }
-    
-    free(node);
+
+    if (all_constant_children(node) && !may_trap(node)) {
+        return create_node_constant(arena, evaluate(node, 0, 0, 0, 0));
+    }
+    return node->type == NODE_OPERATOR ? optimize_operator(node, arena) : optimize_function(node, arena);
 }
 
-// --- Main Program ---
+// --- Common Subexpression Elimination ---
 
-// Helper function to read an integer safely
-int read_int_input(const char* prompt) {
-    char buffer[100];
-    int value;
-    while (1) {
-        printf("%s", prompt);
-        if (fgets(buffer, sizeof(buffer), stdin) == NULL) {
-            printf("Error reading input. Exiting.\n");
-            exit(1);
+// Hash-conses a tree into a DAG: structurally identical subtrees collapse to
+// one node, which compile() then evaluates once per row. Children are
+// canonicalized first, so two nodes are identical exactly when their payload
+// and child pointers match.
+
+size_t pointer_hash(const void* ptr) {
+    uint64_t h = (uint64_t)(uintptr_t)ptr * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h >> 17);
+}
+
+typedef struct {
+    ExprNode** slots;
+    size_t capacity;
+    size_t count;
+} InternTable;
+
+uint64_t node_shallow_hash(const ExprNode* node) {
+    uint64_t h = (uint64_t)node->type * 0x9E3779B97F4A7C15ULL;
+    switch (node->type) {
+        case NODE_VARIABLE: h ^= (uint64_t)(uint32_t)node->slot; break;
+        case NODE_CONSTANT: h ^= (uint64_t)(uint32_t)node->constant; break;
+        case NODE_OPERATOR:
+            h ^= (uint64_t)node->operation.op;
+            h = h * 31 + pointer_hash(node->operation.left);
+            h = h * 31 + pointer_hash(node->operation.right);
+            break;
+        case NODE_FUNCTION:
+            h ^= (uint64_t)node->function.func << 8;
+            for (int i = 0; i < node->function.argc; i++) h = h * 31 + pointer_hash(node->function.args[i]);
+            break;
+    }
+    return h ^ (h >> 29);
+}
+
+bool node_shallow_equal(const ExprNode* x, const ExprNode* y) {
+    if (x->type != y->type) return false;
+    switch (x->type) {
+        case NODE_VARIABLE: return x->slot == y->slot;
+        case NODE_CONSTANT: return x->constant == y->constant;
+        case NODE_OPERATOR:
+            return x->operation.op == y->operation.op &&
+                   x->operation.left == y->operation.left && x->operation.right == y->operation.right;
+        case NODE_FUNCTION:
+            if (x->function.func != y->function.func || x->function.argc != y->function.argc) return false;
+            for (int i = 0; i < x->function.argc; i++) {
+                if (x->function.args[i] != y->function.args[i]) return false;
+            }
+            return true;
+        default: return false;
+    }
+}
+
+ExprNode* intern_node(InternTable* table, ExprNode* node) {
+    if (2 * (table->count + 1) > table->capacity) {
+        ExprNode** old = table->slots;
+        size_t old_capacity = table->capacity;
+        table->capacity = old_capacity ? old_capacity * 2 : 64;
+        table->slots = calloc(table->capacity, sizeof(ExprNode*));
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (!old[i]) continue;
+            size_t k = node_shallow_hash(old[i]) & (table->capacity - 1);
+            while (table->slots[k]) k = (k + 1) & (table->capacity - 1);
+            table->slots[k] = old[i];
         }
-        if (sscanf(buffer, "%d", &value) == 1) {
-            return value;
-        } else {
-            printf("Invalid input. Please enter an integer.\n");
+        free(old);
+    }
+
+    size_t k = node_shallow_hash(node) & (table->capacity - 1);
+    for (; table->slots[k]; k = (k + 1) & (table->capacity - 1)) {
+        if (node_shallow_equal(table->slots[k], node)) return table->slots[k];
+    }
+    table->slots[k] = node;
+    table->count++;
+    return node;
+}
+
+ExprNode* hash_cons_node(InternTable* table, ExprNode* node) {
+    if (node->type == NODE_OPERATOR) {
+        node->operation.left = hash_cons_node(table, node->operation.left);
+        node->operation.right = hash_cons_node(table, node->operation.right);
+    } else if (node->type == NODE_FUNCTION) {
+        for (int i = 0; i < node->function.argc; i++) {
+            node->function.args[i] = hash_cons_node(table, node->function.args[i]);
         }
     }
+    return intern_node(table, node);
 }
 
-void print_usage() {
-    printf("MPC Expression Interpreter\n");
-    printf("Available variables: a, b, c, d (single character)\n");
-    printf("Available functions: max(x, y), min(x, y), equal(x, y), greater_than(x, y), ifelse(condition, true_val, false_val), absolute(x)\n");
-    printf("Available operators: +, -, *, /\n");
-    printf("Example: max(a * b, c + 5)\n");
-    printf("Enter 'quit' to exit\n\n");
+// Rewrites child pointers in place and returns the canonical root.
+ExprNode* hash_cons(ExprNode* root) {
+    InternTable table = { NULL, 0, 0 };
+    ExprNode* result = hash_cons_node(&table, root);
+    free(table.slots);
+    return result;
 }
 
-int main() {
-    print_usage();
-    
-    char input[256];
-    int a, b, c, d;
-    
-    a = read_int_input("Enter value for a: ");
-    b = read_int_input("Enter value for b: ");
-    c = read_int_input("Enter value for c: ");
-    d = read_int_input("Enter value for d: ");
-    
-    printf("\nVariables: a=%d, b=%d, c=%d, d=%d\n\n", a, b, c, d);
-    
-    while (1) {
-        printf("Enter expression: ");
-        if (fgets(input, sizeof(input), stdin) == NULL) {
-            printf("Error reading input. Exiting.\n");
-            break;
+// --- Loop Unrolling ---
+
+// Expands each while() into n copies of its step, x_{k+1} = ifelse(body(x_k),
+// x_k, cond(x_k)) with x_0 = 0, so compile() and every engine after it see
+// plain nodes, and loops batch, vectorize and share like the rest of the
+// expression. The copies form a DAG: each x_k is referenced by the next
+// step, so the expansion is memoized on (node, x_k) and never walks a
+// subtree twice for the same state. New nodes are interned alongside the
+// originals and folded when their operands are constants; the first steps
+// of a loop that starts from a literal usually fold away entirely.
+
+typedef struct {
+    const ExprNode* node;
+    const ExprNode* state;
+    ExprNode* result;
+} UnrollEntry;
+
+typedef struct {
+    NodeArena* arena;
+    InternTable nodes;
+    UnrollEntry* memo;
+    size_t capacity;
+    size_t count;
+} Unroller;
+
+bool contains_loop(const ExprNode* node) {
+    if (node->type == NODE_OPERATOR) return contains_loop(node->operation.left) || contains_loop(node->operation.right);
+    if (node->type != NODE_FUNCTION) return false;
+    if (node->function.func == FUNC_WHILE) return true;
+    for (int i = 0; i < node->function.argc; i++) {
+        if (contains_loop(node->function.args[i])) return true;
+    }
+    return false;
+}
+
+void intern_tree(InternTable* table, ExprNode* node) {
+    if (node->type == NODE_OPERATOR) {
+        intern_tree(table, node->operation.left);
+        intern_tree(table, node->operation.right);
+    } else if (node->type == NODE_FUNCTION) {
+        for (int i = 0; i < node->function.argc; i++) intern_tree(table, node->function.args[i]);
+    }
+    intern_node(table, node);
+}
+
+UnrollEntry* unroll_entry(Unroller* u, const ExprNode* node, const ExprNode* state) {
+    if (2 * (u->count + 1) > u->capacity) {
+        UnrollEntry* old = u->memo;
+        size_t old_capacity = u->capacity;
+        u->capacity = old_capacity ? old_capacity * 2 : 256;
+        u->memo = calloc(u->capacity, sizeof(UnrollEntry));
+        for (size_t i = 0; i < old_capacity; i++) {
+            if (!old[i].node) continue;
+            size_t k = (pointer_hash(old[i].node) * 31 + pointer_hash(old[i].state)) & (u->capacity - 1);
+            while (u->memo[k].node) k = (k + 1) & (u->capacity - 1);
+            u->memo[k] = old[i];
         }
-        
-        input[strcspn(input, "\n")] = 0;
-        
-        if (strcmp(input, "quit") == 0) {
-            break;
+        free(old);
+    }
+
+    size_t k = (pointer_hash(node) * 31 + pointer_hash(state)) & (u->capacity - 1);
+    while (u->memo[k].node && (u->memo[k].node != node || u->memo[k].state != state)) k = (k + 1) & (u->capacity - 1);
+    if (!u->memo[k].node) {
+        u->memo[k] = (UnrollEntry){ node, state, NULL };
+        u->count++;
+    }
+    return &u->memo[k];
+}
+
+// Folds and interns a node built by the expansion.
+ExprNode* unroll_intern(Unroller* u, ExprNode* node) {
+    if (all_constant_children(node) && !may_trap(node)) {
+        node = create_node_constant(u->arena, evaluate(node, 0, 0, 0, 0));
+    } else if (node->type == NODE_FUNCTION && node->function.func == FUNC_IFELSE &&
+               node->function.args[2]->type == NODE_CONSTANT) {
+        // As in optimize_function(), provided the dropped branch is a leaf.
+        ExprNode* kept = node->function.args[node->function.args[2]->constant != 0 ? 0 : 1];
+        ExprNode* dropped = node->function.args[node->function.args[2]->constant != 0 ? 1 : 0];
+        if (dropped->type == NODE_CONSTANT || dropped->type == NODE_VARIABLE) return kept;
+    }
+    return intern_node(&u->nodes, node);
+}
+
+ExprNode* unroll_node(Unroller* u, ExprNode* node, ExprNode* state);
+
+ExprNode* unroll_loop(Unroller* u, ExprNode* loop) {
+    ExprNode* state = intern_node(&u->nodes, create_node_constant(u->arena, 0));
+    for (int i = 0; i < loop->function.args[2]->constant; i++) {
+        ExprNode* step[3] = {
+            unroll_node(u, loop->function.args[1], state),
+            state,
+            unroll_node(u, loop->function.args[0], state),
+        };
+        state = unroll_intern(u, create_node_function(u->arena, FUNC_IFELSE, step, 3));
+    }
+    return state;
+}
+
+// `state` stands for x, or is NULL outside any loop.
+ExprNode* unroll_node(Unroller* u, ExprNode* node, ExprNode* state) {
+    if (node->type == NODE_VARIABLE) return node->slot == LOOP_STATE_SLOT ? state : node;
+    if (node->type == NODE_CONSTANT) return node;
+
+    UnrollEntry* entry = unroll_entry(u, node, state);
+    if (entry->result) return entry->result;
+
+    ExprNode* result = node;
+    if (node->type == NODE_OPERATOR) {
+        ExprNode* left = unroll_node(u, node->operation.left, state);
+        ExprNode* right = unroll_node(u, node->operation.right, state);
+        if (left != node->operation.left || right != node->operation.right) {
+            result = unroll_intern(u, create_node_operator(u->arena, node->operation.op, left, right));
         }
-        
-        if (input[0] == '\0') {
-            printf("Empty expression. Please enter a valid expression or 'quit'.\n\n");
-            continue;
+    } else if (node->function.func == FUNC_WHILE) {
+        result = unroll_loop(u, node);
+    } else {
+        ExprNode* args[3];
+        bool changed = false;
+        for (int i = 0; i < node->function.argc; i++) {
+            args[i] = unroll_node(u, node->function.args[i], state);
+            changed |= args[i] != node->function.args[i];
         }
+        if (changed) result = unroll_intern(u, create_node_function(u->arena, node->function.func, args, node->function.argc));
+    }
 
-        ExprNode* ast = NULL;
-        int result = 0;
-        
-        printf("Parsing and evaluating...\n");
-        ast = parse(input);
-        result = evaluate(ast, a, b, c, d);
-        
-        printf("Result: %d\n\n", result);
-        
-        free_tree(ast);
+    // The memo may have grown while expanding the children.
+    unroll_entry(u, node, state)->result = result;
+    return result;
+}
+
+// Expands every while() in a hash-consed tree; trees without loops are
+// returned as they are.
+ExprNode* unroll_loops(ExprNode* root, NodeArena* arena) {
+    if (!contains_loop(root)) return root;
+    Unroller u = { arena, { NULL, 0, 0 }, NULL, 0, 0 };
+    intern_tree(&u.nodes, root);
+    ExprNode* result = unroll_node(&u, root, NULL);
+    free(u.nodes.slots);
+    free(u.memo);
+    return result;
+}
+
+// The standard pipeline between parse() and compile().
+ExprNode* prepare_expression(ExprNode* ast, NodeArena* arena) {
+    return unroll_loops(hash_cons(optimize(ast, arena)), arena);
+}
+
+// --- Bytecode Compilation ---
+
+// The AST is lowered into a flat array of three-address instructions over a
+// register file laid out as [variables | constants | temporaries], where
+// variable registers are the symbol slots and always include a, b, c, d.
+// Leaves never emit code: they are referenced directly by their register,
+// so only operators and functions cost a dispatch.
+
+#define PROGRAM_MAX_REGS 256
+
+typedef enum {
+    OPC_ADD, OPC_SUB, OPC_MUL, OPC_DIV,
+    OPC_SHIFT_LEFT, OPC_DIVIDE_POW2,
+    OPC_MAX, OPC_MIN, OPC_EQUAL, OPC_GREATER_THAN,
+    OPC_IFELSE, OPC_ABSOLUTE,
+    OPC_MUL_SECRET, OPC_DIV_SECRET  // oblivious versions, for operators on secret values
+} OpCode;
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t dst;
+    uint8_t src[3];
+} Instruction;
+
+typedef struct {
+    Instruction* code;
+    int count;
+    int capacity;
+    int* constants;
+    int num_constants;
+    int num_variables;  // at least NUM_VARIABLES; one past the highest slot read
+    int num_regs;
+    int result_reg;
+} Program;
+
+// Only valid once count_uses() has seen every variable.
+int constant_slot(Program* prog, int value) {
+    for (int i = 0; i < prog->num_constants; i++) {
+        if (prog->constants[i] == value) return prog->num_variables + i;
+    }
+    prog->constants = realloc(prog->constants, (prog->num_constants + 1) * sizeof(int));
+    prog->constants[prog->num_constants] = value;
+    return prog->num_variables + prog->num_constants++;
+}
+
+// Per-node bookkeeping for compiling a DAG: how many parents reference a
+// node, and the register its value was pinned to once emitted.
+typedef struct {
+    const ExprNode* node;
+    int uses;
+    int reg;
+} NodeUse;
+
+typedef struct {
+    Program* prog;
+    NodeUse* uses;
+    int capacity;
+    int count;
+    int temp_base;
+    int next_pinned;
+} Compiler;
+
+NodeUse* node_use(Compiler* cc, const ExprNode* node) {
+    if (2 * (cc->count + 1) > cc->capacity) {
+        NodeUse* old = cc->uses;
+        int old_capacity = cc->capacity;
+        cc->capacity = old_capacity ? old_capacity * 2 : 64;
+        cc->uses = calloc(cc->capacity, sizeof(NodeUse));
+        for (int i = 0; i < old_capacity; i++) {
+            if (!old[i].node) continue;
+            size_t k = pointer_hash(old[i].node) & (cc->capacity - 1);
+            while (cc->uses[k].node) k = (k + 1) & (cc->capacity - 1);
+            cc->uses[k] = old[i];
+        }
+        free(old);
+    }
+
+    size_t k = pointer_hash(node) & (cc->capacity - 1);
+    while (cc->uses[k].node && cc->uses[k].node != node) k = (k + 1) & (cc->capacity - 1);
+    if (!cc->uses[k].node) {
+        cc->uses[k] = (NodeUse){ node, 0, -1 };
+        cc->count++;
+    }
+    return &cc->uses[k];
+}
+
+// First pass: counts references per node and pools constants, visiting each
+// shared subtree once.
+void count_uses(Compiler* cc, ExprNode* node) {
+    if (node_use(cc, node)->uses++ > 0) return;
+
+    if (node->type == NODE_VARIABLE) {
+        if (node->slot >= cc->prog->num_variables) cc->prog->num_variables = node->slot + 1;
+    } else if (node->type == NODE_CONSTANT) {
+        constant_slot(cc->prog, node->constant);
+    } else if (node->type == NODE_OPERATOR) {
+        count_uses(cc, node->operation.left);
+        count_uses(cc, node->operation.right);
+    } else if (node->type == NODE_FUNCTION) {
+        for (int i = 0; i < node->function.argc; i++) {
+            count_uses(cc, node->function.args[i]);
+        }
+    }
+}
+
+void emit_instruction(Program* prog, OpCode opcode, int dst, int src0, int src1, int src2) {
+    if (prog->count == prog->capacity) {
+        prog->capacity = prog->capacity ? prog->capacity * 2 : 16;
+        prog->code = realloc(prog->code, prog->capacity * sizeof(Instruction));
+    }
+    prog->code[prog->count++] = (Instruction){ opcode, dst, { src0, src1, src2 } };
+}
+
+OpCode operator_opcode(const ExprNode* node) {
+    OpCode opcode = (OpCode)(OPC_ADD + node->operation.op);
+    if (node->secret && opcode == OPC_MUL) return OPC_MUL_SECRET;
+    if (node->secret && opcode == OPC_DIV) return OPC_DIV_SECRET;
+    return opcode;
+}
+
+OpCode function_opcode(FunctionType func) {
+    switch (func) {
+        case FUNC_MAX: return OPC_MAX;
+        case FUNC_MIN: return OPC_MIN;
+        case FUNC_EQUAL: return OPC_EQUAL;
+        case FUNC_GREATER_THAN: return OPC_GREATER_THAN;
+        case FUNC_IFELSE: return OPC_IFELSE;
+        case FUNC_ABSOLUTE: return OPC_ABSOLUTE;
+        default:
+            printf("Error: Unknown function type: %d.\n", func);
+            exit(1);
+    }
+}
+
+// Emits code for `node` and returns the register holding its value. The
+// temporary for a subtree at `depth` is `temp_base + depth`, so sibling
+// operands never clobber each other. Nodes referenced more than once get a
+// pinned register below temp_base instead: they are computed on first use
+// and every later reference just reads that register.
+int compile_node(Compiler* cc, ExprNode* node, int depth) {
+    Program* prog = cc->prog;
+    int dst = cc->temp_base + depth;
+    if (dst >= PROGRAM_MAX_REGS) {
+        printf("Error: Expression too deeply nested to compile (max %d registers).\n", PROGRAM_MAX_REGS);
+        exit(1);
+    }
+    if (dst + 1 > prog->num_regs) prog->num_regs = dst + 1;
+
+    if (node->type == NODE_VARIABLE) return node->slot;
+    if (node->type == NODE_CONSTANT) return constant_slot(prog, node->constant);
+
+    NodeUse* use = node_use(cc, node);
+    if (use->reg >= 0) return use->reg;
+    if (use->uses > 1) dst = cc->next_pinned++;
+
+    switch (node->type) {
+        case NODE_OPERATOR: {
+            int left = compile_node(cc, node->operation.left, depth);
+            int right = compile_node(cc, node->operation.right, depth + 1);
+            emit_instruction(prog, operator_opcode(node), dst, left, right, 0);
+            break;
+        }
+
+        case NODE_FUNCTION: {
+            int src[3] = { 0, 0, 0 };
+            for (int i = 0; i < node->function.argc; i++) {
+                src[i] = compile_node(cc, node->function.args[i], depth + i);
+            }
+            emit_instruction(prog, function_opcode(node->function.func), dst, src[0], src[1], src[2]);
+            break;
+        }
+
+        default:
+            printf("Error: Unknown node type: %d.\n", node->type);
+            exit(1);
+    }
+
+    // node_use() may have rehashed while compiling the children.
+    if (dst < cc->temp_base) node_use(cc, node)->reg = dst;
+    return dst;
+}
+
+Program* compile(ExprNode* ast) {
+    Program* prog = calloc(1, sizeof(Program));
+    prog->num_variables = NUM_VARIABLES;
+    Compiler cc = { prog, NULL, 0, 0, 0, 0 };
+    count_uses(&cc, ast);
+
+    int pinned = 0;
+    for (int i = 0; i < cc.capacity; i++) {
+        const ExprNode* node = cc.uses[i].node;
+        if (node && cc.uses[i].uses > 1 && (node->type == NODE_OPERATOR || node->type == NODE_FUNCTION)) pinned++;
+    }
+
+    cc.next_pinned = prog->num_variables + prog->num_constants;
+    cc.temp_base = cc.next_pinned + pinned;
+    if (cc.temp_base >= PROGRAM_MAX_REGS) {
+        printf("Error: Too many variables and constants to compile (max %d registers).\n", PROGRAM_MAX_REGS);
+        exit(1);
+    }
+    prog->num_regs = cc.temp_base;
+    prog->result_reg = compile_node(&cc, ast, 0);
+    free(cc.uses);
+    return prog;
+}
+
+// Runs prog over regs, whose variable slots the caller has filled.
+static inline int run_program_regs(const Program* prog, int* regs) {
+    if (prog->num_constants) {
+        memcpy(&regs[prog->num_variables], prog->constants, prog->num_constants * sizeof(int));
+    }
+
+    const Instruction* ip = prog->code;
+    const Instruction* end = ip + prog->count;
+    for (; ip < end; ip++) {
+        int x = regs[ip->src[0]];
+        int y = regs[ip->src[1]];
+
+        switch (ip->opcode) {
+            case OPC_ADD: regs[ip->dst] = x + y; break;
+            case OPC_SUB: regs[ip->dst] = subtract(x, y); break;
+            case OPC_MUL: regs[ip->dst] = multiply_public(x, y); break;
+            case OPC_MUL_SECRET: regs[ip->dst] = multiply(x, y); break;
+            case OPC_DIV:
+            case OPC_DIV_SECRET:
+                if (y == 0) {
+                    printf("Error: Division by zero.\n");
+                    exit(1);
+                }
+                regs[ip->dst] = ip->opcode == OPC_DIV ? divide_public(x, y) : divide_signed_oblivious(x, y);
+                break;
+            case OPC_SHIFT_LEFT: regs[ip->dst] = shift_left(x, y); break;
+            case OPC_DIVIDE_POW2: regs[ip->dst] = divide_pow2(x, y); break;
+            case OPC_MAX: regs[ip->dst] = max(x, y); break;
+            case OPC_MIN: regs[ip->dst] = min(x, y); break;
+            case OPC_EQUAL: regs[ip->dst] = equal(x, y); break;
+            case OPC_GREATER_THAN: regs[ip->dst] = greater_than(x, y); break;
+            case OPC_IFELSE: regs[ip->dst] = ifelse(x, y, regs[ip->src[2]] != 0); break;
+            case OPC_ABSOLUTE: regs[ip->dst] = absolute(x); break;
+        }
+    }
+
+    return regs[prog->result_reg];
+}
+
+// Same semantics as evaluate_row(), which stays as the reference
+// implementation; `row` holds prog->num_variables values.
+int run_program_row(const Program* prog, const int32_t* row) {
+    int regs[PROGRAM_MAX_REGS];
+    memcpy(regs, row, (size_t)prog->num_variables * sizeof(int));
+    return run_program_regs(prog, regs);
+}
+
+// For programs over a, b, c and d only, as parse_with_secrecy() produces.
+int run_program(const Program* prog, int a, int b, int c, int d) {
+    int regs[PROGRAM_MAX_REGS];
+    regs[0] = a;
+    regs[1] = b;
+    regs[2] = c;
+    regs[3] = d;
+    return run_program_regs(prog, regs);
+}
+
+// The bitsliced, secret-shared and circuit engines and the code generators
+// are built around exactly a, b, c and d.
+void require_four_variables(const Program* prog, const char* engine) {
+    if (prog->num_variables > NUM_VARIABLES) {
+        printf("Error: %s supports only the variables a, b, c and d.\n", engine);
+        exit(1);
+    }
+}
+
+// --- Memory Management ---
+
+void free_program(Program* prog) {
+    if (!prog) return;
+    free(prog->code);
+    free(prog->constants);
+    free(prog);
+}
+
+// --- Batch Evaluation ---
+
+// Evaluates one compiled program over structure-of-arrays columns. Rows are
+// processed in blocks of BATCH_BLOCK: each instruction runs over the whole
+// block before the next one is dispatched, so decode cost is paid once per
+// block instead of once per row. Variable registers alias the input columns
+// directly; constants are broadcast once per call.
+
+#define BATCH_BLOCK 1024
+
+void batch_add(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = (int32_t)((uint32_t)x[i] + (uint32_t)y[i]);
+}
+
+void batch_subtract(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = subtract(x[i], y[i]);
+}
+
+void batch_multiply(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = multiply(x[i], y[i]);
+}
+
+// Long-running callers such as the server set batch_trap_soft so that a zero
+// divisor only sets batch_trapped instead of ending the process; the rows of
+// that call then hold unspecified values and should be discarded.
+bool batch_trap_soft = false;
+#ifdef MPC_HAVE_THREADS
+atomic_bool batch_trapped = false;
+#else
+bool batch_trapped = false;
+#endif
+
+void check_divisors(const int32_t* y, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (y[i] == 0) {
+            if (batch_trap_soft) {
+                batch_trapped = true;
+                return;
+            }
+            printf("Error: Division by zero.\n");
+            exit(1);
+        }
+    }
+}
+
+void batch_divide(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    check_divisors(y, n);
+    for (size_t i = 0; i < n; i++) out[i] = divide_signed_oblivious(x[i], y[i]);
+}
+
+void batch_shift_left(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = shift_left(x[i], y[i]);
+}
+
+void batch_divide_pow2(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = divide_pow2(x[i], y[i]);
+}
+
+void batch_max(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = max(x[i], y[i]);
+}
+
+void batch_min(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = min(x[i], y[i]);
+}
+
+void batch_equal(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = equal(x[i], y[i]);
+}
+
+void batch_greater_than(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = greater_than(x[i], y[i]);
+}
+
+void batch_ifelse(const int32_t* x, const int32_t* y, const int32_t* cond, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = ifelse(x[i], y[i], cond[i] != 0);
+}
+
+void batch_absolute(const int32_t* x, int32_t* out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = absolute(x[i]);
+}
+
+// --- SIMD Kernels ---
+
+// Vector versions of the batch kernels. Every lane runs the same instruction
+// sequence regardless of its data: comparisons produce all-ones/all-zeros lane
+// masks, selection is and/andnot, and division is the fixed 32-step restoring
+// loop from devision.c (with a carry lane so divisors above 2^31 stay exact).
+// vpmulld is used for multiply: it is data-independent on x86 and matches the
+// sign-magnitude shift-and-mask product bit for bit modulo 2^32.
+
+typedef struct {
+    const char* name;
+    void (*add)(const int32_t* x, const int32_t* y, int32_t* out, size_t n);
+    void (*subtract)(const int32_t* x, const int32_t* y, int32_t* out, size_t n);
+    void (*multiply)(const int32_t* x, const int32_t* y, int32_t* out, size_t n);
+    void (*divide)(const int32_t* x, const int32_t* y, int32_t* out, size_t n);
+    void (*shift_left)(const int32_t* x, const int32_t* y, int32_t* out, size_t n);
+    void (*divide_pow2)(const int32_t* x, const int32_t* y, int32_t* out, size_t n);
+    void (*max)(const int32_t* x, const int32_t* y, int32_t* out, size_t n);
+    void (*min)(const int32_t* x, const int32_t* y, int32_t* out, size_t n);
+    void (*equal)(const int32_t* x, const int32_t* y, int32_t* out, size_t n);
+    void (*greater_than)(const int32_t* x, const int32_t* y, int32_t* out, size_t n);
+    void (*ifelse)(const int32_t* x, const int32_t* y, const int32_t* cond, int32_t* out, size_t n);
+    void (*absolute)(const int32_t* x, int32_t* out, size_t n);
+} BatchKernels;
+
+const BatchKernels scalar_kernels = {
+    "scalar", batch_add, batch_subtract, batch_multiply, batch_divide,
+    batch_shift_left, batch_divide_pow2,
+    batch_max, batch_min, batch_equal, batch_greater_than, batch_ifelse, batch_absolute
+};
+
+#ifdef MPC_HAVE_X86_SIMD
+
+#define AVX2 __attribute__((target("avx2")))
+#define AVX512 __attribute__((target("avx512f")))
+#define LOAD256(p) _mm256_loadu_si256((const __m256i*)(p))
+#define STORE256(p, v) _mm256_storeu_si256((__m256i*)(p), (v))
+
+AVX2 static inline __m256i avx2_greater_than(__m256i x, __m256i y) {
+    return _mm256_cmpgt_epi32(_mm256_sub_epi32(x, y), _mm256_setzero_si256());
+}
+
+AVX2 static inline __m256i avx2_absolute(__m256i x) {
+    __m256i mask = _mm256_srai_epi32(x, 31);
+    return _mm256_xor_si256(_mm256_add_epi32(x, mask), mask);
+}
+
+AVX2 static inline __m256i avx2_divide_unsigned(__m256i numerator, __m256i denominator) {
+    const __m256i bias = _mm256_set1_epi32((int)0x80000000u);
+    const __m256i one = _mm256_set1_epi32(1);
+    __m256i biased_denominator = _mm256_xor_si256(denominator, bias);
+    __m256i quotient = _mm256_setzero_si256();
+    __m256i remainder = _mm256_setzero_si256();
+
+    for (int i = 0; i < 32; i++) {
+        __m256i carry = _mm256_srai_epi32(remainder, 31);
+        remainder = _mm256_or_si256(_mm256_slli_epi32(remainder, 1), _mm256_srli_epi32(numerator, 31));
+        numerator = _mm256_slli_epi32(numerator, 1);
+        __m256i below = _mm256_cmpgt_epi32(biased_denominator, _mm256_xor_si256(remainder, bias));
+        __m256i ge = _mm256_or_si256(carry, _mm256_xor_si256(below, _mm256_set1_epi32(-1)));
+        remainder = _mm256_sub_epi32(remainder, _mm256_and_si256(denominator, ge));
+        quotient = _mm256_or_si256(_mm256_slli_epi32(quotient, 1), _mm256_and_si256(ge, one));
+    }
+    return quotient;
+}
+
+AVX2 void avx2_add(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) STORE256(out + i, _mm256_add_epi32(LOAD256(x + i), LOAD256(y + i)));
+    batch_add(x + i, y + i, out + i, n - i);
+}
+
+AVX2 void avx2_subtract(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) STORE256(out + i, _mm256_sub_epi32(LOAD256(x + i), LOAD256(y + i)));
+    batch_subtract(x + i, y + i, out + i, n - i);
+}
+
+AVX2 void avx2_multiply(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) STORE256(out + i, _mm256_mullo_epi32(LOAD256(x + i), LOAD256(y + i)));
+    batch_multiply(x + i, y + i, out + i, n - i);
+}
+
+AVX2 void avx2_divide(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    check_divisors(y, n);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i vx = LOAD256(x + i);
+        __m256i vy = LOAD256(y + i);
+        __m256i sign = _mm256_xor_si256(_mm256_srai_epi32(vx, 31), _mm256_srai_epi32(vy, 31));
+        __m256i q = avx2_divide_unsigned(avx2_absolute(vx), avx2_absolute(vy));
+        STORE256(out + i, _mm256_sub_epi32(_mm256_xor_si256(q, sign), sign));
+    }
+    batch_divide(x + i, y + i, out + i, n - i);
+}
+
+AVX2 void avx2_shift_left(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) STORE256(out + i, _mm256_sllv_epi32(LOAD256(x + i), LOAD256(y + i)));
+    batch_shift_left(x + i, y + i, out + i, n - i);
+}
+
+AVX2 void avx2_divide_pow2(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    const __m256i one = _mm256_set1_epi32(1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i vx = LOAD256(x + i);
+        __m256i vk = LOAD256(y + i);
+        __m256i low_mask = _mm256_sub_epi32(_mm256_sllv_epi32(one, vk), one);
+        __m256i bias = _mm256_and_si256(_mm256_srai_epi32(vx, 31), low_mask);
+        STORE256(out + i, _mm256_srav_epi32(_mm256_add_epi32(vx, bias), vk));
+    }
+    batch_divide_pow2(x + i, y + i, out + i, n - i);
+}
+
+AVX2 void avx2_max(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i vx = LOAD256(x + i);
+        __m256i vy = LOAD256(y + i);
+        STORE256(out + i, _mm256_blendv_epi8(vy, vx, avx2_greater_than(vx, vy)));
+    }
+    batch_max(x + i, y + i, out + i, n - i);
+}
+
+AVX2 void avx2_min(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i vx = LOAD256(x + i);
+        __m256i vy = LOAD256(y + i);
+        STORE256(out + i, _mm256_blendv_epi8(vy, vx, avx2_greater_than(vy, vx)));
+    }
+    batch_min(x + i, y + i, out + i, n - i);
+}
+
+AVX2 void avx2_equal(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    const __m256i one = _mm256_set1_epi32(1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        STORE256(out + i, _mm256_and_si256(_mm256_cmpeq_epi32(LOAD256(x + i), LOAD256(y + i)), one));
+    }
+    batch_equal(x + i, y + i, out + i, n - i);
+}
+
+AVX2 void avx2_greater_than_kernel(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    const __m256i one = _mm256_set1_epi32(1);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        STORE256(out + i, _mm256_and_si256(avx2_greater_than(LOAD256(x + i), LOAD256(y + i)), one));
+    }
+    batch_greater_than(x + i, y + i, out + i, n - i);
+}
+
+AVX2 void avx2_ifelse(const int32_t* x, const int32_t* y, const int32_t* cond, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i is_false = _mm256_cmpeq_epi32(LOAD256(cond + i), _mm256_setzero_si256());
+        STORE256(out + i, _mm256_blendv_epi8(LOAD256(x + i), LOAD256(y + i), is_false));
+    }
+    batch_ifelse(x + i, y + i, cond + i, out + i, n - i);
+}
+
+AVX2 void avx2_absolute_kernel(const int32_t* x, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) STORE256(out + i, avx2_absolute(LOAD256(x + i)));
+    batch_absolute(x + i, out + i, n - i);
+}
+
+const BatchKernels avx2_kernels = {
+    "avx2", avx2_add, avx2_subtract, avx2_multiply, avx2_divide,
+    avx2_shift_left, avx2_divide_pow2,
+    avx2_max, avx2_min, avx2_equal, avx2_greater_than_kernel, avx2_ifelse, avx2_absolute_kernel
+};
+
+AVX512 static inline __mmask16 avx512_greater_than(__m512i x, __m512i y) {
+    return _mm512_cmpgt_epi32_mask(_mm512_sub_epi32(x, y), _mm512_setzero_si512());
+}
+
+AVX512 static inline __m512i avx512_absolute(__m512i x) {
+    __m512i mask = _mm512_srai_epi32(x, 31);
+    return _mm512_xor_si512(_mm512_add_epi32(x, mask), mask);
+}
+
+AVX512 static inline __m512i avx512_divide_unsigned(__m512i numerator, __m512i denominator) {
+    const __m512i zero = _mm512_setzero_si512();
+    const __m512i one = _mm512_set1_epi32(1);
+    __m512i quotient = zero;
+    __m512i remainder = zero;
+
+    for (int i = 0; i < 32; i++) {
+        __mmask16 carry = _mm512_cmplt_epi32_mask(remainder, zero);
+        remainder = _mm512_or_si512(_mm512_slli_epi32(remainder, 1), _mm512_srli_epi32(numerator, 31));
+        numerator = _mm512_slli_epi32(numerator, 1);
+        __mmask16 ge = carry | _mm512_cmpge_epu32_mask(remainder, denominator);
+        remainder = _mm512_mask_sub_epi32(remainder, ge, remainder, denominator);
+        quotient = _mm512_slli_epi32(quotient, 1);
+        quotient = _mm512_mask_or_epi32(quotient, ge, quotient, one);
+    }
+    return quotient;
+}
+
+AVX512 void avx512_add(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_si512(out + i, _mm512_add_epi32(_mm512_loadu_si512(x + i), _mm512_loadu_si512(y + i)));
+    }
+    batch_add(x + i, y + i, out + i, n - i);
+}
+
+AVX512 void avx512_subtract(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_si512(out + i, _mm512_sub_epi32(_mm512_loadu_si512(x + i), _mm512_loadu_si512(y + i)));
+    }
+    batch_subtract(x + i, y + i, out + i, n - i);
+}
+
+AVX512 void avx512_multiply(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_si512(out + i, _mm512_mullo_epi32(_mm512_loadu_si512(x + i), _mm512_loadu_si512(y + i)));
+    }
+    batch_multiply(x + i, y + i, out + i, n - i);
+}
+
+AVX512 void avx512_divide(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    check_divisors(y, n);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i vx = _mm512_loadu_si512(x + i);
+        __m512i vy = _mm512_loadu_si512(y + i);
+        __m512i sign = _mm512_xor_si512(_mm512_srai_epi32(vx, 31), _mm512_srai_epi32(vy, 31));
+        __m512i q = avx512_divide_unsigned(avx512_absolute(vx), avx512_absolute(vy));
+        _mm512_storeu_si512(out + i, _mm512_sub_epi32(_mm512_xor_si512(q, sign), sign));
+    }
+    batch_divide(x + i, y + i, out + i, n - i);
+}
+
+AVX512 void avx512_shift_left(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_si512(out + i, _mm512_sllv_epi32(_mm512_loadu_si512(x + i), _mm512_loadu_si512(y + i)));
+    }
+    batch_shift_left(x + i, y + i, out + i, n - i);
+}
+
+AVX512 void avx512_divide_pow2(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    const __m512i one = _mm512_set1_epi32(1);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i vx = _mm512_loadu_si512(x + i);
+        __m512i vk = _mm512_loadu_si512(y + i);
+        __m512i low_mask = _mm512_sub_epi32(_mm512_sllv_epi32(one, vk), one);
+        __m512i bias = _mm512_and_si512(_mm512_srai_epi32(vx, 31), low_mask);
+        _mm512_storeu_si512(out + i, _mm512_srav_epi32(_mm512_add_epi32(vx, bias), vk));
+    }
+    batch_divide_pow2(x + i, y + i, out + i, n - i);
+}
+
+AVX512 void avx512_max(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i vx = _mm512_loadu_si512(x + i);
+        __m512i vy = _mm512_loadu_si512(y + i);
+        _mm512_storeu_si512(out + i, _mm512_mask_blend_epi32(avx512_greater_than(vx, vy), vy, vx));
+    }
+    batch_max(x + i, y + i, out + i, n - i);
+}
+
+AVX512 void avx512_min(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i vx = _mm512_loadu_si512(x + i);
+        __m512i vy = _mm512_loadu_si512(y + i);
+        _mm512_storeu_si512(out + i, _mm512_mask_blend_epi32(avx512_greater_than(vy, vx), vy, vx));
+    }
+    batch_min(x + i, y + i, out + i, n - i);
+}
+
+AVX512 void avx512_equal(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    const __m512i one = _mm512_set1_epi32(1);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __mmask16 eq = _mm512_cmpeq_epi32_mask(_mm512_loadu_si512(x + i), _mm512_loadu_si512(y + i));
+        _mm512_storeu_si512(out + i, _mm512_maskz_mov_epi32(eq, one));
+    }
+    batch_equal(x + i, y + i, out + i, n - i);
+}
+
+AVX512 void avx512_greater_than_kernel(const int32_t* x, const int32_t* y, int32_t* out, size_t n) {
+    const __m512i one = _mm512_set1_epi32(1);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __mmask16 gt = avx512_greater_than(_mm512_loadu_si512(x + i), _mm512_loadu_si512(y + i));
+        _mm512_storeu_si512(out + i, _mm512_maskz_mov_epi32(gt, one));
+    }
+    batch_greater_than(x + i, y + i, out + i, n - i);
+}
+
+AVX512 void avx512_ifelse(const int32_t* x, const int32_t* y, const int32_t* cond, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __mmask16 taken = _mm512_test_epi32_mask(_mm512_loadu_si512(cond + i), _mm512_loadu_si512(cond + i));
+        _mm512_storeu_si512(out + i, _mm512_mask_blend_epi32(taken, _mm512_loadu_si512(y + i), _mm512_loadu_si512(x + i)));
+    }
+    batch_ifelse(x + i, y + i, cond + i, out + i, n - i);
+}
+
+AVX512 void avx512_absolute_kernel(const int32_t* x, int32_t* out, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) _mm512_storeu_si512(out + i, avx512_absolute(_mm512_loadu_si512(x + i)));
+    batch_absolute(x + i, out + i, n - i);
+}
+
+const BatchKernels avx512_kernels = {
+    "avx512", avx512_add, avx512_subtract, avx512_multiply, avx512_divide,
+    avx512_shift_left, avx512_divide_pow2,
+    avx512_max, avx512_min, avx512_equal, avx512_greater_than_kernel, avx512_ifelse, avx512_absolute_kernel
+};
+
+#undef AVX2
+#undef AVX512
+#undef LOAD256
+#undef STORE256
+
+#endif // MPC_HAVE_X86_SIMD
+
+// Fills `list` with the kernel sets this CPU can run, widest first.
+int supported_batch_kernels(const BatchKernels* list[3]) {
+    int count = 0;
+#ifdef MPC_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) list[count++] = &avx512_kernels;
+    if (__builtin_cpu_supports("avx2")) list[count++] = &avx2_kernels;
+#endif
+    list[count++] = &scalar_kernels;
+    return count;
+}
+
+// Picks the widest kernel set the CPU supports. MPC_SIMD=scalar|avx2|avx512
+// in the environment forces a narrower one (e.g. to compare implementations).
+const BatchKernels* batch_kernels(void) {
+    static const BatchKernels* selected = NULL;
+    if (selected) return selected;
+
+    const BatchKernels* candidates[3];
+    int count = supported_batch_kernels(candidates);
+
+    selected = candidates[0];
+    const char* forced = getenv("MPC_SIMD");
+    if (forced) {
+        for (int i = 0; i < count; i++) {
+            if (strcmp(forced, candidates[i]->name) == 0) selected = candidates[i];
+        }
+    }
+    return selected;
+}
+
+// --- Batch Driver ---
+
+// Register columns for one block of rows: temporaries, and constants
+// broadcast once. A frame may be prepared again for another program and
+// only grows.
+typedef struct {
+    int32_t* storage;
+    int capacity;
+    const int32_t* cols[PROGRAM_MAX_REGS];
+} BatchFrame;
+
+void batch_frame_prepare(BatchFrame* frame, const Program* prog) {
+    int columns = prog->num_regs - prog->num_variables;
+    if (!frame->storage || columns > frame->capacity) {
+        free(frame->storage);
+        frame->storage = aligned_alloc(64, (size_t)columns * BATCH_BLOCK * sizeof(int32_t) + 64);
+        frame->capacity = columns;
+    }
+
+    for (int r = prog->num_variables; r < prog->num_regs; r++) {
+        frame->cols[r] = frame->storage + (size_t)(r - prog->num_variables) * BATCH_BLOCK;
+    }
+    for (int k = 0; k < prog->num_constants; k++) {
+        int32_t* column = (int32_t*)frame->cols[prog->num_variables + k];
+        for (size_t i = 0; i < BATCH_BLOCK; i++) column[i] = prog->constants[k];
+    }
+}
+
+void batch_frame_free(BatchFrame* frame) {
+    free(frame->storage);
+    frame->storage = NULL;
+    frame->capacity = 0;
+}
+
+// `columns` holds one input column per variable slot of `prog`.
+void batch_frame_run(BatchFrame* frame, const Program* prog, const BatchKernels* kernels,
+                     const int32_t* const* columns, int32_t* out, size_t n) {
+    const int32_t** cols = frame->cols;
+    for (size_t start = 0; start < n; start += BATCH_BLOCK) {
+        size_t len = n - start < BATCH_BLOCK ? n - start : BATCH_BLOCK;
+        for (int v = 0; v < prog->num_variables; v++) cols[v] = columns[v] + start;
+
+        for (int k = 0; k < prog->count; k++) {
+            const Instruction* ins = &prog->code[k];
+            const int32_t* x = cols[ins->src[0]];
+            const int32_t* y = cols[ins->src[1]];
+            int32_t* dst = (int32_t*)cols[ins->dst];
+
+            switch (ins->opcode) {
+                case OPC_ADD: kernels->add(x, y, dst, len); break;
+                case OPC_SUB: kernels->subtract(x, y, dst, len); break;
+                // The kernels are data-oblivious, so public and secret share them.
+                case OPC_MUL:
+                case OPC_MUL_SECRET: kernels->multiply(x, y, dst, len); break;
+                case OPC_DIV:
+                case OPC_DIV_SECRET: kernels->divide(x, y, dst, len); break;
+                case OPC_SHIFT_LEFT: kernels->shift_left(x, y, dst, len); break;
+                case OPC_DIVIDE_POW2: kernels->divide_pow2(x, y, dst, len); break;
+                case OPC_MAX: kernels->max(x, y, dst, len); break;
+                case OPC_MIN: kernels->min(x, y, dst, len); break;
+                case OPC_EQUAL: kernels->equal(x, y, dst, len); break;
+                case OPC_GREATER_THAN: kernels->greater_than(x, y, dst, len); break;
+                case OPC_IFELSE: kernels->ifelse(x, y, cols[ins->src[2]], dst, len); break;
+                case OPC_ABSOLUTE: kernels->absolute(x, dst, len); break;
+            }
+        }
+
+        memcpy(out + start, cols[prog->result_reg], len * sizeof(int32_t));
+    }
+}
+
+void run_program_columns_with(const Program* prog, const BatchKernels* kernels, const int32_t* const* columns,
+                              int32_t* out, size_t n) {
+    BatchFrame frame = { NULL, 0, { NULL } };
+    batch_frame_prepare(&frame, prog);
+    batch_frame_run(&frame, prog, kernels, columns, out, n);
+    batch_frame_free(&frame);
+}
+
+void run_program_columns(const Program* prog, const int32_t* const* columns, int32_t* out, size_t n) {
+    run_program_columns_with(prog, batch_kernels(), columns, out, n);
+}
+
+// With batch_trap_soft set: evaluates the rows one at a time into `out` up
+// to the first that divides by zero and returns its index, or n if none
+// does. Finds the row behind a block that trapped.
+size_t run_program_columns_to_trap(const Program* prog, const int32_t* const* columns, int32_t* out, size_t n) {
+    BatchFrame frame = { NULL, 0, { NULL } };
+    const int32_t* row[PROGRAM_MAX_REGS];
+    batch_frame_prepare(&frame, prog);
+    size_t i = 0;
+    for (; i < n; i++) {
+        for (int v = 0; v < prog->num_variables; v++) row[v] = columns[v] + i;
+        batch_trapped = false;
+        batch_frame_run(&frame, prog, batch_kernels(), row, out + i, 1);
+        if (batch_trapped) break;
+    }
+    batch_frame_free(&frame);
+    return i;
+}
+
+void run_program_batch_with(const Program* prog, const BatchKernels* kernels, const int32_t* a,
+                            const int32_t* b, const int32_t* c, const int32_t* d, int32_t* out, size_t n) {
+    const int32_t* columns[NUM_VARIABLES] = { a, b, c, d };
+    run_program_columns_with(prog, kernels, columns, out, n);
+}
+
+void run_program_batch(const Program* prog, const int32_t* a, const int32_t* b,
+                       const int32_t* c, const int32_t* d, int32_t* out, size_t n) {
+    run_program_batch_with(prog, batch_kernels(), a, b, c, d, out, n);
+}
+
+void evaluate_batch(ExprNode* ast, const int32_t* a, const int32_t* b,
+                    const int32_t* c, const int32_t* d, int32_t* out, size_t n) {
+    Program* prog = compile(ast);
+    run_program_batch(prog, a, b, c, d, out, n);
+    free_program(prog);
+}
+
+// --- Parallel Batch Evaluation ---
+
+// Runs the batch driver on a pool of threads. The rows are cut into chunks
+// of PARALLEL_CHUNK_ROWS, sized so a chunk's input and output columns stay
+// in a core's L2, and each worker starts with a contiguous range of them. A
+// worker takes chunks from the front of its own range; once that is empty
+// it steals the back half of another's, nearest neighbours first. A range
+// is a single atomic word, so taking and stealing are one compare-exchange
+// each and workers share nothing else while running: each evaluates into
+// its own register frame, allocated on its own thread after it is pinned to
+// its CPU so the pages sit on its NUMA node, and copies results only into
+// its own chunks of the output. The caller works as worker 0.
+//
+// MPC_THREADS sets the size of the pool used by run_program_parallel(),
+// which defaults to the number of online CPUs.
+
+#define PARALLEL_CHUNK_ROWS (16 * BATCH_BLOCK)
+
+typedef struct ParallelPool ParallelPool;
+
+#ifdef MPC_HAVE_THREADS
+
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range;  // next chunk in the low half, end in the high half
+} ChunkRange;
+
+typedef struct {
+    ParallelPool* pool;
+    int index;
+    int cpu;  // -1 when not pinned
+    pthread_t thread;
+    BatchFrame frame;
+} ParallelWorker;
+
+struct ParallelPool {
+    int num_workers;
+    ParallelWorker* workers;
+    ChunkRange* ranges;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    int busy;
+    bool stop;
+
+    // The current job, written by the caller before the workers start.
+    const Program* prog;
+    const BatchKernels* kernels;
+    const int32_t* const* columns;
+    int32_t* out;
+    size_t n;
+};
+
+bool chunk_take(ChunkRange* range, uint32_t* chunk) {
+    uint64_t current = atomic_load_explicit(&range->range, memory_order_relaxed);
+    while ((uint32_t)current < (uint32_t)(current >> 32)) {
+        if (atomic_compare_exchange_weak_explicit(&range->range, &current, current + 1, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            *chunk = (uint32_t)current;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Moves the back half of `victim` into `thief`, which is empty and owned by
+// the caller.
+bool chunk_steal(ChunkRange* victim, ChunkRange* thief) {
+    uint64_t current = atomic_load_explicit(&victim->range, memory_order_relaxed);
+    for (;;) {
+        uint32_t next = (uint32_t)current, end = (uint32_t)(current >> 32);
+        if (next >= end) return false;
+        uint32_t middle = next + (end - next) / 2;
+        uint64_t kept = (uint64_t)middle << 32 | next;
+        if (atomic_compare_exchange_weak_explicit(&victim->range, &current, kept, memory_order_relaxed,
+                                                  memory_order_relaxed)) {
+            atomic_store_explicit(&thief->range, (uint64_t)end << 32 | middle, memory_order_relaxed);
+            return true;
+        }
+    }
+}
+
+void parallel_work(ParallelPool* pool, ParallelWorker* worker) {
+    ChunkRange* own = &pool->ranges[worker->index];
+    const int32_t* chunk_columns[PROGRAM_MAX_REGS];
+    batch_frame_prepare(&worker->frame, pool->prog);
+
+    for (;;) {
+        uint32_t chunk;
+        while (chunk_take(own, &chunk)) {
+            size_t start = (size_t)chunk * PARALLEL_CHUNK_ROWS;
+            size_t len = pool->n - start < PARALLEL_CHUNK_ROWS ? pool->n - start : PARALLEL_CHUNK_ROWS;
+            for (int v = 0; v < pool->prog->num_variables; v++) chunk_columns[v] = pool->columns[v] + start;
+            batch_frame_run(&worker->frame, pool->prog, pool->kernels, chunk_columns, pool->out + start, len);
+        }
+
+        bool stolen = false;
+        for (int distance = 1; distance < pool->num_workers && !stolen; distance++) {
+            int right = (worker->index + distance) % pool->num_workers;
+            int left = (worker->index - distance + pool->num_workers) % pool->num_workers;
+            stolen = chunk_steal(&pool->ranges[right], own) || chunk_steal(&pool->ranges[left], own);
+        }
+        if (!stolen) return;
+    }
+}
+
+void* parallel_worker_main(void* arg) {
+    ParallelWorker* worker = arg;
+    ParallelPool* pool = worker->pool;
+#ifdef __linux__
+    if (worker->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(worker->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+
+    uint64_t seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->stop) pthread_cond_wait(&pool->start, &pool->lock);
+        seen = pool->generation;
+        bool stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) break;
+
+        parallel_work(pool, worker);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    batch_frame_free(&worker->frame);
+    return NULL;
+}
+
+// Worker i > 0 is pinned to the i-th CPU the process may run on, when there
+// are at least as many CPUs as workers.
+ParallelPool* parallel_pool_create(int num_threads) {
+    ParallelPool* pool = calloc(1, sizeof(ParallelPool));
+    pool->num_workers = num_threads > 0 ? num_threads : 1;
+    pool->workers = calloc((size_t)pool->num_workers, sizeof(ParallelWorker));
+    pool->ranges = aligned_alloc(64, (size_t)pool->num_workers * sizeof(ChunkRange));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    int cpus[1024];
+    int num_cpus = 0;
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE && num_cpus < 1024; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) cpus[num_cpus++] = cpu;
+        }
+    }
+#endif
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        ParallelWorker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        worker->cpu = num_cpus >= pool->num_workers ? cpus[i] : -1;
+        atomic_init(&pool->ranges[i].range, 0);
+        if (i == 0) continue;
+        if (pthread_create(&worker->thread, NULL, parallel_worker_main, worker) != 0) {
+            printf("Error: Cannot start batch worker thread.\n");
+            exit(1);
+        }
+    }
+    return pool;
+}
+
+void parallel_pool_free(ParallelPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 1; i < pool->num_workers; i++) pthread_join(pool->workers[i].thread, NULL);
+
+    batch_frame_free(&pool->workers[0].frame);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->workers);
+    free(pool->ranges);
+    free(pool);
+}
+
+int parallel_pool_threads(const ParallelPool* pool) {
+    return pool->num_workers;
+}
+
+void run_program_parallel_with(ParallelPool* pool, const Program* prog, const BatchKernels* kernels,
+                               const int32_t* const* columns, int32_t* out, size_t n) {
+    ParallelWorker* caller = &pool->workers[0];
+    if (pool->num_workers == 1 || n <= PARALLEL_CHUNK_ROWS) {
+        batch_frame_prepare(&caller->frame, prog);
+        batch_frame_run(&caller->frame, prog, kernels, columns, out, n);
+        return;
+    }
+
+    uint64_t chunks = (n + PARALLEL_CHUNK_ROWS - 1) / PARALLEL_CHUNK_ROWS;
+    if (chunks > UINT32_MAX) {
+        printf("Error: Too many rows for one parallel batch.\n");
+        exit(1);
+    }
+    for (int i = 0; i < pool->num_workers; i++) {
+        uint64_t begin = chunks * (uint64_t)i / (uint64_t)pool->num_workers;
+        uint64_t end = chunks * (uint64_t)(i + 1) / (uint64_t)pool->num_workers;
+        atomic_store_explicit(&pool->ranges[i].range, end << 32 | begin, memory_order_relaxed);
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->prog = prog;
+    pool->kernels = kernels;
+    pool->columns = columns;
+    pool->out = out;
+    pool->n = n;
+    pool->busy = pool->num_workers - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    parallel_work(pool, caller);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+int parallel_default_threads(void) {
+    const char* threads = getenv("MPC_THREADS");
+    if (threads && atoi(threads) > 0) return atoi(threads);
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    return online > 0 ? (int)online : 1;
+}
+
+ParallelPool* default_parallel_pool = NULL;
+pthread_once_t default_parallel_pool_once = PTHREAD_ONCE_INIT;
+
+void create_default_parallel_pool(void) {
+    default_parallel_pool = parallel_pool_create(parallel_default_threads());
+}
+
+// The pool shared by run_program_parallel(); it lives until exit. Callers
+// must not run two batches on it at once.
+ParallelPool* parallel_pool(void) {
+    pthread_once(&default_parallel_pool_once, create_default_parallel_pool);
+    return default_parallel_pool;
+}
+
+#else
+
+struct ParallelPool {
+    int num_workers;
+};
+
+ParallelPool* parallel_pool_create(int num_threads) {
+    (void)num_threads;
+    ParallelPool* pool = calloc(1, sizeof(ParallelPool));
+    pool->num_workers = 1;
+    return pool;
+}
+
+void parallel_pool_free(ParallelPool* pool) {
+    free(pool);
+}
+
+int parallel_pool_threads(const ParallelPool* pool) {
+    return pool->num_workers;
+}
+
+void run_program_parallel_with(ParallelPool* pool, const Program* prog, const BatchKernels* kernels,
+                               const int32_t* const* columns, int32_t* out, size_t n) {
+    (void)pool;
+    run_program_columns_with(prog, kernels, columns, out, n);
+}
+
+ParallelPool* parallel_pool(void) {
+    static ParallelPool single = { 1 };
+    return &single;
+}
+
+#endif // MPC_HAVE_THREADS
+
+void run_program_parallel_columns(const Program* prog, const int32_t* const* columns, int32_t* out, size_t n) {
+    run_program_parallel_with(parallel_pool(), prog, batch_kernels(), columns, out, n);
+}
+
+void run_program_parallel(const Program* prog, const int32_t* a, const int32_t* b, const int32_t* c,
+                          const int32_t* d, int32_t* out, size_t n) {
+    const int32_t* columns[NUM_VARIABLES] = { a, b, c, d };
+    run_program_parallel_columns(prog, columns, out, n);
+}
+
+// --- Bitsliced Evaluation ---
+
+// Rows are transposed into 32 bit-planes, where bit k of plane i is bit i of
+// row k, and every primitive is evaluated as the gate sequence it is built
+// from (the ripple borrow chain of Substract.c, masked partial products of
+// Multiply.c, restoring division of devision.c). One gate then processes
+// BITSLICE_LANES rows at once. Built with AVX2 enabled, a plane is a 256-bit
+// GCC vector; otherwise it is a single 64-bit word.
+
+#define WORD_BITS 32
+
+#if defined(__AVX2__) && defined(__GNUC__)
+typedef uint64_t Plane __attribute__((vector_size(32)));
+#define BITSLICE_WORDS 4
+#else
+typedef uint64_t Plane;
+#define BITSLICE_WORDS 1
+#endif
+
+#define BITSLICE_LANES (64 * BITSLICE_WORDS)
+#define PLANE_ZERO ((Plane){0})
+#define PLANE_ONES (~(Plane){0})
+
+// In-place transpose of a 64x64 bit matrix (Hacker's Delight, 7-3).
+void transpose64(uint64_t m[64]) {
+    uint64_t mask = 0x00000000FFFFFFFFULL;
+    for (int j = 32; j != 0; j >>= 1, mask ^= mask << j) {
+        for (int k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+            uint64_t t = ((m[k] >> j) ^ m[k | j]) & mask;
+            m[k] ^= t << j;
+            m[k | j] ^= t;
+        }
+    }
+}
+
+void bitslice_load(const int32_t* column, size_t len, Plane planes[WORD_BITS]) {
+    uint64_t m[64];
+    for (int w = 0; w < BITSLICE_WORDS; w++) {
+        for (int k = 0; k < 64; k++) {
+            size_t row = (size_t)w * 64 + k;
+            m[k] = row < len ? (uint32_t)column[row] : 0;
+        }
+        transpose64(m);
+        for (int i = 0; i < WORD_BITS; i++) ((uint64_t*)&planes[i])[w] = m[i];
+    }
+}
+
+void bitslice_store(const Plane planes[WORD_BITS], int32_t* column, size_t len) {
+    uint64_t m[64];
+    for (int w = 0; w < BITSLICE_WORDS; w++) {
+        for (int i = 0; i < WORD_BITS; i++) m[i] = ((const uint64_t*)&planes[i])[w];
+        for (int i = WORD_BITS; i < 64; i++) m[i] = 0;
+        transpose64(m);
+        for (int k = 0; k < 64; k++) {
+            size_t row = (size_t)w * 64 + k;
+            if (row < len) column[row] = (int32_t)(uint32_t)m[k];
+        }
+    }
+}
+
+void bitslice_constant(int value, Plane planes[WORD_BITS]) {
+    for (int i = 0; i < WORD_BITS; i++) {
+        planes[i] = (((uint32_t)value >> i) & 1) ? PLANE_ONES : PLANE_ZERO;
+    }
+}
+
+Plane bitslice_any(const Plane x[WORD_BITS]) {
+    Plane acc = x[0];
+    for (int i = 1; i < WORD_BITS; i++) acc |= x[i];
+    return acc;
+}
+
+void bitslice_from_flag(Plane flag, Plane out[WORD_BITS]) {
+    out[0] = flag;
+    for (int i = 1; i < WORD_BITS; i++) out[i] = PLANE_ZERO;
+}
+
+void bitslice_add(const Plane x[WORD_BITS], const Plane y[WORD_BITS], Plane out[WORD_BITS]) {
+    Plane carry = PLANE_ZERO;
+    for (int i = 0; i < WORD_BITS; i++) {
+        Plane p = x[i] ^ y[i];
+        Plane g = x[i] & y[i];
+        out[i] = p ^ carry;
+        carry = g | (p & carry);
+    }
+}
+
+// Ripple-borrow subtractor, gate for gate the chain in Substract.c. Returns
+// the borrow out of the top bit (set where x < y as unsigned).
+Plane bitslice_subtract(const Plane x[WORD_BITS], const Plane y[WORD_BITS], Plane out[WORD_BITS]) {
+    Plane borrow = PLANE_ZERO;
+    for (int i = 0; i < WORD_BITS; i++) {
+        Plane p = x[i] ^ y[i];
+        out[i] = p ^ borrow;
+        borrow = (~x[i] & y[i]) | (~p & borrow);
+    }
+    return borrow;
+}
+
+// Conditional two's complement: (x ^ s) + s for the broadcast sign plane s.
+void bitslice_negate_if(const Plane x[WORD_BITS], Plane sign, Plane out[WORD_BITS]) {
+    Plane carry = sign;
+    for (int i = 0; i < WORD_BITS; i++) {
+        Plane t = x[i] ^ sign;
+        out[i] = t ^ carry;
+        carry = t & carry;
+    }
+}
+
+void bitslice_absolute(const Plane x[WORD_BITS], Plane out[WORD_BITS]) {
+    bitslice_negate_if(x, x[WORD_BITS - 1], out);
+}
+
+void bitslice_select(Plane cond, const Plane x[WORD_BITS], const Plane y[WORD_BITS], Plane out[WORD_BITS]) {
+    for (int i = 0; i < WORD_BITS; i++) out[i] = (x[i] & cond) | (y[i] & ~cond);
+}
+
+Plane bitslice_greater_than(const Plane x[WORD_BITS], const Plane y[WORD_BITS]) {
+    Plane diff[WORD_BITS];
+    bitslice_subtract(x, y, diff);
+    return ~diff[WORD_BITS - 1] & bitslice_any(diff);
+}
+
+Plane bitslice_equal(const Plane x[WORD_BITS], const Plane y[WORD_BITS]) {
+    Plane acc = x[0] ^ y[0];
+    for (int i = 1; i < WORD_BITS; i++) acc |= x[i] ^ y[i];
+    return ~acc;
+}
+
+// Shift-and-add over masked partial products, as in Multiply.c. The product
+// modulo 2^32 does not depend on the operands' signs, so no sign fix-up is
+// needed.
+void bitslice_multiply(const Plane x[WORD_BITS], const Plane y[WORD_BITS], Plane out[WORD_BITS]) {
+    Plane acc[WORD_BITS];
+    for (int i = 0; i < WORD_BITS; i++) acc[i] = x[i] & y[0];
+
+    for (int j = 1; j < WORD_BITS; j++) {
+        Plane carry = PLANE_ZERO;
+        for (int i = j; i < WORD_BITS; i++) {
+            Plane pp = x[i - j] & y[j];
+            Plane p = acc[i] ^ pp;
+            Plane g = acc[i] & pp;
+            acc[i] = p ^ carry;
+            carry = g | (p & carry);
+        }
+    }
+    memcpy(out, acc, sizeof(acc));
+}
+
+// Restoring division on magnitudes followed by a sign fix-up, matching
+// divide_signed(). |y| <= 2^31 keeps every partial remainder within 32 bits.
+void bitslice_divide(const Plane x[WORD_BITS], const Plane y[WORD_BITS], Plane out[WORD_BITS]) {
+    Plane ax[WORD_BITS], ay[WORD_BITS], rem[WORD_BITS], diff[WORD_BITS], quot[WORD_BITS];
+    bitslice_absolute(x, ax);
+    bitslice_absolute(y, ay);
+    for (int i = 0; i < WORD_BITS; i++) rem[i] = PLANE_ZERO;
+
+    for (int step = WORD_BITS - 1; step >= 0; step--) {
+        for (int i = WORD_BITS - 1; i > 0; i--) rem[i] = rem[i - 1];
+        rem[0] = ax[step];
+        Plane ge = ~bitslice_subtract(rem, ay, diff);
+        bitslice_select(ge, diff, rem, rem);
+        quot[step] = ge;
+    }
+    bitslice_negate_if(quot, x[WORD_BITS - 1] ^ y[WORD_BITS - 1], out);
+}
+
+// Shifts by a literal amount are pure rewiring; the bias for a truncating
+// division by 2^k is the sign plane in the low k bits.
+void bitslice_shift_left(const Plane x[WORD_BITS], int k, Plane out[WORD_BITS]) {
+    for (int i = WORD_BITS - 1; i >= 0; i--) out[i] = i >= k ? x[i - k] : PLANE_ZERO;
+}
+
+void bitslice_divide_pow2(const Plane x[WORD_BITS], int k, Plane out[WORD_BITS]) {
+    Plane bias[WORD_BITS], biased[WORD_BITS];
+    for (int i = 0; i < WORD_BITS; i++) bias[i] = i < k ? x[WORD_BITS - 1] : PLANE_ZERO;
+    bitslice_add(x, bias, biased);
+    for (int i = 0; i < WORD_BITS; i++) out[i] = i + k < WORD_BITS ? biased[i + k] : biased[WORD_BITS - 1];
+}
+
+// Log-depth versions of the chains above, for when depth matters more than
+// gate count (a round per AND layer when the circuit is evaluated on shares,
+// or the critical path of a hardware netlist). Carries come from a Sklansky
+// parallel prefix over generate/propagate: log2(width) levels, with half the
+// prefix nodes of Kogge-Stone since fanout costs nothing here. Division is
+// radix 4, half the steps of the restoring loop, each comparing against 1, 2
+// and 3 times the divisor side by side on a remainder two bits wider.
+// AND/OR gates and the longest chain of them, for 32 bits:
+//
+//                    subtract  greater_than  absolute  divide
+//   ripple  gates        96        128           32     6240
+//           depth        64         64           31     2110
+//   prefix  gates       274        291          242    16323
+//           depth        12         13           12      238
+
+#define BITSLICE_WIDE (WORD_BITS + 2)
+
+// carries[i] is the carry into bit i of the sum with generate/propagate
+// planes g and p and `carry_in`; carries[width] is the carry out.
+void bitslice_prefix_carries(const Plane* g, const Plane* p, Plane carry_in, Plane* carries, int width) {
+    Plane gen[BITSLICE_WIDE], prop[BITSLICE_WIDE];
+    for (int i = 0; i < width; i++) {
+        gen[i] = g[i];
+        prop[i] = p[i];
+    }
+    gen[0] |= p[0] & carry_in;
+
+    for (int span = 1; span < width; span <<= 1) {
+        for (int i = 0; i < width; i++) {
+            if (!(i & span)) continue;
+            int j = (i & ~(span - 1)) - 1;  // top of the lower half of i's block
+            gen[i] |= prop[i] & gen[j];
+            prop[i] &= prop[j];
+        }
+    }
+
+    carries[0] = carry_in;
+    for (int i = 0; i < width; i++) carries[i + 1] = gen[i];
+}
+
+void bitslice_add_prefix(const Plane x[WORD_BITS], const Plane y[WORD_BITS], Plane out[WORD_BITS]) {
+    Plane g[WORD_BITS], p[WORD_BITS], carries[WORD_BITS + 1];
+    for (int i = 0; i < WORD_BITS; i++) {
+        g[i] = x[i] & y[i];
+        p[i] = x[i] ^ y[i];
+    }
+    bitslice_prefix_carries(g, p, PLANE_ZERO, carries, WORD_BITS);
+    for (int i = 0; i < WORD_BITS; i++) out[i] = p[i] ^ carries[i];
+}
+
+// x - y as x + ~y + 1 over `width` planes. Returns the borrow out.
+Plane bitslice_subtract_wide(const Plane* x, const Plane* y, Plane* out, int width) {
+    Plane g[BITSLICE_WIDE] = { PLANE_ZERO }, p[BITSLICE_WIDE] = { PLANE_ZERO }, carries[BITSLICE_WIDE + 1];
+    for (int i = 0; i < width; i++) {
+        g[i] = x[i] & ~y[i];
+        p[i] = ~(x[i] ^ y[i]);
+    }
+    bitslice_prefix_carries(g, p, PLANE_ONES, carries, width);
+    for (int i = 0; i < width; i++) out[i] = p[i] ^ carries[i];
+    return ~carries[width];
+}
+
+Plane bitslice_subtract_prefix(const Plane x[WORD_BITS], const Plane y[WORD_BITS], Plane out[WORD_BITS]) {
+    return bitslice_subtract_wide(x, y, out, WORD_BITS);
+}
+
+// bitslice_any() as a balanced OR tree.
+Plane bitslice_any_tree(const Plane x[WORD_BITS]) {
+    Plane acc[WORD_BITS];
+    memcpy(acc, x, sizeof(acc));
+    for (int width = WORD_BITS / 2; width >= 1; width /= 2) {
+        for (int i = 0; i < width; i++) acc[i] = acc[2 * i] | acc[2 * i + 1];
+    }
+    return acc[0];
+}
+
+// The same wrapped-difference test as greater_than(), but only the sign bit
+// of x - y is formed, next to an OR tree for x != y.
+Plane bitslice_greater_than_prefix(const Plane x[WORD_BITS], const Plane y[WORD_BITS]) {
+    Plane g[WORD_BITS], p[WORD_BITS], differs[WORD_BITS], carries[WORD_BITS + 1];
+    for (int i = 0; i < WORD_BITS; i++) {
+        g[i] = x[i] & ~y[i];
+        p[i] = ~(x[i] ^ y[i]);
+        differs[i] = ~p[i];
+    }
+    bitslice_prefix_carries(g, p, PLANE_ONES, carries, WORD_BITS - 1);
+    Plane sign = p[WORD_BITS - 1] ^ carries[WORD_BITS - 1];
+    return ~sign & bitslice_any_tree(differs);
+}
+
+// (x ^ s) + s: the carries are prefix ANDs of the flipped bits.
+void bitslice_negate_if_prefix(const Plane x[WORD_BITS], Plane sign, Plane out[WORD_BITS]) {
+    Plane g[WORD_BITS], p[WORD_BITS], carries[WORD_BITS + 1];
+    for (int i = 0; i < WORD_BITS; i++) {
+        g[i] = PLANE_ZERO;
+        p[i] = x[i] ^ sign;
+    }
+    bitslice_prefix_carries(g, p, sign, carries, WORD_BITS);
+    for (int i = 0; i < WORD_BITS; i++) out[i] = p[i] ^ carries[i];
+}
+
+void bitslice_absolute_prefix(const Plane x[WORD_BITS], Plane out[WORD_BITS]) {
+    bitslice_negate_if_prefix(x, x[WORD_BITS - 1], out);
+}
+
+// Radix-4 restoring division on magnitudes. The remainder stays below the
+// divisor, at most 2^31, so after shifting in two bits it and 3 * divisor
+// fit in WORD_BITS + 2 planes. The three comparisons are monotone, so the
+// next remainder and the quotient digit follow from their masks directly.
+void bitslice_divide_radix4(const Plane x[WORD_BITS], const Plane y[WORD_BITS], Plane out[WORD_BITS]) {
+    Plane ax[WORD_BITS], ay[WORD_BITS], quot[WORD_BITS];
+    Plane multiples[3][BITSLICE_WIDE], trial[3][BITSLICE_WIDE], rem[BITSLICE_WIDE];
+    bitslice_absolute_prefix(x, ax);
+    bitslice_absolute_prefix(y, ay);
+
+    for (int i = 0; i < BITSLICE_WIDE; i++) {
+        multiples[0][i] = i < WORD_BITS ? ay[i] : PLANE_ZERO;
+        multiples[1][i] = i >= 1 && i <= WORD_BITS ? ay[i - 1] : PLANE_ZERO;
+        rem[i] = PLANE_ZERO;
+    }
+    Plane g[BITSLICE_WIDE], p[BITSLICE_WIDE], carries[BITSLICE_WIDE + 1];
+    for (int i = 0; i < BITSLICE_WIDE; i++) {
+        g[i] = multiples[0][i] & multiples[1][i];
+        p[i] = multiples[0][i] ^ multiples[1][i];
+    }
+    bitslice_prefix_carries(g, p, PLANE_ZERO, carries, BITSLICE_WIDE);
+    for (int i = 0; i < BITSLICE_WIDE; i++) multiples[2][i] = p[i] ^ carries[i];
+
+    for (int step = WORD_BITS - 2; step >= 0; step -= 2) {
+        for (int i = BITSLICE_WIDE - 1; i > 1; i--) rem[i] = rem[i - 2];
+        rem[1] = ax[step + 1];
+        rem[0] = ax[step];
+
+        Plane ge[3];
+        for (int m = 0; m < 3; m++) ge[m] = ~bitslice_subtract_wide(rem, multiples[m], trial[m], BITSLICE_WIDE);
+        for (int i = 0; i < BITSLICE_WIDE; i++) {
+            rem[i] ^= (ge[0] & (trial[0][i] ^ rem[i])) ^ (ge[1] & (trial[1][i] ^ trial[0][i])) ^
+                      (ge[2] & (trial[2][i] ^ trial[1][i]));
+        }
+        quot[step + 1] = ge[1];
+        quot[step] = ge[0] ^ ge[1] ^ ge[2];
+    }
+    bitslice_negate_if_prefix(quot, x[WORD_BITS - 1] ^ y[WORD_BITS - 1], out);
+}
+
+void bitslice_divide_pow2_prefix(const Plane x[WORD_BITS], int k, Plane out[WORD_BITS]) {
+    Plane bias[WORD_BITS], biased[WORD_BITS];
+    for (int i = 0; i < WORD_BITS; i++) bias[i] = i < k ? x[WORD_BITS - 1] : PLANE_ZERO;
+    bitslice_add_prefix(x, bias, biased);
+    for (int i = 0; i < WORD_BITS; i++) out[i] = i + k < WORD_BITS ? biased[i + k] : biased[WORD_BITS - 1];
+}
+
+// The gate-level circuits the bitsliced engine is built from, one set per
+// goal: "gates" is the ripple chains above, "depth" the prefix versions.
+typedef struct {
+    const char* name;
+    void (*add)(const Plane x[WORD_BITS], const Plane y[WORD_BITS], Plane out[WORD_BITS]);
+    Plane (*subtract)(const Plane x[WORD_BITS], const Plane y[WORD_BITS], Plane out[WORD_BITS]);
+    Plane (*greater_than)(const Plane x[WORD_BITS], const Plane y[WORD_BITS]);
+    void (*absolute)(const Plane x[WORD_BITS], Plane out[WORD_BITS]);
+    void (*divide)(const Plane x[WORD_BITS], const Plane y[WORD_BITS], Plane out[WORD_BITS]);
+    void (*divide_pow2)(const Plane x[WORD_BITS], int k, Plane out[WORD_BITS]);
+} BitsliceCircuits;
+
+const BitsliceCircuits ripple_circuits = {
+    "gates", bitslice_add, bitslice_subtract, bitslice_greater_than, bitslice_absolute,
+    bitslice_divide, bitslice_divide_pow2
+};
+
+const BitsliceCircuits prefix_circuits = {
+    "depth", bitslice_add_prefix, bitslice_subtract_prefix, bitslice_greater_than_prefix, bitslice_absolute_prefix,
+    bitslice_divide_radix4, bitslice_divide_pow2_prefix
+};
+
+// Fewest gates is fastest when the planes are evaluated in the clear, so
+// that is the default; MPC_CIRCUIT=depth picks the log-depth set. The goal
+// only picks the adders and dividers operator by operator; unlike
+// build_netlist(), nothing here compares the depth of the whole program.
+const BitsliceCircuits* bitslice_circuits(void) {
+    const char* goal = getenv("MPC_CIRCUIT");
+    return goal && strcmp(goal, prefix_circuits.name) == 0 ? &prefix_circuits : &ripple_circuits;
+}
+
+int program_constant(const Program* prog, int reg) {
+    if (reg < NUM_VARIABLES || reg >= NUM_VARIABLES + prog->num_constants) {
+        printf("Error: Shift amount must be a constant register, got r%d.\n", reg);
+        exit(1);
+    }
+    return prog->constants[reg - NUM_VARIABLES];
+}
+
+void run_program_bitsliced_with(const Program* prog, const BitsliceCircuits* circuits, const int32_t* a,
+                                const int32_t* b, const int32_t* c, const int32_t* d, int32_t* out, size_t n) {
+    require_four_variables(prog, "Bitsliced evaluation");
+    Plane (*regs)[WORD_BITS] = aligned_alloc(64, (size_t)prog->num_regs * sizeof(Plane[WORD_BITS]));
+    for (int k = 0; k < prog->num_constants; k++) {
+        bitslice_constant(prog->constants[k], regs[NUM_VARIABLES + k]);
+    }
+
+    for (size_t start = 0; start < n; start += BITSLICE_LANES) {
+        size_t len = n - start < BITSLICE_LANES ? n - start : BITSLICE_LANES;
+        bitslice_load(a + start, len, regs[0]);
+        bitslice_load(b + start, len, regs[1]);
+        bitslice_load(c + start, len, regs[2]);
+        bitslice_load(d + start, len, regs[3]);
+
+        for (int k = 0; k < prog->count; k++) {
+            const Instruction* ins = &prog->code[k];
+            Plane* x = regs[ins->src[0]];
+            Plane* y = regs[ins->src[1]];
+            Plane result[WORD_BITS];
+
+            switch (ins->opcode) {
+                case OPC_ADD: circuits->add(x, y, result); break;
+                case OPC_SUB: circuits->subtract(x, y, result); break;
+                case OPC_MUL:
+                case OPC_MUL_SECRET: bitslice_multiply(x, y, result); break;
+                case OPC_DIV:
+                case OPC_DIV_SECRET: {
+                    // Padding lanes past `len` are zero, so only live lanes count.
+                    Plane zero = ~bitslice_any(y);
+                    for (int w = 0; w < BITSLICE_WORDS; w++) {
+                        size_t lo = (size_t)w * 64;
+                        uint64_t live = len <= lo ? 0 : len - lo >= 64 ? ~0ULL : (1ULL << (len - lo)) - 1;
+                        if (((uint64_t*)&zero)[w] & live) {
+                            printf("Error: Division by zero.\n");
+                            exit(1);
+                        }
+                    }
+                    circuits->divide(x, y, result);
+                    break;
+                }
+                case OPC_SHIFT_LEFT: bitslice_shift_left(x, program_constant(prog, ins->src[1]), result); break;
+                case OPC_DIVIDE_POW2: circuits->divide_pow2(x, program_constant(prog, ins->src[1]), result); break;
+                case OPC_MAX: bitslice_select(circuits->greater_than(x, y), x, y, result); break;
+                case OPC_MIN: bitslice_select(circuits->greater_than(y, x), x, y, result); break;
+                case OPC_EQUAL: bitslice_from_flag(bitslice_equal(x, y), result); break;
+                case OPC_GREATER_THAN: bitslice_from_flag(circuits->greater_than(x, y), result); break;
+                case OPC_IFELSE: bitslice_select(bitslice_any(regs[ins->src[2]]), x, y, result); break;
+                case OPC_ABSOLUTE: circuits->absolute(x, result); break;
+            }
+            memcpy(regs[ins->dst], result, sizeof(result));
+        }
+
+        bitslice_store(regs[prog->result_reg], out + start, len);
+    }
+
+    free(regs);
+}
+
+void run_program_bitsliced(const Program* prog, const int32_t* a, const int32_t* b,
+                           const int32_t* c, const int32_t* d, int32_t* out, size_t n) {
+    run_program_bitsliced_with(prog, bitslice_circuits(), a, b, c, d, out, n);
+}
+
+void evaluate_bitsliced(ExprNode* ast, const int32_t* a, const int32_t* b,
+                        const int32_t* c, const int32_t* d, int32_t* out, size_t n) {
+    Program* prog = compile(ast);
+    run_program_bitsliced(prog, a, b, c, d, out, n);
+    free_program(prog);
+}
+
+// --- Preprocessing ---
+
+// Correlated randomness for the secret-shared backend: Beaver triples over
+// Z_2^32, bitwise triples, edaBits and daBits. A background dealer thread
+// produces them ahead of demand into one single-producer single-consumer
+// ring per party and item type. The dealer deals each item once, writes
+// every party's share into that party's ring and publishes the batch with
+// a release store of the head; a party copies items out and frees the
+// slots with a release store of the tail, so neither side takes a lock.
+// When the rings together exceed MPC_SPILL_BYTES (64 MiB by default) they
+// live in an unlinked temporary file instead of anonymous memory, so a
+// large pool can be written back to disk instead of pinning RAM.
+//
+// There is one dealer per number of parties, started on first use and kept
+// for the rest of the process. Its rings carry over from one evaluation to
+// the next and refill in the background between them; an evaluation only
+// waits until they hold what its schedule will consume, not until they are
+// full. While every ring is full the dealer sleeps until a party frees a
+// chunk.
+//
+// The dealer stands in for a trusted third party. Its values come from a
+// keyed mixer, which is not a cryptographic PRF: the backend models the
+// protocol and its costs, it is not a hardened implementation.
+
+#define MPC_MAX_PARTIES 16
+#define MPC_DEAL_CHUNK 256
+#define MPC_DEFAULT_RING_ITEMS (1u << 16)
+#define MPC_DEFAULT_SPILL_BYTES (64u << 20)
+#define MPC_INPUT_STREAM 64
+
+typedef enum {
+    MPC_ARITH_TRIPLE, MPC_BOOL_TRIPLE, MPC_EDABIT, MPC_DABIT, MPC_ITEM_TYPES
+} MpcItemType;
+
+// Words per party per item: triples (a, b, c) with c = a * b (or a & b);
+// edaBits and daBits (arithmetic share, XOR share) of one random value or
+// random bit.
+static const int mpc_item_width[MPC_ITEM_TYPES] = { 3, 3, 2, 2 };
+
+typedef struct {
+    uint64_t rounds;                  // communication rounds, per party
+    uint64_t levels;                  // levels of the gate schedule
+    uint64_t gates;                   // interactive gates in the schedule
+    uint64_t bytes;                   // sent by all parties together
+    uint64_t items[MPC_ITEM_TYPES];   // consumed, per party
+    uint64_t dealt[MPC_ITEM_TYPES];   // produced during the run, per party
+    uint64_t stalls;                  // takes that found a ring empty, all parties
+    double stall_seconds;
+    double prefill_seconds;           // waiting for the rings before the parties start
+    double online_seconds;
+    double dealer_seconds;            // time the dealer spent dealing
+} MpcStats;
+
+uint32_t mpc_mix(uint64_t key, uint64_t index) {
+    uint64_t z = key ^ (index * 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (uint32_t)(z ^ (z >> 31));
+}
+
+uint64_t mpc_stream(uint64_t seed, int stream) {
+    return seed ^ ((uint64_t)(stream + 1) * 0xD6E8FEB86659FD93ULL);
+}
+
+// Party `id`'s share of element `index` of a dealt stream: every party but
+// the last gets a mask, the last gets whatever makes all shares add (or
+// XOR) up to `value`. Only the last party's call reads `value`.
+uint32_t deal_share(int num_parties, uint64_t key, uint64_t index, uint32_t value, int id, bool boolean) {
+    int last = num_parties - 1;
+    if (id < last) return mpc_mix(key, index * MPC_MAX_PARTIES + (uint64_t)id);
+    for (int q = 0; q < last; q++) {
+        uint32_t mask = mpc_mix(key, index * MPC_MAX_PARTIES + (uint64_t)q);
+        value = boolean ? value ^ mask : value - mask;
+    }
+    return value;
+}
+
+#ifdef MPC_HAVE_THREADS
+
+double mpc_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+typedef struct {
+    uint32_t* words;
+    size_t capacity;          // items, a power of two
+    _Atomic uint64_t head;    // items dealt; written by the dealer
+    _Atomic uint64_t tail;    // items taken; written by the party
+} MpcRing;
+
+typedef struct {
+    int num_parties;
+    uint64_t seed;
+    MpcRing rings[MPC_ITEM_TYPES][MPC_MAX_PARTIES];
+    void* storage;
+    size_t storage_bytes;
+    bool spilled;
+    _Atomic uint64_t busy_ns;     // time spent dealing
+    _Atomic bool sleeping;
+    pthread_mutex_t lock;         // guards the dealer's sleep
+    pthread_cond_t wake;
+    pthread_mutex_t session;      // held by the evaluation taking from the rings
+    pthread_t thread;
+} MpcDealer;
+
+// Deals items [first, first + count) of `type` into every party's ring.
+void deal_items(MpcDealer* dealer, MpcItemType type, uint64_t first, size_t count) {
+    int parties = dealer->num_parties;
+    int width = mpc_item_width[type];
+    uint64_t value_x = mpc_stream(dealer->seed, 4 * type);
+    uint64_t value_y = mpc_stream(dealer->seed, 4 * type + 1);
+    uint64_t masks = mpc_stream(dealer->seed, 4 * type + 2);
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t k = first + i;
+        uint32_t x = mpc_mix(value_x, k), y = mpc_mix(value_y, k);
+        uint32_t rest[3];
+        switch (type) {
+            case MPC_ARITH_TRIPLE: rest[0] = x; rest[1] = y; rest[2] = x * y; break;
+            case MPC_BOOL_TRIPLE: rest[0] = x; rest[1] = y; rest[2] = x & y; break;
+            case MPC_EDABIT: rest[0] = rest[1] = x; break;
+            default: rest[0] = rest[1] = x & 1; break;
+        }
+
+        for (int q = 0; q < parties; q++) {
+            MpcRing* ring = &dealer->rings[type][q];
+            uint32_t* item = ring->words + (size_t)(k & (ring->capacity - 1)) * width;
+            for (int w = 0; w < width; w++) {
+                if (q == parties - 1) {
+                    item[w] = rest[w];
+                    continue;
+                }
+                bool boolean = type == MPC_BOOL_TRIPLE || (type != MPC_ARITH_TRIPLE && w == 1);
+                uint32_t share = mpc_mix(masks, ((uint64_t)width * k + (uint64_t)w) * MPC_MAX_PARTIES + (uint64_t)q);
+                rest[w] = boolean ? rest[w] ^ share : rest[w] - share;
+                item[w] = share;
+            }
+        }
+    }
+}
+
+// Free slots in the rings of `type`. Every party's ring of a type advances
+// together, so the slowest consumer bounds the space.
+size_t mpc_dealer_room(MpcDealer* dealer, int type) {
+    MpcRing* rings = dealer->rings[type];
+    uint64_t head = atomic_load(&rings[0].head);
+    uint64_t oldest = head;
+    for (int q = 0; q < dealer->num_parties; q++) {
+        uint64_t tail = atomic_load(&rings[q].tail);
+        if (tail < oldest) oldest = tail;
+    }
+    return rings[0].capacity - (size_t)(head - oldest);
+}
+
+// Items of `type` that every party can take without waiting.
+size_t mpc_dealer_ready(MpcDealer* dealer, int type) {
+    MpcRing* rings = dealer->rings[type];
+    uint64_t head = atomic_load_explicit(&rings[0].head, memory_order_acquire);
+    uint64_t newest = 0;
+    for (int q = 0; q < dealer->num_parties; q++) {
+        uint64_t tail = atomic_load_explicit(&rings[q].tail, memory_order_acquire);
+        if (tail > newest) newest = tail;
+    }
+    return (size_t)(head - newest);
+}
+
+void* dealer_main(void* arg) {
+    MpcDealer* dealer = arg;
+
+    for (;;) {
+        bool dealt = false;
+        for (int t = 0; t < MPC_ITEM_TYPES; t++) {
+            if (mpc_dealer_room(dealer, t) < MPC_DEAL_CHUNK) continue;
+
+            MpcRing* rings = dealer->rings[t];
+            uint64_t head = atomic_load_explicit(&rings[0].head, memory_order_relaxed);
+            double start = mpc_seconds();
+            deal_items(dealer, (MpcItemType)t, head, MPC_DEAL_CHUNK);
+            for (int q = 0; q < dealer->num_parties; q++) {
+                atomic_store_explicit(&rings[q].head, head + MPC_DEAL_CHUNK, memory_order_release);
+            }
+            atomic_fetch_add_explicit(&dealer->busy_ns, (uint64_t)((mpc_seconds() - start) * 1e9), memory_order_relaxed);
+            dealt = true;
+        }
+        if (dealt) continue;
+
+        // Every ring is full. Announce the sleep before looking at the tails
+        // once more, so that a party freeing space after the check sees the
+        // flag and wakes the dealer.
+        pthread_mutex_lock(&dealer->lock);
+        atomic_store(&dealer->sleeping, true);
+        bool room = false;
+        for (int t = 0; t < MPC_ITEM_TYPES; t++) room |= mpc_dealer_room(dealer, t) >= MPC_DEAL_CHUNK;
+        if (!room) pthread_cond_wait(&dealer->wake, &dealer->lock);
+        atomic_store(&dealer->sleeping, false);
+        pthread_mutex_unlock(&dealer->lock);
+    }
+    return NULL;
+}
+
+// Ring memory: anonymous up to MPC_SPILL_BYTES, an unlinked temporary file
+// beyond it.
+void* mpc_ring_storage(size_t bytes, bool* spilled) {
+    const char* limit = getenv("MPC_SPILL_BYTES");
+    size_t spill_bytes = limit ? strtoull(limit, NULL, 10) : MPC_DEFAULT_SPILL_BYTES;
+
+    *spilled = false;
+    if (bytes >= spill_bytes) {
+        const char* dir = getenv("TMPDIR");
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/mpc-pool-XXXXXX", dir ? dir : "/tmp");
+        int fd = mkstemp(path);
+        if (fd >= 0) {
+            unlink(path);
+            void* mem = ftruncate(fd, (off_t)bytes) == 0
+                        ? mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+            close(fd);
+            if (mem != MAP_FAILED) {
+                *spilled = true;
+                return mem;
+            }
+        }
+    }
+
+    void* mem = malloc(bytes);
+    if (!mem) {
+        printf("Error: Out of memory allocating the preprocessing pool.\n");
+        exit(1);
+    }
+    return mem;
+}
+
+// Starts a dealer with rings of `ring_items` items (rounded up to a power
+// of two), which it fills in the background.
+MpcDealer* mpc_dealer_start(int num_parties, uint64_t seed, size_t ring_items) {
+    size_t capacity = MPC_DEAL_CHUNK;
+    while (capacity < ring_items) capacity *= 2;
+
+    MpcDealer* dealer = calloc(1, sizeof(MpcDealer));
+    dealer->num_parties = num_parties;
+    dealer->seed = seed;
+    for (int t = 0; t < MPC_ITEM_TYPES; t++) {
+        dealer->storage_bytes += (size_t)num_parties * capacity * (size_t)mpc_item_width[t] * sizeof(uint32_t);
+    }
+    dealer->storage = mpc_ring_storage(dealer->storage_bytes, &dealer->spilled);
+
+    uint32_t* words = dealer->storage;
+    for (int t = 0; t < MPC_ITEM_TYPES; t++) {
+        for (int q = 0; q < num_parties; q++) {
+            MpcRing* ring = &dealer->rings[t][q];
+            ring->words = words;
+            ring->capacity = capacity;
+            atomic_init(&ring->head, 0);
+            atomic_init(&ring->tail, 0);
+            words += capacity * (size_t)mpc_item_width[t];
+        }
+    }
+    atomic_init(&dealer->busy_ns, 0);
+    atomic_init(&dealer->sleeping, false);
+    pthread_mutex_init(&dealer->lock, NULL);
+    pthread_cond_init(&dealer->wake, NULL);
+    pthread_mutex_init(&dealer->session, NULL);
+
+    if (pthread_create(&dealer->thread, NULL, dealer_main, dealer) != 0) {
+        printf("Error: Could not start the dealer thread.\n");
+        exit(1);
+    }
+    return dealer;
+}
+
+static MpcDealer* mpc_dealers[MPC_MAX_PARTIES + 1];
+static pthread_mutex_t mpc_dealers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The process's dealer for `num_parties` parties, started with rings of
+// MPC_POOL_ITEMS items (65536 by default) on first use. The caller has the
+// rings to itself until mpc_dealer_release().
+MpcDealer* mpc_dealer_acquire(int num_parties) {
+    pthread_mutex_lock(&mpc_dealers_lock);
+    MpcDealer* dealer = mpc_dealers[num_parties];
+    if (!dealer) {
+        const char* ring_items = getenv("MPC_POOL_ITEMS");
+        uint64_t seed = ((uint64_t)time(NULL) << 32) ^ (uint64_t)(uintptr_t)&mpc_dealers[num_parties];
+        dealer = mpc_dealer_start(num_parties, seed,
+                                  ring_items ? strtoull(ring_items, NULL, 10) : MPC_DEFAULT_RING_ITEMS);
+        mpc_dealers[num_parties] = dealer;
+    }
+    pthread_mutex_unlock(&mpc_dealers_lock);
+    pthread_mutex_lock(&dealer->session);
+    return dealer;
+}
+
+void mpc_dealer_release(MpcDealer* dealer) {
+    pthread_mutex_unlock(&dealer->session);
+}
+
+// Waits until every party can take `demand[t]` items of each type without
+// stalling, or as many as the rings hold.
+void mpc_dealer_prefill(MpcDealer* dealer, const uint64_t* demand) {
+    for (int t = 0; t < MPC_ITEM_TYPES; t++) {
+        // The dealer only deals whole chunks, so the last one may never fit.
+        size_t limit = dealer->rings[t][0].capacity - MPC_DEAL_CHUNK;
+        size_t wanted = demand[t] < limit ? (size_t)demand[t] : limit;
+        while (mpc_dealer_ready(dealer, t) < wanted) {
+            struct timespec pause = { 0, 20000 };
+            nanosleep(&pause, NULL);
+        }
+    }
+}
+
+// Items dealt so far, per party, and the time spent dealing them.
+void mpc_dealer_totals(MpcDealer* dealer, uint64_t* dealt, double* seconds) {
+    for (int t = 0; t < MPC_ITEM_TYPES; t++) {
+        dealt[t] = atomic_load_explicit(&dealer->rings[t][0].head, memory_order_acquire);
+    }
+    *seconds = (double)atomic_load_explicit(&dealer->busy_ns, memory_order_relaxed) * 1e-9;
+}
+
+// Copies the next `count` items of `type` for party `id` into `out`,
+// waiting for the dealer whenever the ring is empty. Adds the waits to
+// `stats`.
+void mpc_dealer_take(MpcDealer* dealer, int id, MpcItemType type, size_t count, uint32_t* out, MpcStats* stats) {
+    MpcRing* ring = &dealer->rings[type][id];
+    size_t width = (size_t)mpc_item_width[type];
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+    while (count > 0) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (head == tail) {
+            double start = mpc_seconds();
+            while ((head = atomic_load_explicit(&ring->head, memory_order_acquire)) == tail) sched_yield();
+            stats->stalls++;
+            stats->stall_seconds += mpc_seconds() - start;
+        }
+
+        size_t offset = (size_t)(tail & (ring->capacity - 1));
+        size_t run = (size_t)(head - tail);
+        if (run > count) run = count;
+        if (run > ring->capacity - offset) run = ring->capacity - offset;
+        memcpy(out, ring->words + offset * width, run * width * sizeof(uint32_t));
+        out += run * width;
+        tail += run;
+        count -= run;
+        atomic_store(&ring->tail, tail);
+        if (atomic_load(&dealer->sleeping)) {
+            pthread_mutex_lock(&dealer->lock);
+            pthread_cond_signal(&dealer->wake);
+            pthread_mutex_unlock(&dealer->lock);
+        }
+    }
+}
+
+#endif // MPC_HAVE_THREADS
+
+// --- Secret-Shared Evaluation ---
+
+// Evaluates a compiled Program with every value split into additive shares
+// mod 2^32 among N parties. Each party is a thread that only ever holds its
+// own shares and talks to the others through in-process message queues, so
+// a run has the rounds and traffic of a real deployment without a network.
+// Additions, subtractions and multiplications by constants are local;
+// multiplications of two shared values consume Beaver triples. Comparisons,
+// absolute, ifelse and division convert to XOR-shared words with edaBits,
+// run a boolean circuit built on a word-parallel Kogge-Stone adder whose
+// ANDs consume bitwise Beaver triples, and convert back with edaBits or
+// daBits. Rows go through in blocks of BATCH_BLOCK, and each round carries
+// the whole block in one message per peer.
+//
+// Correlated randomness comes from the dealer above; input shares are
+// derived by each party from the same keyed mixer, standing in for the
+// input owner, so no party thread ever sees another party's share.
+// Division opens one bit per row, whether the divisor is zero, so that the
+// run can fail like the other engines do.
+
+#ifdef MPC_HAVE_THREADS
+
+typedef struct MpcMessage {
+    struct MpcMessage* next;
+    size_t count;
+    uint32_t words[];
+} MpcMessage;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    MpcMessage* head;
+    MpcMessage* tail;
+} MpcChannel;
+
+typedef struct MpcSession MpcSession;
+typedef struct MpcSchedule MpcSchedule;
+typedef struct MpcTask MpcTask;
+typedef struct MpcLevel MpcLevel;
+
+typedef struct {
+    MpcSession* session;
+    int id;
+    MpcTask* task;                      // set on the copies that run one kind of gate of a level
+    MpcLevel* level;                    // the party's gate threads, started by the first level that needs them
+    uint32_t* staging[MPC_ITEM_TYPES];  // items taken from the dealer for the current step
+    size_t staging_capacity[MPC_ITEM_TYPES];
+    MpcStats stats;
+    bool division_by_zero;
+    pthread_t thread;
+} Party;
+
+typedef struct {
+    uint32_t* values;
+    size_t count;
+    bool boolean;
+} MpcOpening;
+
+const uint32_t* mpc_task_take(Party* p, MpcItemType type, size_t count);
+void mpc_task_open(Party* p, uint32_t* values, size_t count, bool boolean);
+
+struct MpcSession {
+    const Program* prog;
+    const MpcSchedule* sched;
+    int num_parties;
+    uint64_t seed;
+    MpcDealer* dealer;
+    const int32_t* inputs[NUM_VARIABLES];
+    size_t n;
+    uint32_t* output_shares[MPC_MAX_PARTIES];
+    MpcChannel channels[MPC_MAX_PARTIES][MPC_MAX_PARTIES];  // [sender][receiver]
+    Party parties[MPC_MAX_PARTIES];
+};
+
+// Returns the next `count` items of `type`. The pointer is valid until the
+// next take of that type.
+const uint32_t* mpc_take(Party* p, MpcItemType type, size_t count) {
+    if (p->task) return mpc_task_take(p, type, count);
+    if (count > p->staging_capacity[type]) {
+        p->staging_capacity[type] = count;
+        p->staging[type] = realloc(p->staging[type], count * (size_t)mpc_item_width[type] * sizeof(uint32_t));
+    }
+    mpc_dealer_take(p->session->dealer, p->id, type, count, p->staging[type], &p->stats);
+    p->stats.items[type] += count;
+    return p->staging[type];
+}
+
+void mpc_send(MpcSession* s, int from, int to, const uint32_t* words, size_t count) {
+    MpcMessage* m = malloc(sizeof(MpcMessage) + count * sizeof(uint32_t));
+    m->next = NULL;
+    m->count = count;
+    memcpy(m->words, words, count * sizeof(uint32_t));
+
+    MpcChannel* ch = &s->channels[from][to];
+    pthread_mutex_lock(&ch->lock);
+    if (ch->tail) ch->tail->next = m;
+    else ch->head = m;
+    ch->tail = m;
+    pthread_cond_signal(&ch->ready);
+    pthread_mutex_unlock(&ch->lock);
+}
+
+MpcMessage* mpc_receive(MpcSession* s, int from, int to) {
+    MpcChannel* ch = &s->channels[from][to];
+    pthread_mutex_lock(&ch->lock);
+    while (!ch->head) pthread_cond_wait(&ch->ready, &ch->lock);
+    MpcMessage* m = ch->head;
+    ch->head = m->next;
+    if (!ch->head) ch->tail = NULL;
+    pthread_mutex_unlock(&ch->lock);
+    return m;
+}
+
+// One round: every party sends its shares of all `count` openings to every
+// other party in one message and replaces them with the opened values.
+void mpc_open_many(Party* p, const MpcOpening* openings, int count) {
+    MpcSession* s = p->session;
+    size_t total = 0;
+    for (int k = 0; k < count; k++) total += openings[k].count;
+    uint32_t* words = malloc((total ? total : 1) * sizeof(uint32_t));
+    uint32_t* at = words;
+    for (int k = 0; k < count; k++) {
+        memcpy(at, openings[k].values, openings[k].count * sizeof(uint32_t));
+        at += openings[k].count;
+    }
+
+    for (int q = 0; q < s->num_parties; q++) {
+        if (q != p->id) mpc_send(s, p->id, q, words, total);
+    }
+    for (int q = 0; q < s->num_parties; q++) {
+        if (q == p->id) continue;
+        MpcMessage* m = mpc_receive(s, q, p->id);
+        const uint32_t* theirs = m->words;
+        for (int k = 0; k < count; k++) {
+            uint32_t* values = openings[k].values;
+            for (size_t i = 0; i < openings[k].count; i++) {
+                values[i] = openings[k].boolean ? values[i] ^ theirs[i] : values[i] + theirs[i];
+            }
+            theirs += openings[k].count;
+        }
+        free(m);
+    }
+    free(words);
+    p->stats.rounds++;
+    p->stats.bytes += (uint64_t)total * sizeof(uint32_t) * (uint64_t)(s->num_parties - 1);
+}
+
+void mpc_open(Party* p, uint32_t* values, size_t count, bool boolean) {
+    if (p->task) {
+        mpc_task_open(p, values, count, boolean);
+        return;
+    }
+    MpcOpening opening = { values, count, boolean };
+    mpc_open_many(p, &opening, 1);
+}
+
+// A public value's share: party 0 holds it, everyone else holds zero.
+static inline uint32_t mpc_public(const Party* p, uint32_t value) {
+    return p->id == 0 ? value : 0;
+}
+
+// out = x * y on arithmetic shares. `out` may alias the inputs.
+void mpc_multiply(Party* p, const uint32_t* x, const uint32_t* y, uint32_t* out, size_t n) {
+    const uint32_t* t = mpc_take(p, MPC_ARITH_TRIPLE, n);
+    uint32_t* de = malloc(2 * n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        de[i] = x[i] - t[3 * i];
+        de[n + i] = y[i] - t[3 * i + 1];
+    }
+    mpc_open(p, de, 2 * n, false);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t d = de[i], e = de[n + i];
+        out[i] = t[3 * i + 2] + d * t[3 * i + 1] + e * t[3 * i] + mpc_public(p, d * e);
+    }
+    free(de);
+}
+
+// out = x & y on XOR shares, 32 ANDs per word. `out` may alias the inputs.
+void mpc_and(Party* p, const uint32_t* x, const uint32_t* y, uint32_t* out, size_t n) {
+    const uint32_t* t = mpc_take(p, MPC_BOOL_TRIPLE, n);
+    uint32_t* de = malloc(2 * n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        de[i] = x[i] ^ t[3 * i];
+        de[n + i] = y[i] ^ t[3 * i + 1];
+    }
+    mpc_open(p, de, 2 * n, true);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t d = de[i], e = de[n + i];
+        out[i] = t[3 * i + 2] ^ (d & t[3 * i + 1]) ^ (e & t[3 * i]) ^ mpc_public(p, d & e);
+    }
+    free(de);
+}
+
+// sum = x + y + carry_in on XOR-shared words by a Kogge-Stone prefix over
+// generate/propagate: one round for x & y (none if x is public), then one
+// per doubling of the span, five in all. A bit never both generates and
+// propagates, so the prefix's ORs are XORs and stay local. If `carry_out`
+// is not NULL it receives the carry out of bit 31 in bit 0.
+void mpc_add_boolean(Party* p, const uint32_t* x, bool x_public, const uint32_t* y, uint32_t carry_in,
+                     uint32_t* sum, uint32_t* carry_out, size_t n) {
+    uint32_t* prop = malloc(n * sizeof(uint32_t));
+    uint32_t* gen = malloc(n * sizeof(uint32_t));
+    uint32_t* group = malloc(n * sizeof(uint32_t));
+    uint32_t* lhs = malloc(2 * n * sizeof(uint32_t));
+    uint32_t* rhs = malloc(2 * n * sizeof(uint32_t));
+
+    for (size_t i = 0; i < n; i++) prop[i] = x_public ? y[i] ^ mpc_public(p, x[i]) : x[i] ^ y[i];
+    if (x_public) {
+        for (size_t i = 0; i < n; i++) gen[i] = x[i] & y[i];
+    } else {
+        mpc_and(p, x, y, gen, n);
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (carry_in) gen[i] ^= prop[i] & 1;
+        group[i] = prop[i];
+    }
+
+    for (int span = 1; span < 32; span *= 2) {
+        // The last level only needs the generate half.
+        size_t count = span == 16 ? n : 2 * n;
+        for (size_t i = 0; i < n; i++) {
+            lhs[i] = group[i];
+            rhs[i] = gen[i] << span;
+            lhs[n + i] = group[i];
+            rhs[n + i] = group[i] << span;
+        }
+        mpc_and(p, lhs, rhs, lhs, count);
+        for (size_t i = 0; i < n; i++) {
+            gen[i] ^= lhs[i];
+            if (count > n) group[i] = lhs[n + i];
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (carry_out) carry_out[i] = gen[i] >> 31;
+        sum[i] = prop[i] ^ (gen[i] << 1) ^ mpc_public(p, carry_in);
+    }
+
+    free(prop);
+    free(gen);
+    free(group);
+    free(lhs);
+    free(rhs);
+}
+
+// Arithmetic to XOR shares: open x + r for a dealt edaBit r, then subtract
+// r's bits from the public sum as c + ~r + 1.
+void mpc_to_boolean(Party* p, const uint32_t* x, uint32_t* out, size_t n) {
+    uint32_t* masked = malloc(n * sizeof(uint32_t));
+    uint32_t* not_r = malloc(n * sizeof(uint32_t));
+    const uint32_t* r = mpc_take(p, MPC_EDABIT, n);
+    for (size_t i = 0; i < n; i++) {
+        masked[i] = x[i] + r[2 * i];
+        not_r[i] = r[2 * i + 1] ^ mpc_public(p, ~0u);
+    }
+    mpc_open(p, masked, n, false);
+    mpc_add_boolean(p, masked, true, not_r, 1, out, NULL, n);
+    free(masked);
+    free(not_r);
+}
+
+// XOR to arithmetic shares: add an edaBit's bits, open the sum and take
+// away its arithmetic share.
+void mpc_to_arithmetic(Party* p, const uint32_t* x, uint32_t* out, size_t n) {
+    uint32_t* r_arith = malloc(n * sizeof(uint32_t));
+    uint32_t* masked = malloc(n * sizeof(uint32_t));
+    const uint32_t* r = mpc_take(p, MPC_EDABIT, n);
+    for (size_t i = 0; i < n; i++) {
+        r_arith[i] = r[2 * i];
+        masked[i] = r[2 * i + 1];
+    }
+    mpc_add_boolean(p, x, false, masked, 0, masked, NULL, n);
+    mpc_open(p, masked, n, true);
+    for (size_t i = 0; i < n; i++) out[i] = mpc_public(p, masked[i]) - r_arith[i];
+    free(r_arith);
+    free(masked);
+}
+
+// Bit 0 of XOR-shared `bits` to an arithmetic 0/1, masked by a daBit.
+void mpc_bit_to_arithmetic(Party* p, const uint32_t* bits, uint32_t* out, size_t n) {
+    uint32_t* masked = malloc(n * sizeof(uint32_t));
+    const uint32_t* r = mpc_take(p, MPC_DABIT, n);
+    for (size_t i = 0; i < n; i++) masked[i] = (bits[i] ^ r[2 * i + 1]) & 1;
+    mpc_open(p, masked, n, true);
+    for (size_t i = 0; i < n; i++) out[i] = masked[i] ? mpc_public(p, 1) - r[2 * i] : r[2 * i];
+    free(masked);
+}
+
+// Bit 0 of out is set where the XOR-shared word is zero: an AND tree over
+// the inverted bits, five rounds.
+void mpc_is_zero(Party* p, const uint32_t* x, uint32_t* out, size_t n) {
+    uint32_t* shifted = malloc(n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) out[i] = x[i] ^ mpc_public(p, ~0u);
+    for (int span = 16; span >= 1; span /= 2) {
+        for (size_t i = 0; i < n; i++) shifted[i] = out[i] >> span;
+        mpc_and(p, out, shifted, out, n);
+    }
+    free(shifted);
+}
+
+// Arithmetic 0/1 for greater_than(x, y): x - y is neither negative nor zero.
+void mpc_greater_than(Party* p, const uint32_t* x, const uint32_t* y, uint32_t* out, size_t n) {
+    uint32_t* bits = malloc(n * sizeof(uint32_t));
+    uint32_t* zero = malloc(n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) out[i] = x[i] - y[i];
+    mpc_to_boolean(p, out, bits, n);
+    mpc_is_zero(p, bits, zero, n);
+    for (size_t i = 0; i < n; i++) {
+        bits[i] = (bits[i] >> 31) ^ mpc_public(p, 1);
+        zero[i] ^= mpc_public(p, 1);
+    }
+    mpc_and(p, bits, zero, bits, n);
+    mpc_bit_to_arithmetic(p, bits, out, n);
+    free(bits);
+    free(zero);
+}
+
+// Arithmetic 0/1 for x != 0 (negate = false) or x == 0 (negate = true).
+void mpc_nonzero(Party* p, const uint32_t* x, bool negate, uint32_t* out, size_t n) {
+    uint32_t* bits = malloc(n * sizeof(uint32_t));
+    mpc_to_boolean(p, x, bits, n);
+    mpc_is_zero(p, bits, bits, n);
+    if (!negate) {
+        for (size_t i = 0; i < n; i++) bits[i] ^= mpc_public(p, 1);
+    }
+    mpc_bit_to_arithmetic(p, bits, out, n);
+    free(bits);
+}
+
+// out = cond ? x : y for an arithmetic 0/1 `cond`, as y + cond * (x - y).
+// `out` may alias `x` or `y`.
+void mpc_select(Party* p, const uint32_t* cond, const uint32_t* x, const uint32_t* y, uint32_t* out, size_t n) {
+    uint32_t* diff = calloc(n, sizeof(uint32_t));
+    uint32_t* keep = malloc(n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        diff[i] = x[i] - y[i];
+        keep[i] = y[i];
+    }
+    mpc_multiply(p, cond, diff, diff, n);
+    for (size_t i = 0; i < n; i++) out[i] = keep[i] + diff[i];
+    free(diff);
+    free(keep);
+}
+
+void mpc_absolute(Party* p, const uint32_t* x, uint32_t* out, size_t n) {
+    uint32_t* bits = malloc(n * sizeof(uint32_t));
+    uint32_t* product = malloc(n * sizeof(uint32_t));
+    mpc_to_boolean(p, x, bits, n);
+    for (size_t i = 0; i < n; i++) bits[i] >>= 31;
+    mpc_bit_to_arithmetic(p, bits, bits, n);
+    mpc_multiply(p, bits, x, product, n);
+    for (size_t i = 0; i < n; i++) out[i] = x[i] - 2 * product[i];
+    free(bits);
+    free(product);
+}
+
+// divide_pow2(): add 2^k - 1 to negative values, then shift arithmetically.
+void mpc_divide_pow2(Party* p, const uint32_t* x, int k, uint32_t* out, size_t n) {
+    uint32_t* bits = malloc(n * sizeof(uint32_t));
+    uint32_t* bias = calloc(n, sizeof(uint32_t));
+    mpc_to_boolean(p, x, bits, n);
+    for (size_t i = 0; i < n; i++) bias[i] = (uint32_t)((int32_t)bits[i] >> 31) & ((1u << k) - 1);
+    mpc_add_boolean(p, bits, false, bias, 0, bits, NULL, n);
+    for (size_t i = 0; i < n; i++) bits[i] = (uint32_t)((int32_t)bits[i] >> k);
+    mpc_to_arithmetic(p, bits, out, n);
+    free(bits);
+    free(bias);
+}
+
+// (v ^ s) + (s & 1) for each word's sign mask s: negates negative words.
+void mpc_negate_if_negative(Party* p, const uint32_t* v, const uint32_t* sign, uint32_t* out, size_t n) {
+    uint32_t* flipped = malloc(n * sizeof(uint32_t));
+    uint32_t* low = malloc(n * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        flipped[i] = v[i] ^ sign[i];
+        low[i] = sign[i] & 1;
+    }
+    mpc_add_boolean(p, flipped, false, low, 0, out, NULL, n);
+    free(flipped);
+    free(low);
+}
+
+// divide_signed() as restoring division on the magnitudes in the boolean
+// domain, 32 steps of subtract-and-select. Returns true if any divisor in
+// the block was zero, which is opened to every party.
+bool mpc_divide(Party* p, const uint32_t* x, const uint32_t* y, uint32_t* out, size_t n) {
+    uint32_t* words = malloc(2 * n * sizeof(uint32_t));
+    uint32_t* signs = calloc(2 * n, sizeof(uint32_t));
+    uint32_t* mags = malloc(2 * n * sizeof(uint32_t));
+    uint32_t* rem = calloc(n, sizeof(uint32_t));
+    uint32_t* quo = calloc(n, sizeof(uint32_t));
+    uint32_t* not_den = malloc(n * sizeof(uint32_t));
+    uint32_t* diff = malloc(n * sizeof(uint32_t));
+    uint32_t* ge = malloc(n * sizeof(uint32_t));
+    uint32_t* mask = calloc(n, sizeof(uint32_t));
+
+    memcpy(words, x, n * sizeof(uint32_t));
+    memcpy(words + n, y, n * sizeof(uint32_t));
+    mpc_to_boolean(p, words, words, 2 * n);
+
+    bool division_by_zero = false;
+    mpc_is_zero(p, words + n, diff, n);
+    for (size_t i = 0; i < n; i++) diff[i] &= 1;
+    mpc_open(p, diff, n, true);
+    for (size_t i = 0; i < n; i++) division_by_zero |= diff[i] != 0;
+
+    for (size_t i = 0; i < 2 * n; i++) signs[i] = (uint32_t)((int32_t)words[i] >> 31);
+    mpc_negate_if_negative(p, words, signs, mags, 2 * n);
+    for (size_t i = 0; i < n; i++) not_den[i] = mags[n + i] ^ mpc_public(p, ~0u);
+
+    for (int bit = 31; bit >= 0; bit--) {
+        for (size_t i = 0; i < n; i++) rem[i] = (rem[i] << 1) ^ ((mags[i] >> bit) & 1);
+        // rem - den = rem + ~den + 1; no borrow means rem >= den.
+        mpc_add_boolean(p, rem, false, not_den, 1, diff, ge, n);
+        for (size_t i = 0; i < n; i++) {
+            mask[i] = -(ge[i] & 1);
+            diff[i] ^= rem[i];
+        }
+        mpc_and(p, mask, diff, diff, n);
+        for (size_t i = 0; i < n; i++) {
+            rem[i] ^= diff[i];
+            quo[i] ^= (ge[i] & 1) << bit;
+        }
+    }
+
+    for (size_t i = 0; i < n; i++) signs[i] ^= signs[n + i];
+    mpc_negate_if_negative(p, quo, signs, quo, n);
+    mpc_to_arithmetic(p, quo, out, n);
+
+    free(words);
+    free(signs);
+    free(mags);
+    free(rem);
+    free(quo);
+    free(not_den);
+    free(diff);
+    free(ge);
+    free(mask);
+    return division_by_zero;
+}
+
+bool is_constant_reg(const Program* prog, int reg) {
+    return reg >= NUM_VARIABLES && reg < NUM_VARIABLES + prog->num_constants;
+}
+
+// The parties do not walk the Program in order. It is first renamed into
+// single-assignment slots, so that instructions can move past each other
+// without clobbering reused registers, and split into local steps and
+// gates: multiplications (with the selects of max, min and ifelse), zero
+// tests, comparisons, absolutes, divisions and divide_pow2s. A gate's level
+// is one more than the deepest gate it depends on. The parties run a level
+// at a time and each kind of gate in it as one call over all of its gates'
+// rows, so a level of independent multiplications costs a single round and
+// the rounds of an evaluation follow the multiplicative depth rather than
+// the number of gates.
+
+typedef enum {
+    MPC_STEP_LOCAL,
+    MPC_STEP_MULTIPLY,      // src[0] * src[1], or with src[2] a select: src[2] + src[0] * (src[1] - src[2])
+    MPC_STEP_IS_ZERO,       // src[0] - src[1] == 0, src[0] == 0 if src[1] < 0
+    MPC_STEP_GREATER_THAN,
+    MPC_STEP_ABSOLUTE,
+    MPC_STEP_DIVIDE,
+    MPC_STEP_DIVIDE_POW2    // by 2^param
+} MpcStepKind;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t opcode;         // local steps: OPC_ADD, OPC_SUB, OPC_MUL by `constant` or OPC_SHIFT_LEFT by `param`
+    uint8_t param;
+    uint32_t constant;
+    int level;
+    int order;
+    int dst;
+    int src[3];
+} MpcStep;
+
+struct MpcSchedule {
+    MpcStep* steps;         // by level; in a level, gates grouped by kind first, then local steps in program order
+    int count;
+    int num_slots;
+    int result_slot;
+    int levels;
+    int gates;
+};
+
+typedef struct {
+    MpcSchedule* sched;
+    int slot_of[PROGRAM_MAX_REGS];
+    int* level_of;
+    bool* is_bit;           // holds the 0/1 of a comparison or zero test
+    bool levelized;
+} MpcScheduleBuilder;
+
+int mpc_schedule_add(MpcScheduleBuilder* b, MpcStep step) {
+    MpcSchedule* sched = b->sched;
+    int depth = 0;
+    for (int k = 0; k < 3; k++) {
+        if (step.src[k] >= 0 && b->level_of[step.src[k]] > depth) depth = b->level_of[step.src[k]];
+    }
+    if (step.kind == MPC_STEP_LOCAL) {
+        step.level = depth;
+    } else {
+        sched->gates++;
+        // Serially, every gate gets a level of its own in program order.
+        step.level = b->levelized ? depth + 1 : sched->gates;
+        if (step.level > sched->levels) sched->levels = step.level;
+    }
+    step.order = sched->count;
+    step.dst = sched->num_slots++;
+    b->level_of[step.dst] = step.level;
+    b->is_bit[step.dst] = step.kind == MPC_STEP_IS_ZERO || step.kind == MPC_STEP_GREATER_THAN;
+    sched->steps[sched->count++] = step;
+    return step.dst;
+}
+
+int mpc_step_key(const MpcStep* step) {
+    return step->kind << 8 | step->param;
+}
+
+int compare_mpc_steps(const void* left, const void* right) {
+    const MpcStep* x = left;
+    const MpcStep* y = right;
+    if (x->level != y->level) return x->level - y->level;
+    bool x_local = x->kind == MPC_STEP_LOCAL, y_local = y->kind == MPC_STEP_LOCAL;
+    if (x_local != y_local) return x_local - y_local;
+    if (!x_local && mpc_step_key(x) != mpc_step_key(y)) return mpc_step_key(x) - mpc_step_key(y);
+    return x->order - y->order;
+}
+
+MpcSchedule* build_mpc_schedule(const Program* prog, bool levelized) {
+    MpcSchedule* sched = calloc(1, sizeof(MpcSchedule));
+    int base = NUM_VARIABLES + prog->num_constants;
+    // max, min and ifelse take two steps each.
+    sched->steps = malloc((size_t)(2 * prog->count + 1) * sizeof(MpcStep));
+    sched->num_slots = base;
+
+    int max_slots = base + 2 * prog->count + 1;
+    MpcScheduleBuilder b = { sched, { 0 }, calloc((size_t)max_slots, sizeof(int)), calloc((size_t)max_slots, sizeof(bool)),
+                             levelized };
+    for (int r = 0; r < base; r++) b.slot_of[r] = r;
+
+    for (int k = 0; k < prog->count; k++) {
+        const Instruction* ins = &prog->code[k];
+        int x = b.slot_of[ins->src[0]];
+        int y = b.slot_of[ins->src[1]];
+        MpcStep step = { .kind = MPC_STEP_LOCAL, .opcode = ins->opcode, .src = { x, y, -1 } };
+        int dst;
+
+        switch (ins->opcode) {
+            case OPC_ADD:
+            case OPC_SUB:
+                dst = mpc_schedule_add(&b, step);
+                break;
+            case OPC_MUL:
+            case OPC_MUL_SECRET:
+                if (is_constant_reg(prog, ins->src[1]) || is_constant_reg(prog, ins->src[0])) {
+                    bool right = is_constant_reg(prog, ins->src[1]);
+                    step.opcode = OPC_MUL;
+                    step.constant = (uint32_t)prog->constants[ins->src[right ? 1 : 0] - NUM_VARIABLES];
+                    step.src[0] = right ? x : y;
+                    step.src[1] = -1;
+                } else {
+                    step.kind = MPC_STEP_MULTIPLY;
+                }
+                dst = mpc_schedule_add(&b, step);
+                break;
+            case OPC_DIV:
+            case OPC_DIV_SECRET:
+                step.kind = MPC_STEP_DIVIDE;
+                dst = mpc_schedule_add(&b, step);
+                break;
+            case OPC_SHIFT_LEFT:
+                step.param = (uint8_t)program_constant(prog, ins->src[1]);
+                step.src[1] = -1;
+                dst = mpc_schedule_add(&b, step);
+                break;
+            case OPC_DIVIDE_POW2:
+                step.kind = MPC_STEP_DIVIDE_POW2;
+                step.param = (uint8_t)program_constant(prog, ins->src[1]);
+                step.src[1] = -1;
+                dst = mpc_schedule_add(&b, step);
+                break;
+            case OPC_MAX:
+            case OPC_MIN: {
+                bool is_max = ins->opcode == OPC_MAX;
+                MpcStep compare = { .kind = MPC_STEP_GREATER_THAN, .src = { is_max ? x : y, is_max ? y : x, -1 } };
+                MpcStep select = { .kind = MPC_STEP_MULTIPLY, .src = { mpc_schedule_add(&b, compare), x, y } };
+                dst = mpc_schedule_add(&b, select);
+                break;
+            }
+            case OPC_EQUAL:
+                step.kind = MPC_STEP_IS_ZERO;
+                dst = mpc_schedule_add(&b, step);
+                break;
+            case OPC_GREATER_THAN:
+                step.kind = MPC_STEP_GREATER_THAN;
+                dst = mpc_schedule_add(&b, step);
+                break;
+            case OPC_IFELSE: {
+                // A comparison's 0/1 is selected on directly. Anything else is
+                // selected on being zero, so that all zero tests are one kind of gate.
+                int cond = b.slot_of[ins->src[2]];
+                MpcStep select = { .kind = MPC_STEP_MULTIPLY, .src = { cond, x, y } };
+                if (!b.is_bit[cond]) {
+                    MpcStep test = { .kind = MPC_STEP_IS_ZERO, .src = { cond, -1, -1 } };
+                    select = (MpcStep){ .kind = MPC_STEP_MULTIPLY, .src = { mpc_schedule_add(&b, test), y, x } };
+                }
+                dst = mpc_schedule_add(&b, select);
+                break;
+            }
+            case OPC_ABSOLUTE:
+                step.kind = MPC_STEP_ABSOLUTE;
+                step.src[1] = -1;
+                dst = mpc_schedule_add(&b, step);
+                break;
+            default:
+                printf("Error: Unknown opcode %d.\n", ins->opcode);
+                exit(1);
+        }
+        b.slot_of[ins->dst] = dst;
+    }
+
+    sched->result_slot = b.slot_of[prog->result_reg];
+    qsort(sched->steps, (size_t)sched->count, sizeof(MpcStep), compare_mpc_steps);
+    free(b.level_of);
+    free(b.is_bit);
+    return sched;
+}
+
+// Items of each type a gate consumes per row, following the protocols
+// above: a Kogge-Stone addition takes 9 AND triples per word with a public
+// operand and 10 without, a zero test 5, a conversion to XOR shares one
+// edaBit and an addition.
+static const uint16_t mpc_gate_items[][MPC_ITEM_TYPES] = {
+    [MPC_STEP_MULTIPLY] = { 1, 0, 0, 0 },
+    [MPC_STEP_IS_ZERO] = { 0, 14, 1, 1 },
+    [MPC_STEP_GREATER_THAN] = { 0, 15, 1, 1 },
+    [MPC_STEP_ABSOLUTE] = { 1, 9, 1, 1 },
+    [MPC_STEP_DIVIDE] = { 0, 415, 3, 0 },
+    [MPC_STEP_DIVIDE_POW2] = { 0, 29, 2, 0 },
+};
+
+// Items of each type, per party, that evaluating `sched` on n rows takes.
+void mpc_schedule_demand(const MpcSchedule* sched, size_t n, uint64_t* demand) {
+    memset(demand, 0, MPC_ITEM_TYPES * sizeof(uint64_t));
+    for (int k = 0; k < sched->count; k++) {
+        const MpcStep* step = &sched->steps[k];
+        if (step->kind == MPC_STEP_LOCAL) continue;
+        for (int t = 0; t < MPC_ITEM_TYPES; t++) demand[t] += (uint64_t)mpc_gate_items[step->kind][t] * n;
+    }
+}
+
+void free_mpc_schedule(MpcSchedule* sched) {
+    free(sched->steps);
+    free(sched);
+}
+
+void mpc_local_step(const MpcStep* step, uint32_t** slots, size_t n) {
+    const uint32_t* x = slots[step->src[0]];
+    const uint32_t* y = step->src[1] >= 0 ? slots[step->src[1]] : NULL;
+    uint32_t* dst = slots[step->dst];
+
+    switch (step->opcode) {
+        case OPC_ADD: for (size_t i = 0; i < n; i++) dst[i] = x[i] + y[i]; break;
+        case OPC_SUB: for (size_t i = 0; i < n; i++) dst[i] = x[i] - y[i]; break;
+        case OPC_MUL: for (size_t i = 0; i < n; i++) dst[i] = x[i] * step->constant; break;
+        case OPC_SHIFT_LEFT: for (size_t i = 0; i < n; i++) dst[i] = x[i] << step->param; break;
+    }
+}
+
+// Runs `count` gates of one kind and level over the block as a single
+// circuit on count * n rows.
+void mpc_gate_group(Party* p, const MpcStep* steps, int count, uint32_t** slots, size_t n) {
+    size_t total = (size_t)count * n;
+    uint32_t* lhs = calloc(total, sizeof(uint32_t));
+    uint32_t* rhs = calloc(total, sizeof(uint32_t));
+    uint32_t* res = malloc(total * sizeof(uint32_t));
+
+    for (int g = 0; g < count; g++) {
+        const MpcStep* step = &steps[g];
+        const uint32_t* x = slots[step->src[0]];
+        const uint32_t* y = step->src[1] >= 0 ? slots[step->src[1]] : NULL;
+        const uint32_t* z = step->src[2] >= 0 ? slots[step->src[2]] : NULL;
+        uint32_t* l = lhs + (size_t)g * n;
+        uint32_t* r = rhs + (size_t)g * n;
+        for (size_t i = 0; i < n; i++) {
+            if (step->kind == MPC_STEP_IS_ZERO) {
+                l[i] = y ? x[i] - y[i] : x[i];
+            } else {
+                l[i] = x[i];
+                r[i] = z ? y[i] - z[i] : y ? y[i] : 0;
+            }
+        }
+    }
+
+    switch (steps[0].kind) {
+        case MPC_STEP_MULTIPLY: mpc_multiply(p, lhs, rhs, res, total); break;
+        case MPC_STEP_IS_ZERO: mpc_nonzero(p, lhs, true, res, total); break;
+        case MPC_STEP_GREATER_THAN: mpc_greater_than(p, lhs, rhs, res, total); break;
+        case MPC_STEP_ABSOLUTE: mpc_absolute(p, lhs, res, total); break;
+        case MPC_STEP_DIVIDE: p->division_by_zero |= mpc_divide(p, lhs, rhs, res, total); break;
+        case MPC_STEP_DIVIDE_POW2: mpc_divide_pow2(p, lhs, steps[0].param, res, total); break;
+    }
+
+    for (int g = 0; g < count; g++) {
+        const MpcStep* step = &steps[g];
+        uint32_t* dst = slots[step->dst];
+        const uint32_t* out = res + (size_t)g * n;
+        if (step->src[2] >= 0) {
+            const uint32_t* z = slots[step->src[2]];
+            for (size_t i = 0; i < n; i++) dst[i] = z[i] + out[i];
+        } else {
+            memcpy(dst, out, n * sizeof(uint32_t));
+        }
+    }
+
+    free(lhs);
+    free(rhs);
+    free(res);
+}
+
+// Gates of different kinds in one level run as tasks on threads of their
+// own, each with a copy of the party. A task hands its takes and openings to
+// the party's thread and waits. Once no task is running, the party serves
+// the waiting takes in task order or, when every live task is opening,
+// opens them all in one round. The requests each task makes do not depend
+// on timing, so every party serves the same takes and openings in the same
+// order, and the level costs as many rounds as its deepest kind of gate.
+// The threads are started by the first level with that many kinds of gate
+// and then wait for the next level, until the party finishes.
+
+typedef enum {
+    MPC_TASK_IDLE, MPC_TASK_RUNNING, MPC_TASK_TAKE, MPC_TASK_OPEN, MPC_TASK_DONE, MPC_TASK_QUIT
+} MpcTaskState;
+
+struct MpcLevel {
+    pthread_mutex_t lock;
+    pthread_cond_t stopped;     // some task is no longer running
+    MpcTask** tasks;
+    int count;
+    MpcOpening* openings;
+};
+
+struct MpcTask {
+    Party party;
+    MpcLevel* level;
+    MpcTaskState state;
+    pthread_cond_t resume;
+    MpcItemType type;           // MPC_TASK_TAKE
+    size_t count;
+    MpcOpening opening;         // MPC_TASK_OPEN
+    const MpcStep* steps;
+    int num_steps;
+    uint32_t** slots;
+    size_t n;
+    pthread_t thread;
+};
+
+void mpc_task_wait(MpcTask* t, MpcTaskState state) {
+    MpcLevel* level = t->level;
+    pthread_mutex_lock(&level->lock);
+    t->state = state;
+    pthread_cond_signal(&level->stopped);
+    while (t->state == state) pthread_cond_wait(&t->resume, &level->lock);
+    pthread_mutex_unlock(&level->lock);
+}
+
+const uint32_t* mpc_task_take(Party* p, MpcItemType type, size_t count) {
+    MpcTask* t = p->task;
+    t->type = type;
+    t->count = count;
+    mpc_task_wait(t, MPC_TASK_TAKE);
+    return p->staging[type];
+}
+
+void mpc_task_open(Party* p, uint32_t* values, size_t count, bool boolean) {
+    MpcTask* t = p->task;
+    t->opening = (MpcOpening){ values, count, boolean };
+    mpc_task_wait(t, MPC_TASK_OPEN);
+}
+
+void* mpc_task_main(void* arg) {
+    MpcTask* t = arg;
+    MpcLevel* level = t->level;
+    pthread_mutex_lock(&level->lock);
+    for (;;) {
+        while (t->state == MPC_TASK_IDLE || t->state == MPC_TASK_DONE) pthread_cond_wait(&t->resume, &level->lock);
+        if (t->state == MPC_TASK_QUIT) break;
+        pthread_mutex_unlock(&level->lock);
+        mpc_gate_group(&t->party, t->steps, t->num_steps, t->slots, t->n);
+        pthread_mutex_lock(&level->lock);
+        t->state = MPC_TASK_DONE;
+        pthread_cond_signal(&level->stopped);
+    }
+    pthread_mutex_unlock(&level->lock);
+    return NULL;
+}
+
+// Makes sure `p` has at least `count` gate threads. Call with no task running.
+void mpc_level_reserve(Party* p, int count) {
+    if (!p->level) {
+        p->level = calloc(1, sizeof(MpcLevel));
+        pthread_mutex_init(&p->level->lock, NULL);
+        pthread_cond_init(&p->level->stopped, NULL);
+    }
+    MpcLevel* level = p->level;
+    if (count <= level->count) return;
+
+    level->tasks = realloc(level->tasks, (size_t)count * sizeof(MpcTask*));
+    level->openings = realloc(level->openings, (size_t)count * sizeof(MpcOpening));
+    for (int g = level->count; g < count; g++) {
+        MpcTask* t = calloc(1, sizeof(MpcTask));
+        t->party.session = p->session;
+        t->party.id = p->id;
+        t->party.task = t;
+        t->level = level;
+        t->state = MPC_TASK_IDLE;
+        pthread_cond_init(&t->resume, NULL);
+        if (pthread_create(&t->thread, NULL, mpc_task_main, t) != 0) {
+            printf("Error: Could not start gate thread.\n");
+            exit(1);
+        }
+        level->tasks[g] = t;
+    }
+    level->count = count;
+}
+
+// Stops and frees the party's gate threads.
+void mpc_level_stop(Party* p) {
+    MpcLevel* level = p->level;
+    if (!level) return;
+    pthread_mutex_lock(&level->lock);
+    for (int g = 0; g < level->count; g++) {
+        level->tasks[g]->state = MPC_TASK_QUIT;
+        pthread_cond_signal(&level->tasks[g]->resume);
+    }
+    pthread_mutex_unlock(&level->lock);
+
+    for (int g = 0; g < level->count; g++) {
+        MpcTask* t = level->tasks[g];
+        pthread_join(t->thread, NULL);
+        pthread_cond_destroy(&t->resume);
+        for (int k = 0; k < MPC_ITEM_TYPES; k++) free(t->party.staging[k]);
+        free(t);
+    }
+    pthread_mutex_destroy(&level->lock);
+    pthread_cond_destroy(&level->stopped);
+    free(level->tasks);
+    free(level->openings);
+    free(level);
+    p->level = NULL;
+}
+
+// Runs the gates of one level, `groups` runs of one kind each, starting at
+// `steps` and `sizes[g]` long.
+void mpc_level(Party* p, const MpcStep* steps, const int* sizes, int groups, uint32_t** slots, size_t n) {
+    if (groups == 1) {
+        mpc_gate_group(p, steps, sizes[0], slots, n);
+        return;
+    }
+
+    mpc_level_reserve(p, groups);
+    MpcLevel* level = p->level;
+    MpcTask** tasks = level->tasks;
+
+    pthread_mutex_lock(&level->lock);
+    for (int g = 0; g < groups; g++) {
+        MpcTask* t = tasks[g];
+        t->steps = steps;
+        t->num_steps = sizes[g];
+        t->slots = slots;
+        t->n = n;
+        t->state = MPC_TASK_RUNNING;
+        pthread_cond_signal(&t->resume);
+        steps += sizes[g];
+    }
+
+    for (;;) {
+        bool running = false, live = false, took = false;
+        for (int g = 0; g < groups; g++) {
+            running |= tasks[g]->state == MPC_TASK_RUNNING;
+            live |= tasks[g]->state != MPC_TASK_DONE;
+        }
+        if (running) {
+            pthread_cond_wait(&level->stopped, &level->lock);
+            continue;
+        }
+        if (!live) break;
+
+        for (int g = 0; g < groups; g++) {
+            MpcTask* t = tasks[g];
+            if (t->state != MPC_TASK_TAKE) continue;
+            Party* copy = &t->party;
+            if (t->count > copy->staging_capacity[t->type]) {
+                copy->staging_capacity[t->type] = t->count;
+                copy->staging[t->type] = realloc(copy->staging[t->type],
+                                                 t->count * (size_t)mpc_item_width[t->type] * sizeof(uint32_t));
+            }
+            mpc_dealer_take(p->session->dealer, p->id, t->type, t->count, copy->staging[t->type], &p->stats);
+            p->stats.items[t->type] += t->count;
+            t->state = MPC_TASK_RUNNING;
+            pthread_cond_signal(&t->resume);
+            took = true;
+        }
+        if (took) continue;
+
+        int count = 0;
+        for (int g = 0; g < groups; g++) {
+            if (tasks[g]->state == MPC_TASK_OPEN) level->openings[count++] = tasks[g]->opening;
+        }
+        mpc_open_many(p, level->openings, count);
+        for (int g = 0; g < groups; g++) {
+            MpcTask* t = tasks[g];
+            if (t->state != MPC_TASK_OPEN) continue;
+            t->state = MPC_TASK_RUNNING;
+            pthread_cond_signal(&t->resume);
+        }
+    }
+
+    for (int g = 0; g < groups; g++) {
+        MpcTask* t = tasks[g];
+        p->division_by_zero |= t->party.division_by_zero;
+        t->party.division_by_zero = false;
+        t->state = MPC_TASK_IDLE;
+    }
+    pthread_mutex_unlock(&level->lock);
+}
+
+void* party_main(void* arg) {
+    Party* p = arg;
+    MpcSession* s = p->session;
+    const Program* prog = s->prog;
+    const MpcSchedule* sched = s->sched;
+    bool owner = p->id == s->num_parties - 1;
+
+    uint32_t* storage = malloc((size_t)sched->num_slots * BATCH_BLOCK * sizeof(uint32_t));
+    uint32_t** slots = malloc((size_t)sched->num_slots * sizeof(uint32_t*));
+    int* sizes = malloc((size_t)(sched->count + 1) * sizeof(int));
+    for (int r = 0; r < sched->num_slots; r++) slots[r] = storage + (size_t)r * BATCH_BLOCK;
+    for (int k = 0; k < prog->num_constants; k++) {
+        for (size_t i = 0; i < BATCH_BLOCK; i++) slots[NUM_VARIABLES + k][i] = mpc_public(p, (uint32_t)prog->constants[k]);
+    }
+
+    for (size_t start = 0; start < s->n; start += BATCH_BLOCK) {
+        size_t len = s->n - start < BATCH_BLOCK ? s->n - start : BATCH_BLOCK;
+        for (int v = 0; v < NUM_VARIABLES; v++) {
+            uint64_t key = mpc_stream(s->seed, MPC_INPUT_STREAM + v);
+            for (size_t i = 0; i < len; i++) {
+                uint32_t value = owner ? (uint32_t)s->inputs[v][start + i] : 0;
+                slots[v][i] = deal_share(s->num_parties, key, start + i, value, p->id, false);
+            }
+        }
+
+        for (int k = 0; k < sched->count;) {
+            const MpcStep* step = &sched->steps[k];
+            if (step->kind == MPC_STEP_LOCAL) {
+                mpc_local_step(step, slots, len);
+                k++;
+                continue;
+            }
+            int groups = 0;
+            int end = k;
+            while (end < sched->count && sched->steps[end].level == step->level &&
+                   sched->steps[end].kind != MPC_STEP_LOCAL) {
+                if (end == k || mpc_step_key(&sched->steps[end]) != mpc_step_key(&sched->steps[end - 1])) {
+                    sizes[groups++] = 0;
+                }
+                sizes[groups - 1]++;
+                end++;
+            }
+            mpc_level(p, step, sizes, groups, slots, len);
+            k = end;
+        }
+        memcpy(s->output_shares[p->id] + start, slots[sched->result_slot], len * sizeof(uint32_t));
+    }
+
+    mpc_level_stop(p);
+    free(storage);
+    free(slots);
+    free(sizes);
+    for (int t = 0; t < MPC_ITEM_TYPES; t++) free(p->staging[t]);
+    return NULL;
+}
+
+// Shares a, b, c, d among `num_parties` parties, runs `prog` on the shares
+// and reconstructs `out`. With `levelized` false every gate takes its own
+// turn in program order, as a baseline for the schedule. The parties start
+// once the dealer's rings hold what the schedule consumes, up to their
+// MPC_POOL_ITEMS items. `stats` may be NULL.
+void run_program_shared_with(const Program* prog, bool levelized, int num_parties, const int32_t* a,
+                             const int32_t* b, const int32_t* c, const int32_t* d, int32_t* out, size_t n,
+                             MpcStats* stats) {
+    require_four_variables(prog, "Secret-shared evaluation");
+    if (num_parties < 2 || num_parties > MPC_MAX_PARTIES) {
+        printf("Error: Secret sharing needs between 2 and %d parties, got %d.\n", MPC_MAX_PARTIES, num_parties);
+        exit(1);
+    }
+
+    MpcSession* s = calloc(1, sizeof(MpcSession));
+    s->prog = prog;
+    s->sched = build_mpc_schedule(prog, levelized);
+    s->num_parties = num_parties;
+    s->seed = ((uint64_t)time(NULL) << 32) ^ (uint64_t)(uintptr_t)s;
+    s->inputs[0] = a;
+    s->inputs[1] = b;
+    s->inputs[2] = c;
+    s->inputs[3] = d;
+    s->n = n;
+
+    for (int i = 0; i < num_parties; i++) {
+        for (int j = 0; j < num_parties; j++) {
+            pthread_mutex_init(&s->channels[i][j].lock, NULL);
+            pthread_cond_init(&s->channels[i][j].ready, NULL);
+        }
+        s->output_shares[i] = malloc((n ? n : 1) * sizeof(uint32_t));
+        s->parties[i].session = s;
+        s->parties[i].id = i;
+    }
+
+    uint64_t demand[MPC_ITEM_TYPES], dealt_before[MPC_ITEM_TYPES], dealt_after[MPC_ITEM_TYPES];
+    double dealing_before, dealing_after;
+    mpc_schedule_demand(s->sched, n, demand);
+    double start = mpc_seconds();
+    s->dealer = mpc_dealer_acquire(num_parties);
+    mpc_dealer_totals(s->dealer, dealt_before, &dealing_before);
+    mpc_dealer_prefill(s->dealer, demand);
+    double online = mpc_seconds();
+    for (int i = 0; i < num_parties; i++) {
+        if (pthread_create(&s->parties[i].thread, NULL, party_main, &s->parties[i]) != 0) {
+            printf("Error: Could not start party thread.\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < num_parties; i++) pthread_join(s->parties[i].thread, NULL);
+    double finish = mpc_seconds();
+    mpc_dealer_totals(s->dealer, dealt_after, &dealing_after);
+    mpc_dealer_release(s->dealer);
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t sum = 0;
+        for (int q = 0; q < num_parties; q++) sum += s->output_shares[q][i];
+        out[i] = (int32_t)sum;
+    }
+
+    bool division_by_zero = s->parties[0].division_by_zero;
+    if (stats) {
+        *stats = s->parties[0].stats;
+        stats->bytes = 0;
+        stats->stalls = 0;
+        stats->stall_seconds = 0;
+        for (int i = 0; i < num_parties; i++) {
+            stats->bytes += s->parties[i].stats.bytes;
+            stats->stalls += s->parties[i].stats.stalls;
+            stats->stall_seconds += s->parties[i].stats.stall_seconds;
+        }
+        for (int t = 0; t < MPC_ITEM_TYPES; t++) stats->dealt[t] = dealt_after[t] - dealt_before[t];
+        stats->dealer_seconds = dealing_after - dealing_before;
+        stats->levels = (uint64_t)s->sched->levels;
+        stats->gates = (uint64_t)s->sched->gates;
+        stats->prefill_seconds = online - start;
+        stats->online_seconds = finish - online;
+    }
+
+    for (int i = 0; i < num_parties; i++) {
+        for (int j = 0; j < num_parties; j++) {
+            pthread_mutex_destroy(&s->channels[i][j].lock);
+            pthread_cond_destroy(&s->channels[i][j].ready);
+        }
+        free(s->output_shares[i]);
+    }
+    free_mpc_schedule((MpcSchedule*)s->sched);
+    free(s);
+
+    if (division_by_zero) {
+        // The zero test was opened to every party, so flagging it tells no
+        // one more than they already know.
+        if (batch_trap_soft) {
+            batch_trapped = true;
+            return;
+        }
+        printf("Error: Division by zero.\n");
+        exit(1);
+    }
+}
+
+// Evaluates with the levelized schedule unless MPC_SCHEDULE=serial.
+void run_program_shared(const Program* prog, int num_parties, const int32_t* a, const int32_t* b,
+                        const int32_t* c, const int32_t* d, int32_t* out, size_t n, MpcStats* stats) {
+    const char* schedule = getenv("MPC_SCHEDULE");
+    bool levelized = !schedule || strcmp(schedule, "serial") != 0;
+    run_program_shared_with(prog, levelized, num_parties, a, b, c, d, out, n, stats);
+}
+
+#else
+
+void run_program_shared_with(const Program* prog, bool levelized, int num_parties, const int32_t* a,
+                             const int32_t* b, const int32_t* c, const int32_t* d, int32_t* out, size_t n,
+                             MpcStats* stats) {
+    (void)prog; (void)levelized; (void)num_parties; (void)a; (void)b; (void)c; (void)d; (void)out; (void)n;
+    (void)stats;
+    printf("Error: Secret-shared evaluation needs POSIX threads.\n");
+    exit(1);
+}
+
+void run_program_shared(const Program* prog, int num_parties, const int32_t* a, const int32_t* b,
+                        const int32_t* c, const int32_t* d, int32_t* out, size_t n, MpcStats* stats) {
+    run_program_shared_with(prog, true, num_parties, a, b, c, d, out, n, stats);
+}
+
+#endif // MPC_HAVE_THREADS
+
+void print_mpc_stats(const MpcStats* stats) {
+    printf("Shared evaluation: %llu rounds over %llu levels of %llu gates, %llu bytes sent, %llu triples, "
+           "%llu 32-bit AND triples, %llu edaBits, %llu daBits\n",
+           (unsigned long long)stats->rounds, (unsigned long long)stats->levels,
+           (unsigned long long)stats->gates, (unsigned long long)stats->bytes,
+           (unsigned long long)stats->items[MPC_ARITH_TRIPLE], (unsigned long long)stats->items[MPC_BOOL_TRIPLE],
+           (unsigned long long)stats->items[MPC_EDABIT], (unsigned long long)stats->items[MPC_DABIT]);
+
+    uint64_t consumed = 0, dealt = 0;
+    for (int t = 0; t < MPC_ITEM_TYPES; t++) {
+        consumed += stats->items[t];
+        dealt += stats->dealt[t];
+    }
+    printf("Preprocessing: prefilled in %.2f ms, consumed %.3g items/s, refilled %.3g items/s, "
+           "%llu stalls (%.2f ms)\n",
+           stats->prefill_seconds * 1e3,
+           stats->online_seconds > 0 ? (double)consumed / stats->online_seconds : 0.0,
+           stats->dealer_seconds > 0 ? (double)dealt / stats->dealer_seconds : 0.0,
+           (unsigned long long)stats->stalls, stats->stall_seconds * 1e3);
+}
+
+// --- JIT Compilation ---
+
+// Translates a compiled Program into x86-64 machine code that loops over
+// rows itself, so the per-instruction dispatch disappears entirely. The
+// register file stays in memory (rdi points at it); each instruction loads
+// its operands into eax/ecx/edx, runs the inline branch-free sequence for
+// its primitive and stores eax back. Comparisons use setcc/cmov, secret
+// division is the 32-step restoring loop fully unrolled and public division
+// is idiv. The only branches are the row loop, the division-by-zero check
+// that evaluate() also performs and public division's test for -1.
+// Code is written into an anonymous mapping that is flipped from writable
+// to executable before use. jit_compile() returns NULL when the JIT is not
+// available, MPC_JIT=0 is set or the program reads variables past a, b, c
+// and d; callers then run the bytecode instead.
+
+typedef struct {
+    int32_t* regs;
+    const int32_t* cols[NUM_VARIABLES];
+    int32_t* out;
+    size_t n;
+} JitArgs;
+
+typedef int (*JitEntry)(JitArgs* args);
+
+typedef struct {
+    JitEntry entry;
+    void* code;
+    size_t size;
+    const Program* prog;
+} JitProgram;
+
+#ifdef MPC_HAVE_JIT
+
+enum { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+enum { CC_B = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_LE = 0xE, CC_G = 0xF };
+enum { ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29, ALU_XOR = 0x31,
+       ALU_CMP = 0x39, ALU_TEST = 0x85, ALU_MOV = 0x89 };
+enum { EXT_NOT = 2, EXT_NEG = 3, EXT_SHL = 4, EXT_SHR = 5, EXT_SAR = 7, EXT_IDIV = 7 };
+
+typedef struct {
+    uint8_t* bytes;
+    size_t size;
+    size_t capacity;
+    size_t* fixups;  // rel32 slots that must point at the error exit
+    int fixup_count;
+} CodeBuffer;
+
+void emit_byte(CodeBuffer* buf, uint8_t byte) {
+    if (buf->size == buf->capacity) {
+        buf->capacity = buf->capacity ? buf->capacity * 2 : 4096;
+        buf->bytes = realloc(buf->bytes, buf->capacity);
+    }
+    buf->bytes[buf->size++] = byte;
+}
+
+void emit_u32(CodeBuffer* buf, uint32_t value) {
+    for (int i = 0; i < 4; i++) emit_byte(buf, (uint8_t)(value >> (8 * i)));
+}
+
+void emit_rex(CodeBuffer* buf, bool wide, int reg, int index, int base) {
+    uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | ((index >> 3) << 1) | (base >> 3);
+    if (rex != 0x40) emit_byte(buf, rex);
+}
+
+// op r/m32, r32 with both operands in registers (ALU_* opcodes).
+void x86_alu(CodeBuffer* buf, int opcode, int dst, int src) {
+    emit_rex(buf, false, src, 0, dst);
+    emit_byte(buf, (uint8_t)opcode);
+    emit_byte(buf, 0xC0 | (src & 7) << 3 | (dst & 7));
+}
+
+void x86_alu64(CodeBuffer* buf, int opcode, int dst, int src) {
+    emit_rex(buf, true, src, 0, dst);
+    emit_byte(buf, (uint8_t)opcode);
+    emit_byte(buf, 0xC0 | (src & 7) << 3 | (dst & 7));
+}
+
+void x86_imul(CodeBuffer* buf, int dst, int src) {
+    emit_rex(buf, false, dst, 0, src);
+    emit_byte(buf, 0x0F);
+    emit_byte(buf, 0xAF);
+    emit_byte(buf, 0xC0 | (dst & 7) << 3 | (src & 7));
+}
+
+void x86_cmov(CodeBuffer* buf, int cc, int dst, int src) {
+    emit_rex(buf, false, dst, 0, src);
+    emit_byte(buf, 0x0F);
+    emit_byte(buf, 0x40 | cc);
+    emit_byte(buf, 0xC0 | (dst & 7) << 3 | (src & 7));
+}
+
+// setcc into the low byte of `reg` (which must already be zeroed).
+void x86_setcc(CodeBuffer* buf, int cc, int reg) {
+    emit_rex(buf, false, 0, 0, reg);
+    emit_byte(buf, 0x0F);
+    emit_byte(buf, 0x90 | cc);
+    emit_byte(buf, 0xC0 | (reg & 7));
+}
+
+void x86_unary(CodeBuffer* buf, int ext, int reg) {
+    emit_rex(buf, false, 0, 0, reg);
+    emit_byte(buf, 0xF7);
+    emit_byte(buf, 0xC0 | ext << 3 | (reg & 7));
+}
+
+void x86_shift_imm(CodeBuffer* buf, int ext, int reg, int amount) {
+    emit_rex(buf, false, 0, 0, reg);
+    emit_byte(buf, 0xC1);
+    emit_byte(buf, 0xC0 | ext << 3 | (reg & 7));
+    emit_byte(buf, (uint8_t)amount);
+}
+
+void x86_shift_cl(CodeBuffer* buf, int ext, int reg) {
+    emit_rex(buf, false, 0, 0, reg);
+    emit_byte(buf, 0xD3);
+    emit_byte(buf, 0xC0 | ext << 3 | (reg & 7));
+}
+
+void x86_mov_imm(CodeBuffer* buf, int reg, uint32_t imm) {
+    emit_rex(buf, false, 0, 0, reg);
+    emit_byte(buf, 0xB8 | (reg & 7));
+    emit_u32(buf, imm);
+}
+
+// mov r32, [rdi + 4*slot] / mov [rdi + 4*slot], r32
+void x86_load_reg(CodeBuffer* buf, int reg, int slot) {
+    emit_rex(buf, false, reg, 0, RDI);
+    emit_byte(buf, 0x8B);
+    emit_byte(buf, 0x80 | (reg & 7) << 3 | (RDI & 7));
+    emit_u32(buf, (uint32_t)slot * 4);
+}
+
+void x86_store_reg(CodeBuffer* buf, int slot, int reg) {
+    emit_rex(buf, false, reg, 0, RDI);
+    emit_byte(buf, 0x89);
+    emit_byte(buf, 0x80 | (reg & 7) << 3 | (RDI & 7));
+    emit_u32(buf, (uint32_t)slot * 4);
+}
+
+// mov r32, [base + rsi*4] / mov [base + rsi*4], r32
+void x86_row_access(CodeBuffer* buf, uint8_t opcode, int reg, int base) {
+    emit_rex(buf, false, reg, RSI, base);
+    emit_byte(buf, opcode);
+    emit_byte(buf, 0x44 | (reg & 7) << 3);
+    emit_byte(buf, 0x80 | (RSI & 7) << 3 | (base & 7));
+    emit_byte(buf, 0);
+}
+
+// mov r64, [rdi + disp8]
+void x86_load_ptr(CodeBuffer* buf, int reg, int disp) {
+    emit_rex(buf, true, reg, 0, RDI);
+    emit_byte(buf, 0x8B);
+    emit_byte(buf, 0x40 | (reg & 7) << 3 | (RDI & 7));
+    emit_byte(buf, (uint8_t)disp);
+}
+
+void x86_push(CodeBuffer* buf, int reg) {
+    emit_rex(buf, false, 0, 0, reg);
+    emit_byte(buf, 0x50 | (reg & 7));
+}
+
+void x86_pop(CodeBuffer* buf, int reg) {
+    emit_rex(buf, false, 0, 0, reg);
+    emit_byte(buf, 0x58 | (reg & 7));
+}
+
+void x86_jcc_to_error(CodeBuffer* buf, int cc) {
+    emit_byte(buf, 0x0F);
+    emit_byte(buf, 0x80 | cc);
+    buf->fixups = realloc(buf->fixups, (buf->fixup_count + 1) * sizeof(size_t));
+    buf->fixups[buf->fixup_count++] = buf->size;
+    emit_u32(buf, 0);
+}
+
+void patch_rel32(CodeBuffer* buf, size_t slot, size_t target) {
+    uint32_t rel = (uint32_t)((int64_t)target - (int64_t)(slot + 4));
+    memcpy(&buf->bytes[slot], &rel, 4);
+}
+
+// eax = divide_signed(eax, ecx); ecx != 0 has been checked. Clobbers
+// edx, r8d-r11d. Magnitudes are at most 2^31, so the partial remainder
+// never needs a 33rd bit.
+void jit_divide(CodeBuffer* buf) {
+    x86_alu(buf, ALU_MOV, R8, RAX);
+    x86_shift_imm(buf, EXT_SAR, R8, 31);
+    x86_alu(buf, ALU_MOV, R9, RCX);
+    x86_shift_imm(buf, EXT_SAR, R9, 31);
+    x86_alu(buf, ALU_ADD, RAX, R8);
+    x86_alu(buf, ALU_XOR, RAX, R8);
+    x86_alu(buf, ALU_ADD, RCX, R9);
+    x86_alu(buf, ALU_XOR, RCX, R9);
+    x86_alu(buf, ALU_XOR, R8, R9);
+    x86_alu(buf, ALU_XOR, R10, R10);
+    x86_alu(buf, ALU_XOR, R11, R11);
+
+    for (int step = 0; step < 32; step++) {
+        x86_alu(buf, ALU_MOV, R9, RAX);
+        x86_shift_imm(buf, EXT_SHR, R9, 31);
+        x86_shift_imm(buf, EXT_SHL, R10, 1);
+        x86_alu(buf, ALU_OR, R10, R9);
+        x86_shift_imm(buf, EXT_SHL, RAX, 1);
+        x86_alu(buf, ALU_XOR, R9, R9);
+        x86_alu(buf, ALU_CMP, R10, RCX);
+        x86_setcc(buf, CC_AE, R9);
+        x86_unary(buf, EXT_NEG, R9);
+        x86_alu(buf, ALU_MOV, RDX, RCX);
+        x86_alu(buf, ALU_AND, RDX, R9);
+        x86_alu(buf, ALU_SUB, R10, RDX);
+        x86_shift_imm(buf, EXT_SHL, R11, 1);
+        x86_alu(buf, ALU_SUB, R11, R9);
+    }
+
+    x86_alu(buf, ALU_MOV, RAX, R11);
+    x86_alu(buf, ALU_XOR, RAX, R8);
+    x86_alu(buf, ALU_SUB, RAX, R8);
+}
+
+// eax = divide_public(eax, ecx) with the hardware divider; ecx != 0 has
+// been checked. A divisor of -1 negates instead, since INT_MIN / -1 would
+// fault. Clobbers edx.
+void jit_divide_public(CodeBuffer* buf) {
+    x86_alu(buf, ALU_MOV, RDX, RCX);
+    x86_unary(buf, EXT_NOT, RDX);
+    x86_alu(buf, ALU_TEST, RDX, RDX);
+    emit_byte(buf, 0x70 | CC_NE);  // jne rel8 to the idiv
+    size_t to_idiv = buf->size;
+    emit_byte(buf, 0);
+    x86_unary(buf, EXT_NEG, RAX);
+    emit_byte(buf, 0xEB);  // jmp rel8 past it
+    size_t to_done = buf->size;
+    emit_byte(buf, 0);
+    buf->bytes[to_idiv] = (uint8_t)(buf->size - to_idiv - 1);
+    emit_byte(buf, 0x99);  // cdq
+    x86_unary(buf, EXT_IDIV, RCX);
+    buf->bytes[to_done] = (uint8_t)(buf->size - to_done - 1);
+}
+
+void jit_instruction(CodeBuffer* buf, const Instruction* ins) {
+    x86_load_reg(buf, RAX, ins->src[0]);
+    x86_load_reg(buf, RCX, ins->src[1]);
+
+    switch (ins->opcode) {
+        case OPC_ADD: x86_alu(buf, ALU_ADD, RAX, RCX); break;
+        case OPC_SUB: x86_alu(buf, ALU_SUB, RAX, RCX); break;
+        // imul has a fixed latency, so it serves secret operands too.
+        case OPC_MUL:
+        case OPC_MUL_SECRET: x86_imul(buf, RAX, RCX); break;
+        case OPC_DIV:
+        case OPC_DIV_SECRET:
+            x86_alu(buf, ALU_TEST, RCX, RCX);
+            x86_jcc_to_error(buf, CC_E);
+            if (ins->opcode == OPC_DIV) jit_divide_public(buf);
+            else jit_divide(buf);
+            break;
+        case OPC_SHIFT_LEFT: x86_shift_cl(buf, EXT_SHL, RAX); break;
+        case OPC_DIVIDE_POW2:
+            x86_alu(buf, ALU_MOV, RDX, RAX);
+            x86_shift_imm(buf, EXT_SAR, RDX, 31);
+            x86_mov_imm(buf, R8, 1);
+            x86_shift_cl(buf, EXT_SHL, R8);
+            x86_unary(buf, EXT_NEG, R8);
+            x86_unary(buf, EXT_NOT, R8);  // r8d = 2^k - 1
+            x86_alu(buf, ALU_AND, RDX, R8);
+            x86_alu(buf, ALU_ADD, RAX, RDX);
+            x86_shift_cl(buf, EXT_SAR, RAX);
+            break;
+        case OPC_MAX:
+        case OPC_MIN:
+            // max: greater_than(x, y) ? x : y, min: greater_than(y, x) ? x : y
+            x86_alu(buf, ALU_MOV, RDX, ins->opcode == OPC_MAX ? RAX : RCX);
+            x86_alu(buf, ALU_SUB, RDX, ins->opcode == OPC_MAX ? RCX : RAX);
+            x86_alu(buf, ALU_TEST, RDX, RDX);
+            x86_cmov(buf, CC_LE, RAX, RCX);
+            break;
+        case OPC_EQUAL:
+            x86_alu(buf, ALU_XOR, RDX, RDX);
+            x86_alu(buf, ALU_CMP, RAX, RCX);
+            x86_setcc(buf, CC_E, RDX);
+            x86_alu(buf, ALU_MOV, RAX, RDX);
+            break;
+        case OPC_GREATER_THAN:
+            x86_alu(buf, ALU_XOR, RDX, RDX);
+            x86_alu(buf, ALU_SUB, RAX, RCX);
+            x86_alu(buf, ALU_TEST, RAX, RAX);
+            x86_setcc(buf, CC_G, RDX);
+            x86_alu(buf, ALU_MOV, RAX, RDX);
+            break;
+        case OPC_IFELSE:
+            x86_load_reg(buf, RDX, ins->src[2]);
+            x86_alu(buf, ALU_TEST, RDX, RDX);
+            x86_cmov(buf, CC_E, RAX, RCX);
+            break;
+        case OPC_ABSOLUTE:
+            x86_alu(buf, ALU_MOV, RDX, RAX);
+            x86_shift_imm(buf, EXT_SAR, RDX, 31);
+            x86_alu(buf, ALU_ADD, RAX, RDX);
+            x86_alu(buf, ALU_XOR, RAX, RDX);
+            break;
+    }
+
+    x86_store_reg(buf, ins->dst, RAX);
+}
+
+JitProgram* jit_compile(const Program* prog) {
+    const char* enabled = getenv("MPC_JIT");
+    if ((enabled && strcmp(enabled, "0") == 0) || prog->num_variables > NUM_VARIABLES) return NULL;
+
+    static const int saved[] = { RBX, RBP, R12, R13, R14, R15 };
+    static const int columns[NUM_VARIABLES] = { R12, R13, R14, R15 };
+    CodeBuffer buf = { NULL, 0, 0, NULL, 0 };
+
+    for (int i = 0; i < 6; i++) x86_push(&buf, saved[i]);
+    for (int v = 0; v < NUM_VARIABLES; v++) {
+        x86_load_ptr(&buf, columns[v], (int)(offsetof(JitArgs, cols) + v * sizeof(int32_t*)));
+    }
+    x86_load_ptr(&buf, RBX, (int)offsetof(JitArgs, out));
+    x86_load_ptr(&buf, RBP, (int)offsetof(JitArgs, n));
+    x86_load_ptr(&buf, RDI, (int)offsetof(JitArgs, regs));
+    x86_alu(&buf, ALU_XOR, RSI, RSI);
+    x86_alu64(&buf, ALU_TEST, RBP, RBP);
+    emit_byte(&buf, 0x0F);
+    emit_byte(&buf, 0x80 | CC_E);
+    size_t skip_loop = buf.size;
+    emit_u32(&buf, 0);
+
+    size_t loop = buf.size;
+    for (int v = 0; v < NUM_VARIABLES; v++) {
+        x86_row_access(&buf, 0x8B, RAX, columns[v]);
+        x86_store_reg(&buf, v, RAX);
+    }
+    for (int k = 0; k < prog->count; k++) jit_instruction(&buf, &prog->code[k]);
+    x86_load_reg(&buf, RAX, prog->result_reg);
+    x86_row_access(&buf, 0x89, RAX, RBX);
+
+    emit_byte(&buf, 0x48);  // inc rsi
+    emit_byte(&buf, 0xFF);
+    emit_byte(&buf, 0xC6);
+    x86_alu64(&buf, ALU_CMP, RSI, RBP);
+    emit_byte(&buf, 0x0F);
+    emit_byte(&buf, 0x80 | CC_B);
+    emit_u32(&buf, 0);
+    patch_rel32(&buf, buf.size - 4, loop);
+
+    patch_rel32(&buf, skip_loop, buf.size);
+    x86_alu(&buf, ALU_XOR, RAX, RAX);
+    size_t epilogue = buf.size;
+    for (int i = 5; i >= 0; i--) x86_pop(&buf, saved[i]);
+    emit_byte(&buf, 0xC3);
+
+    size_t error_exit = buf.size;
+    x86_mov_imm(&buf, RAX, 1);
+    emit_byte(&buf, 0xE9);
+    emit_u32(&buf, 0);
+    patch_rel32(&buf, buf.size - 4, epilogue);
+    for (int i = 0; i < buf.fixup_count; i++) patch_rel32(&buf, buf.fixups[i], error_exit);
+
+    void* code = mmap(NULL, buf.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED) {
+        free(buf.bytes);
+        free(buf.fixups);
+        return NULL;
+    }
+    memcpy(code, buf.bytes, buf.size);
+    free(buf.bytes);
+    free(buf.fixups);
+    if (mprotect(code, buf.size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(code, buf.size);
+        return NULL;
+    }
+
+    JitProgram* jit = malloc(sizeof(JitProgram));
+    jit->code = code;
+    jit->size = buf.size;
+    jit->prog = prog;
+    memcpy(&jit->entry, &code, sizeof(code));
+    return jit;
+}
+
+void jit_free(JitProgram* jit) {
+    if (!jit) return;
+    munmap(jit->code, jit->size);
+    free(jit);
+}
+
+#else
+
+JitProgram* jit_compile(const Program* prog) {
+    (void)prog;
+    return NULL;
+}
+
+void jit_free(JitProgram* jit) {
+    (void)jit;
+}
+
+#endif // MPC_HAVE_JIT
+
+void run_jit_batch(const JitProgram* jit, const int32_t* a, const int32_t* b,
+                   const int32_t* c, const int32_t* d, int32_t* out, size_t n) {
+    int32_t regs[PROGRAM_MAX_REGS];
+    if (jit->prog->num_constants) {
+        memcpy(&regs[NUM_VARIABLES], jit->prog->constants, jit->prog->num_constants * sizeof(int32_t));
+    }
+
+    JitArgs args = { regs, { a, b, c, d }, out, n };
+    if (jit->entry(&args) != 0) {
+        printf("Error: Division by zero.\n");
+        exit(1);
+    }
+}
+
+int run_jit(const JitProgram* jit, int a, int b, int c, int d) {
+    int32_t result;
+    run_jit_batch(jit, &a, &b, &c, &d, &result, 1);
+    return result;
+}
+
+// --- C Code Generation ---
+
+// Emits a compiled Program as a standalone C translation unit: a prelude of
+// static inline primitives, branch-free except mpc_divide_public() for
+// public operands, followed by straight-line code in
+// SSA form (one local per instruction). The generated function returns
+// nonzero if any row divided by zero; the quotient for such rows is 0, as
+// divide_signed() returns. A `_batch` variant loops over columns so the
+// host compiler can vectorize it.
+
+static const char* codegen_prelude =
+    "#include <stddef.h>\n"
+    "#include <stdint.h>\n"
+    "\n"
+    "static inline int32_t mpc_select(int32_t cond, int32_t x, int32_t y) {\n"
+    "    int32_t mask = -(int32_t)(cond != 0);\n"
+    "    return (x & mask) | (y & ~mask);\n"
+    "}\n"
+    "\n"
+    "static inline int32_t mpc_greater_than(int32_t x, int32_t y) {\n"
+    "    return (int32_t)((uint32_t)x - (uint32_t)y) > 0;\n"
+    "}\n"
+    "\n"
+    "static inline int32_t mpc_absolute(int32_t x) {\n"
+    "    uint32_t mask = (uint32_t)(x >> 31);\n"
+    "    return (int32_t)(((uint32_t)x + mask) ^ mask);\n"
+    "}\n"
+    "\n"
+    "static inline int32_t mpc_divide_pow2(int32_t x, int k) {\n"
+    "    uint32_t bias = (uint32_t)(x >> 31) & ((1u << k) - 1);\n"
+    "    return (int32_t)((uint32_t)x + bias) >> k;\n"
+    "}\n"
+    "\n"
+    "static inline int32_t mpc_divide_public(int32_t x, int32_t y) {\n"
+    "    if (y == 0) return 0;\n"
+    "    if (y == -1) return (int32_t)(0u - (uint32_t)x);\n"
+    "    return x / y;\n"
+    "}\n"
+    "\n"
+    "static inline int32_t mpc_divide_signed(int32_t x, int32_t y) {\n"
+    "    uint32_t sx = (uint32_t)(x >> 31), sy = (uint32_t)(y >> 31);\n"
+    "    uint32_t n = ((uint32_t)x + sx) ^ sx, d = ((uint32_t)y + sy) ^ sy;\n"
+    "    uint32_t q = 0, r = 0;\n"
+    "    for (int i = 31; i >= 0; i--) {\n"
+    "        r = (r << 1) | ((n >> i) & 1);\n"
+    "        uint32_t ge = -(uint32_t)(r >= d);\n"
+    "        r -= d & ge;\n"
+    "        q |= (ge & 1u) << i;\n"
+    "    }\n"
+    "    q &= -(uint32_t)(d != 0);\n"
+    "    return (int32_t)((q ^ (sx ^ sy)) - (sx ^ sy));\n"
+    "}\n"
+    "\n";
+
+void codegen_operand(const Program* prog, int reg, const int* ssa, char* out, size_t size) {
+    if (reg < NUM_VARIABLES) {
+        snprintf(out, size, "%c", "abcd"[reg]);
+    } else if (reg < NUM_VARIABLES + prog->num_constants) {
+        int value = prog->constants[reg - NUM_VARIABLES];
+        if (value == INT32_MIN) snprintf(out, size, "INT32_MIN");
+        else snprintf(out, size, "%d", value);
+    } else {
+        snprintf(out, size, "t%d", ssa[reg]);
+    }
+}
+
+void emit_c_function(FILE* out, const Program* prog, const char* name, const char* source) {
+    require_four_variables(prog, "C code generation");
+    int ssa[PROGRAM_MAX_REGS];
+    bool divides = false;
+    for (int k = 0; k < prog->count; k++) {
+        divides |= prog->code[k].opcode == OPC_DIV || prog->code[k].opcode == OPC_DIV_SECRET;
+    }
+
+    fprintf(out, "// Generated by the MPC interpreter from: %s\n", source);
+    fputs(codegen_prelude, out);
+    fprintf(out, "int %s(int32_t a, int32_t b, int32_t c, int32_t d, int32_t* result) {\n", name);
+    fprintf(out, "    (void)a; (void)b; (void)c; (void)d;\n");
+    if (divides) fprintf(out, "    int div_by_zero = 0;\n");
+
+    for (int k = 0; k < prog->count; k++) {
+        const Instruction* ins = &prog->code[k];
+        char x[32], y[32], z[32];
+        codegen_operand(prog, ins->src[0], ssa, x, sizeof(x));
+        codegen_operand(prog, ins->src[1], ssa, y, sizeof(y));
+        codegen_operand(prog, ins->src[2], ssa, z, sizeof(z));
+
+        fprintf(out, "    int32_t t%d = ", k);
+        switch (ins->opcode) {
+            case OPC_ADD: fprintf(out, "(int32_t)((uint32_t)%s + (uint32_t)%s);\n", x, y); break;
+            case OPC_SUB: fprintf(out, "(int32_t)((uint32_t)%s - (uint32_t)%s);\n", x, y); break;
+            case OPC_MUL:
+            case OPC_MUL_SECRET: fprintf(out, "(int32_t)((uint32_t)%s * (uint32_t)%s);\n", x, y); break;
+            case OPC_DIV:
+            case OPC_DIV_SECRET:
+                fprintf(out, "%s(%s, %s);\n",
+                        ins->opcode == OPC_DIV ? "mpc_divide_public" : "mpc_divide_signed", x, y);
+                fprintf(out, "    div_by_zero |= %s == 0;\n", y);
+                break;
+            case OPC_SHIFT_LEFT: fprintf(out, "(int32_t)((uint32_t)%s << %s);\n", x, y); break;
+            case OPC_DIVIDE_POW2: fprintf(out, "mpc_divide_pow2(%s, %s);\n", x, y); break;
+            case OPC_MAX: fprintf(out, "mpc_select(mpc_greater_than(%s, %s), %s, %s);\n", x, y, x, y); break;
+            case OPC_MIN: fprintf(out, "mpc_select(mpc_greater_than(%s, %s), %s, %s);\n", y, x, x, y); break;
+            case OPC_EQUAL: fprintf(out, "%s == %s;\n", x, y); break;
+            case OPC_GREATER_THAN: fprintf(out, "mpc_greater_than(%s, %s);\n", x, y); break;
+            case OPC_IFELSE: fprintf(out, "mpc_select(%s, %s, %s);\n", z, x, y); break;
+            case OPC_ABSOLUTE: fprintf(out, "mpc_absolute(%s);\n", x); break;
+        }
+        ssa[ins->dst] = k;
+    }
+
+    char result[32];
+    codegen_operand(prog, prog->result_reg, ssa, result, sizeof(result));
+    fprintf(out, "    *result = %s;\n", result);
+    fprintf(out, "    return %s;\n", divides ? "div_by_zero" : "0");
+    fprintf(out, "}\n\n");
+
+    fprintf(out, "int %s_batch(const int32_t* a, const int32_t* b, const int32_t* c, const int32_t* d,\n", name);
+    fprintf(out, "    int32_t* out, size_t n) {\n");
+    fprintf(out, "    int status = 0;\n");
+    fprintf(out, "    for (size_t i = 0; i < n; i++) status |= %s(a[i], b[i], c[i], d[i], &out[i]);\n", name);
+    fprintf(out, "    return status;\n");
+    fprintf(out, "}\n");
+}
+
+// --- Circuit Export ---
+
+// Lowers a compiled Program to a boolean netlist of XOR, AND and INV gates
+// and writes it in Bristol Fashion, for garbled-circuit and GMW tools. The
+// inputs are a, b, c and d as four 32-bit values and the output is the
+// result; within a value, wire i carries bit i. Words are built with the
+// same ripple or parallel-prefix structures as the bitsliced engine, picked
+// by the same depth-vs-gates goal, but in the forms that are cheapest in
+// ANDs: a ripple full adder is c ^ ((x ^ c) & (y ^ c)), a multiplexer is
+// y ^ (s & (x ^ y)), and OR is x ^ y ^ (x & y). XOR and INV are free
+// under free-XOR garbling and local in GMW, so the AND count and the AND
+// depth are the cost. Constants come from a zero wire, an input XORed with
+// itself. A division by zero yields 0, as divide_signed() returns.
+//
+// Prefix adders are shallower one operator at a time, but ripple chains
+// deliver their low bits early, so a chain of operators can overlap its
+// ripples and end up shallower than the prefix version: a*b*c*d has AND
+// depth 33 in ripple form against 39 in prefix form. With depth as the goal
+// build_netlist() therefore lowers the program both ways and keeps the
+// shallower netlist.
+
+typedef enum { GATE_XOR, GATE_AND, GATE_INV } GateType;
+
+typedef struct {
+    uint8_t type;
+    int in[2];
+    int out;
+} Gate;
+
+typedef struct {
+    Gate* gates;
+    int count;
+    int capacity;
+    int num_wires;
+    int num_inputs;
+    int zero;
+    int one;
+    int outputs[WORD_BITS];
+    bool depth;                 // parallel-prefix words instead of ripple chains
+} Netlist;
+
+typedef struct {
+    int and_gates;
+    int xor_gates;
+    int inv_gates;
+    int and_depth;
+} NetlistStats;
+
+int net_gate(Netlist* net, GateType type, int x, int y) {
+    if (net->count == net->capacity) {
+        net->capacity = net->capacity ? net->capacity * 2 : 1024;
+        net->gates = realloc(net->gates, (size_t)net->capacity * sizeof(Gate));
+    }
+    net->gates[net->count++] = (Gate){ (uint8_t)type, { x, y }, net->num_wires };
+    return net->num_wires++;
+}
+
+int net_xor(Netlist* net, int x, int y) { return net_gate(net, GATE_XOR, x, y); }
+int net_and(Netlist* net, int x, int y) { return net_gate(net, GATE_AND, x, y); }
+int net_inv(Netlist* net, int x) { return net_gate(net, GATE_INV, x, -1); }
+
+int net_or(Netlist* net, int x, int y) {
+    return net_xor(net, net_xor(net, x, y), net_and(net, x, y));
+}
+
+int net_select_bit(Netlist* net, int cond, int x, int y) {
+    return net_xor(net, y, net_and(net, cond, net_xor(net, x, y)));
+}
+
+void net_constant(Netlist* net, int value, int out[WORD_BITS]) {
+    for (int i = 0; i < WORD_BITS; i++) out[i] = ((uint32_t)value >> i) & 1 ? net->one : net->zero;
+}
+
+// OR of `width` wires as a balanced tree.
+int net_any(Netlist* net, const int* x, int width) {
+    int acc[BITSLICE_WIDE];
+    memcpy(acc, x, (size_t)width * sizeof(int));
+    while (width > 1) {
+        int half = width / 2;
+        for (int i = 0; i < half; i++) acc[i] = net_or(net, acc[2 * i], acc[2 * i + 1]);
+        if (width & 1) acc[half] = acc[width - 1];
+        width = half + (width & 1);
+    }
+    return acc[0];
+}
+
+// out = x + y + carry_in over `width` bits; returns the carry out. A
+// group never both generates and propagates, so the prefix combines
+// generates with XOR.
+int net_add(Netlist* net, const int* x, const int* y, int carry_in, int* out, int width) {
+    int carries[BITSLICE_WIDE + 1];
+    carries[0] = carry_in;
+    if (!net->depth) {
+        for (int i = 0; i < width; i++) {
+            int c = carries[i];
+            carries[i + 1] = net_xor(net, c, net_and(net, net_xor(net, x[i], c), net_xor(net, y[i], c)));
+        }
+    } else {
+        int gen[BITSLICE_WIDE] = { 0 }, prop[BITSLICE_WIDE] = { 0 };
+        for (int i = 0; i < width; i++) {
+            gen[i] = net_and(net, x[i], y[i]);
+            prop[i] = net_xor(net, x[i], y[i]);
+        }
+        gen[0] = net_xor(net, gen[0], net_and(net, prop[0], carry_in));
+        int group[BITSLICE_WIDE];
+        memcpy(group, prop, (size_t)width * sizeof(int));
+        for (int span = 1; span < width; span <<= 1) {
+            for (int i = 0; i < width; i++) {
+                if (!(i & span)) continue;
+                int j = (i & ~(span - 1)) - 1;
+                gen[i] = net_xor(net, gen[i], net_and(net, group[i], gen[j]));
+                if (span * 2 < width) group[i] = net_and(net, group[i], group[j]);
+            }
+        }
+        for (int i = 0; i < width; i++) carries[i + 1] = gen[i];
+    }
+    for (int i = 0; i < width; i++) out[i] = net_xor(net, net_xor(net, x[i], y[i]), carries[i]);
+    return carries[width];
+}
+
+// out = x - y as x + ~y + 1; returns the borrow out.
+int net_subtract(Netlist* net, const int* x, const int* y, int* out, int width) {
+    int not_y[BITSLICE_WIDE];
+    for (int i = 0; i < width; i++) not_y[i] = net_inv(net, y[i]);
+    return net_inv(net, net_add(net, x, not_y, net->one, out, width));
+}
+
+// (x ^ s) + s for a sign wire s.
+void net_negate_if(Netlist* net, const int x[WORD_BITS], int sign, int out[WORD_BITS]) {
+    int flipped[WORD_BITS], zero[WORD_BITS];
+    for (int i = 0; i < WORD_BITS; i++) {
+        flipped[i] = net_xor(net, x[i], sign);
+        zero[i] = net->zero;
+    }
+    net_add(net, flipped, zero, sign, out, WORD_BITS);
+}
+
+// greater_than() on the wrapped difference: only the sign of x - y is
+// formed, from the carry into bit 31, next to an OR tree for x != y.
+int net_greater_than(Netlist* net, const int x[WORD_BITS], const int y[WORD_BITS]) {
+    int not_y[WORD_BITS], low[WORD_BITS], differs[WORD_BITS];
+    for (int i = 0; i < WORD_BITS; i++) {
+        not_y[i] = net_inv(net, y[i]);
+        differs[i] = net_xor(net, x[i], y[i]);
+    }
+    int carry = net_add(net, x, not_y, net->one, low, WORD_BITS - 1);
+    int sign = net_xor(net, net_xor(net, x[WORD_BITS - 1], not_y[WORD_BITS - 1]), carry);
+    return net_and(net, net_inv(net, sign), net_any(net, differs, WORD_BITS));
+}
+
+void net_select(Netlist* net, int cond, const int* x, const int* y, int* out, int width) {
+    for (int i = 0; i < width; i++) out[i] = net_select_bit(net, cond, x[i], y[i]);
+}
+
+// Shift-and-add over masked partial products, modulo 2^32. With depth as
+// the goal the partial products go through a Wallace tree of carry-save
+// adders, a full adder deep each, before one final addition.
+void net_multiply(Netlist* net, const int x[WORD_BITS], const int y[WORD_BITS], int out[WORD_BITS]) {
+    int rows[WORD_BITS][WORD_BITS];
+    for (int j = 0; j < WORD_BITS; j++) {
+        for (int i = 0; i < WORD_BITS; i++) rows[j][i] = i >= j ? net_and(net, x[i - j], y[j]) : net->zero;
+    }
+
+    if (!net->depth) {
+        for (int j = 1; j < WORD_BITS; j++) net_add(net, rows[0] + j, rows[j] + j, net->zero, rows[0] + j, WORD_BITS - j);
+        memcpy(out, rows[0], sizeof(rows[0]));
+        return;
+    }
+
+    int count = WORD_BITS;
+    while (count > 2) {
+        int next = 0;
+        for (int r = 0; r + 2 < count; r += 3) {
+            int* a = rows[r];
+            int* b = rows[r + 1];
+            int* c = rows[r + 2];
+            int sum[WORD_BITS], carry[WORD_BITS];
+            carry[0] = net->zero;
+            for (int i = 0; i < WORD_BITS; i++) {
+                // Rows shifted by j are zero below bit j; those bits need no adder.
+                int live[3], n = 0;
+                if (a[i] != net->zero) live[n++] = a[i];
+                if (b[i] != net->zero) live[n++] = b[i];
+                if (c[i] != net->zero) live[n++] = c[i];
+                int majority = net->zero;
+                if (n == 0) {
+                    sum[i] = net->zero;
+                } else if (n == 1) {
+                    sum[i] = live[0];
+                } else if (n == 2) {
+                    sum[i] = net_xor(net, live[0], live[1]);
+                    if (i + 1 < WORD_BITS) majority = net_and(net, live[0], live[1]);
+                } else {
+                    int ac = net_xor(net, live[0], live[2]);
+                    sum[i] = net_xor(net, ac, live[1]);
+                    if (i + 1 < WORD_BITS) {
+                        majority = net_xor(net, live[2], net_and(net, ac, net_xor(net, live[1], live[2])));
+                    }
+                }
+                if (i + 1 < WORD_BITS) carry[i + 1] = majority;
+            }
+            memcpy(rows[next++], sum, sizeof(sum));
+            memcpy(rows[next++], carry, sizeof(carry));
+        }
+        for (int r = count - count % 3; r < count; r++) memcpy(rows[next++], rows[r], sizeof(rows[r]));
+        count = next;
+    }
+    net_add(net, rows[0], rows[1], net->zero, out, WORD_BITS);
+}
+
+// divide_signed() on magnitudes: restoring division, one bit a step, or
+// with depth as the goal radix 4 as in bitslice_divide_radix4().
+void net_divide(Netlist* net, const int x[WORD_BITS], const int y[WORD_BITS], int out[WORD_BITS]) {
+    int ax[WORD_BITS], ay[WORD_BITS], quot[WORD_BITS], rem[BITSLICE_WIDE];
+    net_negate_if(net, x, x[WORD_BITS - 1], ax);
+    net_negate_if(net, y, y[WORD_BITS - 1], ay);
+    for (int i = 0; i < BITSLICE_WIDE; i++) rem[i] = net->zero;
+
+    if (!net->depth) {
+        int diff[WORD_BITS];
+        for (int step = WORD_BITS - 1; step >= 0; step--) {
+            for (int i = WORD_BITS - 1; i > 0; i--) rem[i] = rem[i - 1];
+            rem[0] = ax[step];
+            int ge = net_inv(net, net_subtract(net, rem, ay, diff, WORD_BITS));
+            net_select(net, ge, diff, rem, rem, WORD_BITS);
+            quot[step] = ge;
+        }
+    } else {
+        int multiples[3][BITSLICE_WIDE], trial[3][BITSLICE_WIDE];
+        for (int i = 0; i < BITSLICE_WIDE; i++) {
+            multiples[0][i] = i < WORD_BITS ? ay[i] : net->zero;
+            multiples[1][i] = i >= 1 && i <= WORD_BITS ? ay[i - 1] : net->zero;
+        }
+        net_add(net, multiples[0], multiples[1], net->zero, multiples[2], BITSLICE_WIDE);
+        for (int step = WORD_BITS - 2; step >= 0; step -= 2) {
+            for (int i = BITSLICE_WIDE - 1; i > 1; i--) rem[i] = rem[i - 2];
+            rem[1] = ax[step + 1];
+            rem[0] = ax[step];
+            int ge[3];
+            for (int m = 0; m < 3; m++) {
+                ge[m] = net_inv(net, net_subtract(net, rem, multiples[m], trial[m], BITSLICE_WIDE));
+            }
+            for (int i = 0; i < BITSLICE_WIDE; i++) {
+                int r = net_xor(net, rem[i], net_and(net, ge[0], net_xor(net, trial[0][i], rem[i])));
+                r = net_xor(net, r, net_and(net, ge[1], net_xor(net, trial[1][i], trial[0][i])));
+                rem[i] = net_xor(net, r, net_and(net, ge[2], net_xor(net, trial[2][i], trial[1][i])));
+            }
+            quot[step + 1] = ge[1];
+            quot[step] = net_xor(net, net_xor(net, ge[0], ge[1]), ge[2]);
+        }
+    }
+
+    int nonzero = net_any(net, y, WORD_BITS);
+    net_negate_if(net, quot, net_xor(net, x[WORD_BITS - 1], y[WORD_BITS - 1]), quot);
+    for (int i = 0; i < WORD_BITS; i++) out[i] = net_and(net, quot[i], nonzero);
+}
+
+void net_divide_pow2(Netlist* net, const int x[WORD_BITS], int k, int out[WORD_BITS]) {
+    int bias[WORD_BITS], biased[WORD_BITS];
+    for (int i = 0; i < WORD_BITS; i++) bias[i] = i < k ? x[WORD_BITS - 1] : net->zero;
+    net_add(net, x, bias, net->zero, biased, WORD_BITS);
+    for (int i = 0; i < WORD_BITS; i++) out[i] = i + k < WORD_BITS ? biased[i + k] : biased[WORD_BITS - 1];
+}
+
+// Result bits that are not already distinct gate outputs are copied
+// through an XOR with zero, since Bristol Fashion wants the outputs to be
+// the last wires.
+void net_set_outputs(Netlist* net, const int result[WORD_BITS]) {
+    for (int i = 0; i < WORD_BITS; i++) {
+        bool taken = result[i] < net->num_inputs;
+        for (int k = 0; k < i; k++) taken |= net->outputs[k] == result[i];
+        net->outputs[i] = taken ? net_xor(net, result[i], net->zero) : result[i];
+    }
+}
+
+Netlist* build_netlist_with(const Program* prog, bool prefix) {
+    require_four_variables(prog, "Circuit export");
+    Netlist* net = calloc(1, sizeof(Netlist));
+    net->depth = prefix;
+    net->num_inputs = net->num_wires = NUM_VARIABLES * WORD_BITS;
+    net->zero = net_xor(net, 0, 0);
+    net->one = net_inv(net, net->zero);
+
+    int (*regs)[WORD_BITS] = malloc((size_t)prog->num_regs * sizeof(int[WORD_BITS]));
+    for (int v = 0; v < NUM_VARIABLES; v++) {
+        for (int i = 0; i < WORD_BITS; i++) regs[v][i] = v * WORD_BITS + i;
+    }
+    for (int k = 0; k < prog->num_constants; k++) net_constant(net, prog->constants[k], regs[NUM_VARIABLES + k]);
+
+    for (int k = 0; k < prog->count; k++) {
+        const Instruction* ins = &prog->code[k];
+        const int* x = regs[ins->src[0]];
+        const int* y = regs[ins->src[1]];
+        int result[WORD_BITS];
+
+        switch (ins->opcode) {
+            case OPC_ADD: net_add(net, x, y, net->zero, result, WORD_BITS); break;
+            case OPC_SUB: net_subtract(net, x, y, result, WORD_BITS); break;
+            case OPC_MUL:
+            case OPC_MUL_SECRET: net_multiply(net, x, y, result); break;
+            case OPC_DIV:
+            case OPC_DIV_SECRET: net_divide(net, x, y, result); break;
+            case OPC_SHIFT_LEFT: {
+                int shift = program_constant(prog, ins->src[1]);
+                for (int i = 0; i < WORD_BITS; i++) result[i] = i >= shift ? x[i - shift] : net->zero;
+                break;
+            }
+            case OPC_DIVIDE_POW2: net_divide_pow2(net, x, program_constant(prog, ins->src[1]), result); break;
+            case OPC_MAX: net_select(net, net_greater_than(net, x, y), x, y, result, WORD_BITS); break;
+            case OPC_MIN: net_select(net, net_greater_than(net, y, x), x, y, result, WORD_BITS); break;
+            case OPC_EQUAL: {
+                int differs[WORD_BITS];
+                for (int i = 0; i < WORD_BITS; i++) differs[i] = net_xor(net, x[i], y[i]);
+                net_constant(net, 0, result);
+                result[0] = net_inv(net, net_any(net, differs, WORD_BITS));
+                break;
+            }
+            case OPC_GREATER_THAN:
+                net_constant(net, 0, result);
+                result[0] = net_greater_than(net, x, y);
+                break;
+            case OPC_IFELSE: {
+                int cond = net_any(net, regs[ins->src[2]], WORD_BITS);
+                net_select(net, cond, x, y, result, WORD_BITS);
+                break;
+            }
+            case OPC_ABSOLUTE: net_negate_if(net, x, x[WORD_BITS - 1], result); break;
+        }
+        memcpy(regs[ins->dst], result, sizeof(result));
+    }
+
+    net_set_outputs(net, regs[prog->result_reg]);
+    free(regs);
+    return net;
+}
+
+void free_netlist(Netlist* net) {
+    free(net->gates);
+    free(net);
+}
+
+NetlistStats netlist_stats(const Netlist* net);
+
+// The fewest ANDs, or with `depth` the least AND depth of the ripple and
+// prefix lowerings, fewer ANDs breaking a tie.
+Netlist* build_netlist(const Program* prog, bool depth) {
+    Netlist* ripple = build_netlist_with(prog, false);
+    if (!depth) return ripple;
+
+    Netlist* prefix = build_netlist_with(prog, true);
+    NetlistStats r = netlist_stats(ripple), p = netlist_stats(prefix);
+    bool keep_prefix = p.and_depth < r.and_depth || (p.and_depth == r.and_depth && p.and_gates <= r.and_gates);
+    free_netlist(keep_prefix ? ripple : prefix);
+    return keep_prefix ? prefix : ripple;
+}
+
+NetlistStats netlist_stats(const Netlist* net) {
+    NetlistStats stats = { 0 };
+    int* depth = calloc((size_t)net->num_wires, sizeof(int));
+    for (int k = 0; k < net->count; k++) {
+        const Gate* g = &net->gates[k];
+        int d = depth[g->in[0]];
+        if (g->type != GATE_INV && depth[g->in[1]] > d) d = depth[g->in[1]];
+        if (g->type == GATE_AND) {
+            stats.and_gates++;
+            d++;
+        } else if (g->type == GATE_XOR) {
+            stats.xor_gates++;
+        } else {
+            stats.inv_gates++;
+        }
+        depth[g->out] = d;
+    }
+    for (int i = 0; i < WORD_BITS; i++) {
+        if (depth[net->outputs[i]] > stats.and_depth) stats.and_depth = depth[net->outputs[i]];
+    }
+    free(depth);
+    return stats;
+}
+
+// Bristol Fashion numbers the inputs first and the outputs last, so the
+// other wires are renumbered in gate order in between.
+void write_bristol(FILE* out, const Netlist* net) {
+    int* number = malloc((size_t)net->num_wires * sizeof(int));
+    for (int w = 0; w < net->num_wires; w++) number[w] = w < net->num_inputs ? w : -1;
+    int first_output = net->num_wires - WORD_BITS;
+    for (int i = 0; i < WORD_BITS; i++) number[net->outputs[i]] = first_output + i;
+    int next = net->num_inputs;
+    for (int k = 0; k < net->count; k++) {
+        if (number[net->gates[k].out] < 0) number[net->gates[k].out] = next++;
+    }
+
+    fprintf(out, "%d %d\n", net->count, net->num_wires);
+    fprintf(out, "%d", NUM_VARIABLES);
+    for (int v = 0; v < NUM_VARIABLES; v++) fprintf(out, " %d", WORD_BITS);
+    fprintf(out, "\n1 %d\n\n", WORD_BITS);
+    for (int k = 0; k < net->count; k++) {
+        const Gate* g = &net->gates[k];
+        if (g->type == GATE_INV) {
+            fprintf(out, "1 1 %d %d INV\n", number[g->in[0]], number[g->out]);
+        } else {
+            fprintf(out, "2 1 %d %d %d %s\n", number[g->in[0]], number[g->in[1]], number[g->out],
+                    g->type == GATE_AND ? "AND" : "XOR");
+        }
+    }
+    free(number);
+}
+
+// --- Circuit Optimization ---
+
+// Netlists are optimized as an XOR-AND graph: nodes are ANDs and XORs of
+// literals (node * 2, plus one if complemented), so INV costs nothing and
+// vanishes into the edges. Node 0 is the constant false and the inputs
+// follow it. Every node is built through xag_and() and xag_xor(), which
+// apply structural hashing, so an AND or XOR of the same operands is built
+// once, and constant propagation: operands that are constants, equal or
+// complementary fold away, as do a & (a & b) and a ^ (a & b) = a & ~b. An
+// XOR of up to XAG_MAX_LEAVES nodes also records them as a sorted set, with
+// pairs cancelling, and hashes on it, so a sum is shared however it was
+// associated.
+//
+// optimize_netlist() then rebuilds the graph from its outputs, keeping only
+// what they depend on, until the AND count stops falling. Each XOR tree is
+// rebalanced from its terms, and ANDs are shared within it:
+// (s & t) ^ (s & u) becomes s & (t ^ u) when nothing else reads the ANDs.
+
+#define XAG_MAX_LEAVES 8
+#define XAG_MAX_TERMS 64
+#define XAG_MAX_PASSES 8
+
+typedef enum { XAG_INPUT, XAG_AND, XAG_XOR } XagType;
+
+typedef struct {
+    uint8_t type;
+    int in[2];          // literals
+    int* leaves;        // XORs: the nodes summed, sorted; NULL for other nodes and longer sums
+    int num_leaves;
+    int xor_depth;
+} XagNode;
+
+typedef struct {
+    XagNode* nodes;
+    int count;
+    int capacity;
+    int* table;         // node + 1 by hash of its operands, 0 when empty
+    int table_capacity;
+    int num_inputs;
+    int outputs[WORD_BITS];
+    bool depth;         // carried over from the netlist
+} Xag;
+
+uint64_t xag_hash(XagType type, bool sum, const int* operands, int count) {
+    uint64_t h = 0x9E3779B97F4A7C15ULL * (uint64_t)(type * 2 + sum + 1);
+    for (int i = 0; i < count; i++) h = (h ^ (uint32_t)operands[i]) * 0x100000001B3ULL;
+    return h ^ (h >> 29);
+}
+
+bool xag_matches(const XagNode* node, XagType type, bool sum, const int* operands, int count) {
+    if (node->type != type || (node->leaves != NULL) != sum) return false;
+    if (sum) return node->num_leaves == count && memcmp(node->leaves, operands, (size_t)count * sizeof(int)) == 0;
+    return node->in[0] == operands[0] && node->in[1] == operands[1];
+}
+
+void xag_insert(Xag* x, int id) {
+    const XagNode* node = &x->nodes[id];
+    bool sum = node->leaves != NULL;
+    uint64_t h = xag_hash(node->type, sum, sum ? node->leaves : node->in, sum ? node->num_leaves : 2);
+    size_t k = h & (size_t)(x->table_capacity - 1);
+    while (x->table[k]) k = (k + 1) & (size_t)(x->table_capacity - 1);
+    x->table[k] = id + 1;
+}
+
+int xag_find(const Xag* x, XagType type, bool sum, const int* operands, int count) {
+    size_t k = xag_hash(type, sum, operands, count) & (size_t)(x->table_capacity - 1);
+    for (; x->table[k]; k = (k + 1) & (size_t)(x->table_capacity - 1)) {
+        if (xag_matches(&x->nodes[x->table[k] - 1], type, sum, operands, count)) return x->table[k] - 1;
+    }
+    return -1;
+}
+
+int xag_add(Xag* x, XagType type, int in0, int in1, const int* leaves, int num_leaves) {
+    if (x->count == x->capacity) {
+        x->capacity = x->capacity ? x->capacity * 2 : 1024;
+        x->nodes = realloc(x->nodes, (size_t)x->capacity * sizeof(XagNode));
+    }
+    if (2 * (x->count + 1) > x->table_capacity) {
+        free(x->table);
+        x->table_capacity = x->table_capacity ? x->table_capacity * 2 : 2048;
+        x->table = calloc((size_t)x->table_capacity, sizeof(int));
+        for (int id = x->num_inputs + 1; id < x->count; id++) xag_insert(x, id);
+    }
+
+    int id = x->count++;
+    XagNode* node = &x->nodes[id];
+    *node = (XagNode){ (uint8_t)type, { in0, in1 }, NULL, 0, 0 };
+    if (type == XAG_XOR) {
+        int left = x->nodes[in0 >> 1].xor_depth, right = x->nodes[in1 >> 1].xor_depth;
+        node->xor_depth = 1 + (left > right ? left : right);
+    }
+    if (leaves) {
+        node->leaves = malloc((size_t)num_leaves * sizeof(int));
+        memcpy(node->leaves, leaves, (size_t)num_leaves * sizeof(int));
+        node->num_leaves = num_leaves;
+    }
+    if (type != XAG_INPUT) xag_insert(x, id);
+    return id;
+}
+
+Xag* xag_create(int num_inputs, bool depth) {
+    Xag* x = calloc(1, sizeof(Xag));
+    x->num_inputs = num_inputs;
+    x->depth = depth;
+    for (int i = 0; i <= num_inputs; i++) xag_add(x, XAG_INPUT, 0, 0, NULL, 0);
+    return x;
+}
+
+void free_xag(Xag* x) {
+    for (int id = 0; id < x->count; id++) free(x->nodes[id].leaves);
+    free(x->nodes);
+    free(x->table);
+    free(x);
+}
+
+bool xag_is_and(const Xag* x, int literal) {
+    return !(literal & 1) && x->nodes[literal >> 1].type == XAG_AND;
+}
+
+int xag_and(Xag* x, int a, int b) {
+    if (a == 0 || b == 0 || a == (b ^ 1)) return 0;
+    if (a == 1 || a == b) return b;
+    if (b == 1) return a;
+    for (int side = 0; side < 2; side++) {
+        int outer = side ? b : a, inner = side ? a : b;
+        if (!xag_is_and(x, inner)) continue;
+        const XagNode* node = &x->nodes[inner >> 1];
+        if (node->in[0] == outer || node->in[1] == outer) return inner;
+        if (node->in[0] == (outer ^ 1) || node->in[1] == (outer ^ 1)) return 0;
+    }
+
+    int operands[2] = { a < b ? a : b, a < b ? b : a };
+    int id = xag_find(x, XAG_AND, false, operands, 2);
+    if (id < 0) id = xag_add(x, XAG_AND, operands[0], operands[1], NULL, 0);
+    return id * 2;
+}
+
+int xag_xor(Xag* x, int a, int b) {
+    int complement = (a ^ b) & 1;
+    a &= ~1;
+    b &= ~1;
+    if (a == b) return complement;
+    if (a == 0) return b | complement;
+    if (b == 0) return a | complement;
+    for (int side = 0; side < 2; side++) {
+        int outer = side ? b : a, inner = side ? a : b;
+        if (!xag_is_and(x, inner)) continue;
+        const XagNode* node = &x->nodes[inner >> 1];
+        if (node->in[0] == outer) return xag_and(x, outer, node->in[1] ^ 1) ^ complement;
+        if (node->in[1] == outer) return xag_and(x, outer, node->in[0] ^ 1) ^ complement;
+    }
+
+    // The symmetric difference of the two operands' leaves.
+    const XagNode* na = &x->nodes[a >> 1];
+    const XagNode* nb = &x->nodes[b >> 1];
+    int self_a = a >> 1, self_b = b >> 1;
+    const int* la = na->leaves ? na->leaves : &self_a;
+    const int* lb = nb->leaves ? nb->leaves : &self_b;
+    int ca = na->leaves ? na->num_leaves : 1, cb = nb->leaves ? nb->num_leaves : 1;
+    int merged[2 * XAG_MAX_LEAVES];
+    int count = 0, i = 0, j = 0;
+    while ((i < ca || j < cb) && count <= XAG_MAX_LEAVES) {
+        if (j == cb || (i < ca && la[i] < lb[j])) merged[count++] = la[i++];
+        else if (i == ca || lb[j] < la[i]) merged[count++] = lb[j++];
+        else i++, j++;
+    }
+    bool small = count <= XAG_MAX_LEAVES && i == ca && j == cb;
+    if (small && count == 0) return complement;
+    if (small && count == 1) return merged[0] * 2 | complement;
+
+    int operands[2] = { a < b ? a : b, a < b ? b : a };
+    int id = small ? xag_find(x, XAG_XOR, true, merged, count) : xag_find(x, XAG_XOR, false, operands, 2);
+    if (id < 0) id = xag_add(x, XAG_XOR, operands[0], operands[1], small ? merged : NULL, count);
+    return id * 2 | complement;
+}
+
+// Marks the nodes the outputs depend on and counts their readers.
+void xag_uses(const Xag* x, int* uses) {
+    memset(uses, 0, (size_t)x->count * sizeof(int));
+    bool* live = calloc((size_t)x->count, sizeof(bool));
+    for (int i = 0; i < WORD_BITS; i++) live[x->outputs[i] >> 1] = true;
+    for (int id = x->count - 1; id > x->num_inputs; id--) {
+        if (!live[id] || x->nodes[id].type == XAG_INPUT) continue;
+        for (int k = 0; k < 2; k++) {
+            live[x->nodes[id].in[k] >> 1] = true;
+            uses[x->nodes[id].in[k] >> 1]++;
+        }
+    }
+    for (int i = 0; i < WORD_BITS; i++) uses[x->outputs[i] >> 1]++;
+    for (int id = 0; id < x->count; id++) {
+        if (!live[id]) uses[id] = -1;
+    }
+    free(live);
+}
+
+int xag_and_count(const Xag* x) {
+    int* uses = malloc((size_t)x->count * sizeof(int));
+    xag_uses(x, uses);
+    int count = 0;
+    for (int id = 0; id < x->count; id++) count += x->nodes[id].type == XAG_AND && uses[id] >= 0;
+    free(uses);
+    return count;
+}
+
+// Gathers the operands of the XOR tree at `literal`, looking through XORs
+// nothing else reads, into at most `limit` terms.
+int xag_terms(const Xag* x, const int* uses, int literal, bool root, int* terms, int count, int limit) {
+    const XagNode* node = &x->nodes[literal >> 1];
+    if (node->type == XAG_XOR && (root || uses[literal >> 1] == 1) && count + 2 <= limit) {
+        count = xag_terms(x, uses, node->in[0], false, terms, count, limit - 1);
+        return xag_terms(x, uses, node->in[1], false, terms, count, limit);
+    }
+    terms[count++] = literal;
+    return count;
+}
+
+int compare_ints(const void* a, const void* b) {
+    int x = *(const int*)a, y = *(const int*)b;
+    return (x > y) - (x < y);
+}
+
+// Copies the live part of `src` into a new graph, rebuilding each XOR tree
+// from its terms: equal terms cancel, pairs of single-use ANDs that share
+// an operand are factored, and the two shallowest terms are combined first.
+Xag* xag_rebuild(const Xag* src) {
+    Xag* dst = xag_create(src->num_inputs, src->depth);
+    int* uses = malloc((size_t)src->count * sizeof(int));
+    int* map = malloc((size_t)src->count * sizeof(int));
+    xag_uses(src, uses);
+    for (int id = 0; id <= src->num_inputs; id++) map[id] = id * 2;
+#define XAG_MAP(literal) (map[(literal) >> 1] ^ ((literal) & 1))
+
+    for (int id = src->num_inputs + 1; id < src->count; id++) {
+        const XagNode* node = &src->nodes[id];
+        if (uses[id] < 0) continue;
+        if (node->type == XAG_AND) {
+            map[id] = xag_and(dst, XAG_MAP(node->in[0]), XAG_MAP(node->in[1]));
+            continue;
+        }
+
+        int terms[XAG_MAX_TERMS];
+        int count = xag_terms(src, uses, id * 2, true, terms, 0, XAG_MAX_TERMS);
+        qsort(terms, (size_t)count, sizeof(int), compare_ints);
+        int kept = 0;
+        for (int i = 0; i < count; i++) {
+            if (i + 1 < count && terms[i] == terms[i + 1]) i++;
+            else terms[kept++] = terms[i];
+        }
+
+        int mapped[XAG_MAX_TERMS];
+        int n = 0;
+        for (int i = 0; i < kept; i++) {
+            if (terms[i] < 0) continue;
+            mapped[n] = XAG_MAP(terms[i]);
+            if (!xag_is_and(src, terms[i]) || uses[terms[i] >> 1] != 1) {
+                n++;
+                continue;
+            }
+            const XagNode* left = &src->nodes[terms[i] >> 1];
+            for (int j = i + 1; j < kept; j++) {
+                if (terms[j] < 0 || !xag_is_and(src, terms[j]) || uses[terms[j] >> 1] != 1) continue;
+                const XagNode* right = &src->nodes[terms[j] >> 1];
+                int shared = -1, t = 0, u = 0;
+                for (int p = 0; p < 4 && shared < 0; p++) {
+                    if (left->in[p / 2] != right->in[p % 2]) continue;
+                    shared = left->in[p / 2];
+                    t = left->in[1 - p / 2];
+                    u = right->in[1 - p % 2];
+                }
+                if (shared < 0) continue;
+                mapped[n] = xag_and(dst, XAG_MAP(shared), xag_xor(dst, XAG_MAP(t), XAG_MAP(u)));
+                terms[j] = -1;
+                break;
+            }
+            n++;
+        }
+
+        while (n > 1) {
+            int first = -1, second = -1;
+            for (int i = 0; i < n; i++) {
+                int d = dst->nodes[mapped[i] >> 1].xor_depth;
+                if (first < 0 || d < dst->nodes[mapped[first] >> 1].xor_depth) second = first, first = i;
+                else if (second < 0 || d < dst->nodes[mapped[second] >> 1].xor_depth) second = i;
+            }
+            mapped[first] = xag_xor(dst, mapped[first], mapped[second]);
+            mapped[second] = mapped[--n];
+        }
+        map[id] = n ? mapped[0] : 0;
+    }
+
+    for (int i = 0; i < WORD_BITS; i++) dst->outputs[i] = XAG_MAP(src->outputs[i]);
+#undef XAG_MAP
+    free(uses);
+    free(map);
+    return dst;
+}
+
+Xag* netlist_to_xag(const Netlist* net) {
+    Xag* x = xag_create(net->num_inputs, net->depth);
+    int* literal = malloc((size_t)net->num_wires * sizeof(int));
+    for (int w = 0; w < net->num_inputs; w++) literal[w] = (w + 1) * 2;
+    for (int k = 0; k < net->count; k++) {
+        const Gate* g = &net->gates[k];
+        switch (g->type) {
+            case GATE_XOR: literal[g->out] = xag_xor(x, literal[g->in[0]], literal[g->in[1]]); break;
+            case GATE_AND: literal[g->out] = xag_and(x, literal[g->in[0]], literal[g->in[1]]); break;
+            case GATE_INV: literal[g->out] = literal[g->in[0]] ^ 1; break;
+        }
+    }
+    for (int i = 0; i < WORD_BITS; i++) x->outputs[i] = literal[net->outputs[i]];
+    free(literal);
+    return x;
+}
+
+// Complemented edges become INV gates, one per node that needs it.
+int xag_wire(Netlist* net, int* wire, int* inverted, int literal) {
+    int id = literal >> 1;
+    if (!(literal & 1)) return wire[id];
+    if (inverted[id] < 0) inverted[id] = net_inv(net, wire[id]);
+    return inverted[id];
+}
+
+Netlist* xag_to_netlist(const Xag* x) {
+    Netlist* net = calloc(1, sizeof(Netlist));
+    net->depth = x->depth;
+    net->num_inputs = net->num_wires = x->num_inputs;
+    net->zero = net_xor(net, 0, 0);
+    net->one = net_inv(net, net->zero);
+
+    int* uses = malloc((size_t)x->count * sizeof(int));
+    int* wire = malloc((size_t)x->count * sizeof(int));
+    int* inverted = malloc((size_t)x->count * sizeof(int));
+    xag_uses(x, uses);
+    wire[0] = net->zero;
+    inverted[0] = net->one;
+    for (int id = 1; id < x->count; id++) {
+        wire[id] = id <= x->num_inputs ? id - 1 : -1;
+        inverted[id] = -1;
+    }
+    for (int id = x->num_inputs + 1; id < x->count; id++) {
+        const XagNode* node = &x->nodes[id];
+        if (uses[id] < 0) continue;
+        int in0 = xag_wire(net, wire, inverted, node->in[0]);
+        int in1 = xag_wire(net, wire, inverted, node->in[1]);
+        wire[id] = node->type == XAG_AND ? net_and(net, in0, in1) : net_xor(net, in0, in1);
+    }
+
+    int result[WORD_BITS];
+    for (int i = 0; i < WORD_BITS; i++) result[i] = xag_wire(net, wire, inverted, x->outputs[i]);
+    net_set_outputs(net, result);
+    free(uses);
+    free(wire);
+    free(inverted);
+    return net;
+}
+
+Netlist* optimize_netlist(const Netlist* net) {
+    Xag* x = netlist_to_xag(net);
+    int ands = xag_and_count(x);
+    for (int pass = 0; pass < XAG_MAX_PASSES; pass++) {
+        Xag* next = xag_rebuild(x);
+        int next_ands = xag_and_count(next);
+        bool better = next_ands < ands;
+        // The first rebuild is kept regardless, as it drops dead nodes.
+        if (!better && pass > 0) {
+            free_xag(next);
+            break;
+        }
+        free_xag(x);
+        x = next;
+        ands = next_ands;
+    }
+    Netlist* out = xag_to_netlist(x);
+    free_xag(x);
+    return out;
+}
+
+// --- Expression Cache ---
+
+// Parsed and compiled expressions keyed by their whitespace-normalized text
+// and secrecy mask, so a repeated expression skips tokenize/parse/compile entirely. Entries
+// live on an LRU list; once the accounted size exceeds max_bytes the least
+// recently used entries are evicted.
+
+#define EXPR_CACHE_BUCKETS 1024
+#define EXPR_CACHE_DEFAULT_BYTES (4u << 20)
+
+typedef struct CacheEntry {
+    char* key;
+    unsigned secret_vars;
+    uint64_t hash;
+    NodeArena arena;
+    ExprNode* ast;
+    Program* prog;
+    JitProgram* jit;  // NULL when the JIT is unavailable or disabled
+    size_t bytes;
+    struct CacheEntry* hash_next;
+    struct CacheEntry* lru_prev;
+    struct CacheEntry* lru_next;
+} CacheEntry;
+
+typedef struct {
+    CacheEntry* buckets[EXPR_CACHE_BUCKETS];
+    CacheEntry* lru_head;
+    CacheEntry* lru_tail;
+    size_t entries;
+    size_t bytes;
+    size_t max_bytes;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} ExprCache;
+
+// Drops whitespace except where removing it would merge two tokens
+// ("1 2", "ab c") or turn a binary minus into a negative literal ("- 5").
+void normalize_expression(const char* expr, char* out) {
+    size_t len = 0;
+    char prev = '\0';
+
+    for (const char* p = expr; *p; p++) {
+        if (isspace((unsigned char)*p)) continue;
+
+        bool prev_word = isalnum((unsigned char)prev) || prev == '_';
+        bool this_word = isalnum((unsigned char)*p) || *p == '_';
+        if (p != expr && isspace((unsigned char)p[-1]) &&
+            ((prev_word && this_word) || (prev == '-' && isdigit((unsigned char)*p)))) {
+            out[len++] = ' ';
+        }
+        out[len++] = *p;
+        prev = *p;
+    }
+    out[len] = '\0';
+}
+
+uint64_t hash_string(const char* s) {
+    uint64_t h = 1469598103934665603ULL;
+    for (; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+size_t arena_bytes(const NodeArena* arena) {
+    size_t bytes = 0;
+    for (const ArenaChunk* chunk = arena->head; chunk; chunk = chunk->next) {
+        bytes += sizeof(ArenaChunk) + (size_t)chunk->capacity * sizeof(ExprNode);
+    }
+    return bytes;
+}
+
+size_t program_bytes(const Program* prog) {
+    return sizeof(Program) + (size_t)prog->capacity * sizeof(Instruction) +
+           (size_t)prog->num_constants * sizeof(int);
+}
+
+void expr_cache_init(ExprCache* cache, size_t max_bytes) {
+    memset(cache, 0, sizeof(*cache));
+    cache->max_bytes = max_bytes;
+}
+
+void lru_unlink(ExprCache* cache, CacheEntry* entry) {
+    if (entry->lru_prev) entry->lru_prev->lru_next = entry->lru_next;
+    else cache->lru_head = entry->lru_next;
+    if (entry->lru_next) entry->lru_next->lru_prev = entry->lru_prev;
+    else cache->lru_tail = entry->lru_prev;
+}
+
+void lru_push_front(ExprCache* cache, CacheEntry* entry) {
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head) cache->lru_head->lru_prev = entry;
+    cache->lru_head = entry;
+    if (!cache->lru_tail) cache->lru_tail = entry;
+}
+
+void cache_entry_free(CacheEntry* entry) {
+    jit_free(entry->jit);
+    free_program(entry->prog);
+    arena_release(&entry->arena);
+    free(entry->key);
+    free(entry);
+}
+
+void expr_cache_evict(ExprCache* cache, CacheEntry* entry) {
+    CacheEntry** link = &cache->buckets[entry->hash % EXPR_CACHE_BUCKETS];
+    while (*link != entry) link = &(*link)->hash_next;
+    *link = entry->hash_next;
+
+    lru_unlink(cache, entry);
+    cache->entries--;
+    cache->bytes -= entry->bytes;
+    cache->evictions++;
+    cache_entry_free(entry);
+}
+
+// Returns the cached entry for `expression` with the variables in
+// `secret_vars` secret, parsing and compiling it on a miss. The entry stays
+// valid until the next call that may evict it.
+CacheEntry* expr_cache_get(ExprCache* cache, const char* expression, unsigned secret_vars) {
+    // Hits normalize into a stack buffer; only a miss copies the key.
+    char stack_key[256];
+    size_t length = strlen(expression);
+    char* key = length < sizeof(stack_key) ? stack_key : malloc(length + 1);
+    normalize_expression(expression, key);
+    uint64_t hash = hash_string(key) ^ secret_vars;
+
+    for (CacheEntry* e = cache->buckets[hash % EXPR_CACHE_BUCKETS]; e; e = e->hash_next) {
+        if (e->hash == hash && e->secret_vars == secret_vars && strcmp(e->key, key) == 0) {
+            if (key != stack_key) free(key);
+            cache->hits++;
+            lru_unlink(cache, e);
+            lru_push_front(cache, e);
+            return e;
+        }
+    }
+
+    cache->misses++;
+    CacheEntry* entry = calloc(1, sizeof(CacheEntry));
+    entry->key = key != stack_key ? key : strcpy(malloc(strlen(key) + 1), key);
+    entry->secret_vars = secret_vars;
+    entry->hash = hash;
+    entry->ast = prepare_expression(parse_with_secrecy(key, &entry->arena, secret_vars), &entry->arena);
+    entry->prog = compile(entry->ast);
+    entry->jit = jit_compile(entry->prog);
+    entry->bytes = sizeof(CacheEntry) + strlen(key) + 1 +
+                   arena_bytes(&entry->arena) + program_bytes(entry->prog) +
+                   (entry->jit ? entry->jit->size : 0);
+
+    entry->hash_next = cache->buckets[hash % EXPR_CACHE_BUCKETS];
+    cache->buckets[hash % EXPR_CACHE_BUCKETS] = entry;
+    lru_push_front(cache, entry);
+    cache->entries++;
+    cache->bytes += entry->bytes;
+
+    while (cache->bytes > cache->max_bytes && cache->lru_tail != entry) {
+        expr_cache_evict(cache, cache->lru_tail);
+    }
+    return entry;
+}
+
+void expr_cache_clear(ExprCache* cache) {
+    CacheEntry* e = cache->lru_head;
+    while (e) {
+        CacheEntry* next = e->lru_next;
+        cache_entry_free(e);
+        e = next;
+    }
+    memset(cache->buckets, 0, sizeof(cache->buckets));
+    cache->lru_head = cache->lru_tail = NULL;
+    cache->entries = 0;
+    cache->bytes = 0;
+}
+
+void print_cache_stats(const ExprCache* cache) {
+    printf("Cache: %zu entries, %zu/%zu bytes, %llu hits, %llu misses, %llu evictions\n",
+           cache->entries, cache->bytes, cache->max_bytes,
+           (unsigned long long)cache->hits, (unsigned long long)cache->misses,
+           (unsigned long long)cache->evictions);
+}
+
+// --- Memory-Mapped Columns ---
+
+// A columnar file that is mapped straight into memory and evaluated in
+// place, with no copy through read buffers. It starts with a
+// MAPPED_ALIGN-byte header; column k (a, b, c, d, or the results) then
+// starts at MAPPED_ALIGN + k * stride, with the stride rounded up so every
+// column is aligned for the SIMD kernels. Values are native int32; the
+// header records the byte order so a file from a host of the other order
+// is refused rather than misread. Input files may have fewer than four
+// columns, in which case the rest read as 0.
+//
+// Evaluation goes MAPPED_CHUNK_ROWS rows at a time, and each chunk's pages
+// are faulted in with one madvise() just before it is used, so a large
+// file neither takes a fault per page nor is brought in all at once.
+
+#define MAPPED_MAGIC "MPCCOLS"
+#define MAPPED_BYTE_ORDER 0x01020304u
+#define MAPPED_ALIGN 64
+#define MAPPED_CHUNK_ROWS (1u << 20)
+
+#ifdef MADV_POPULATE_READ
+#define MAPPED_FAULT_READ MADV_POPULATE_READ
+#define MAPPED_FAULT_WRITE MADV_POPULATE_WRITE
+#else
+#define MAPPED_FAULT_READ MADV_WILLNEED
+#define MAPPED_FAULT_WRITE MADV_WILLNEED
+#endif
+
+typedef struct {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t columns;
+    uint64_t rows;
+    uint64_t stride;  // bytes from the start of one column to the next
+} MappedHeader;
+
+typedef struct {
+    void* base;
+    size_t bytes;
+    uint64_t rows;
+    int32_t* columns[NUM_VARIABLES];
+    void* zeros;  // read-only zero pages standing in for missing columns
+} MappedColumns;
+
+#ifdef MPC_HAVE_THREADS
+
+static inline uint64_t mapped_stride(uint64_t rows) {
+    return (rows * sizeof(int32_t) + MAPPED_ALIGN - 1) / MAPPED_ALIGN * MAPPED_ALIGN;
+}
+
+// True when `path` starts with a mapped-column header.
+bool is_mapped_file(const char* path) {
+    char magic[8] = { 0 };
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    bool matches = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, MAPPED_MAGIC, 8) == 0;
+    fclose(f);
+    return matches;
+}
+
+MappedColumns mapped_open(const char* path) {
+    MappedColumns m = { NULL };
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: Cannot open '%s'.\n", path);
+        exit(1);
+    }
+    MappedHeader header;
+    if (st.st_size < MAPPED_ALIGN || pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, MAPPED_MAGIC, 8) != 0) {
+        fprintf(stderr, "Error: '%s' is not a mapped column file.\n", path);
+        exit(1);
+    }
+    if (header.byte_order != MAPPED_BYTE_ORDER) {
+        fprintf(stderr, "Error: '%s' was written with the other byte order.\n", path);
+        exit(1);
+    }
+    // Bounded by division, so that a crafted stride cannot wrap the size check.
+    if (header.columns < 1 || header.columns > NUM_VARIABLES ||
+        header.rows > (uint64_t)SIZE_MAX / NUM_VARIABLES / sizeof(int32_t) ||
+        header.stride < mapped_stride(header.rows) || header.stride % MAPPED_ALIGN ||
+        header.stride > ((uint64_t)st.st_size - MAPPED_ALIGN) / header.columns) {
+        fprintf(stderr, "Error: '%s' has a damaged header.\n", path);
+        exit(1);
+    }
+
+    m.bytes = (size_t)st.st_size;
+    m.rows = header.rows;
+    m.base = mmap(NULL, m.bytes, PROT_READ, MAP_SHARED, fd, 0);
+    if (m.rows > 0 && header.columns < NUM_VARIABLES) {
+        m.zeros = mmap(NULL, (size_t)mapped_stride(m.rows), PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    close(fd);
+    if (m.base == MAP_FAILED || m.zeros == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map '%s'.\n", path);
+        exit(1);
+    }
+    madvise(m.base, m.bytes, MADV_SEQUENTIAL);
+    for (uint32_t v = 0; v < NUM_VARIABLES; v++) {
+        m.columns[v] = v < header.columns ? (int32_t*)((char*)m.base + MAPPED_ALIGN + v * header.stride) : m.zeros;
+    }
+    return m;
+}
+
+// Creates `path` with room for `columns` columns of `rows` values each,
+// mapped writable, for the caller to fill in. An existing file is resized
+// rather than truncated, so rewriting an output of the same size reuses its
+// pages.
+MappedColumns mapped_create(const char* path, uint64_t rows, uint32_t columns) {
+    MappedColumns m = { NULL };
+    MappedHeader header = { MAPPED_MAGIC, MAPPED_BYTE_ORDER, columns, rows, mapped_stride(rows) };
+    m.bytes = (size_t)(MAPPED_ALIGN + columns * header.stride);
+    m.rows = rows;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t)m.bytes) != 0) {
+        fprintf(stderr, "Error: Cannot create '%s'.\n", path);
+        exit(1);
+    }
+    m.base = mmap(NULL, m.bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (m.base == MAP_FAILED) {
+        fprintf(stderr, "Error: Cannot map '%s'.\n", path);
+        exit(1);
+    }
+    madvise(m.base, m.bytes, MADV_SEQUENTIAL);
+    memcpy(m.base, &header, sizeof(header));
+    memset((char*)m.base + sizeof(header), 0, MAPPED_ALIGN - sizeof(header));
+    for (uint32_t v = 0; v < columns; v++) {
+        char* column = (char*)m.base + MAPPED_ALIGN + v * header.stride;
+        memset(column + rows * sizeof(int32_t), 0, (size_t)(header.stride - rows * sizeof(int32_t)));
+        if (v < NUM_VARIABLES) m.columns[v] = (int32_t*)column;
+    }
+    return m;
+}
+
+// Faults in rows [first, first + n) of every file-backed column, for
+// reading or for writing.
+void mapped_fault_in(const MappedColumns* m, uint64_t first, size_t n, bool write) {
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    for (int v = 0; v < NUM_VARIABLES; v++) {
+        if (!m->columns[v] || m->columns[v] == m->zeros) continue;
+        uintptr_t start = (uintptr_t)(m->columns[v] + first) & ~(page - 1);
+        uintptr_t end = (uintptr_t)(m->columns[v] + first + n);
+        // Older kernels reject the populate advice; readahead still helps.
+        if (madvise((void*)start, end - start, write ? MAPPED_FAULT_WRITE : MAPPED_FAULT_READ) != 0) {
+            madvise((void*)start, end - start, MADV_WILLNEED);
+        }
+    }
+}
+
+void mapped_close(MappedColumns* m) {
+    munmap(m->base, m->bytes);
+    if (m->zeros) munmap(m->zeros, (size_t)mapped_stride(m->rows));
+    memset(m, 0, sizeof(*m));
+}
+
+// True when `a` and `b` both exist and are the same file.
+bool same_file(const char* a, const char* b) {
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+// Evaluates `prog` over every row of the mapped file `input` into a new
+// one-column mapped file `output`, which must be another file: resizing it
+// would pull pages out from under the input mapping. Returns the number of
+// rows.
+uint64_t mapped_evaluate(const Program* prog, int num_parties, const char* input, const char* output) {
+    if (same_file(input, output)) {
+        fprintf(stderr, "Error: '%s' is both the input and the output.\n", output);
+        exit(1);
+    }
+    MappedColumns in = mapped_open(input);
+    MappedColumns out = mapped_create(output, in.rows, 1);
+    int32_t* const* cols = in.columns;
+    for (uint64_t first = 0; first < in.rows; first += MAPPED_CHUNK_ROWS) {
+        size_t rows = in.rows - first < MAPPED_CHUNK_ROWS ? (size_t)(in.rows - first) : MAPPED_CHUNK_ROWS;
+        mapped_fault_in(&in, first, rows, false);
+        mapped_fault_in(&out, first, rows, true);
+        batch_trapped = false;
+        if (!num_parties) {
+            run_program_parallel(prog, cols[0] + first, cols[1] + first, cols[2] + first, cols[3] + first,
+                                 out.columns[0] + first, rows);
+        } else {
+            // Shared evaluation keeps per-row state, so it goes block by block.
+            for (size_t i = 0; i < rows; i += BATCH_BLOCK * 64) {
+                size_t n = rows - i < BATCH_BLOCK * 64 ? rows - i : BATCH_BLOCK * 64;
+                MpcStats stats;
+                uint64_t row = first + i;
+                run_program_shared(prog, num_parties, cols[0] + row, cols[1] + row, cols[2] + row, cols[3] + row,
+                                   out.columns[0] + row, n, &stats);
+            }
+        }
+        if (batch_trapped) {
+            // Only with batch_trap_soft: keep the rows before the zero divisor.
+            const int32_t* chunk[NUM_VARIABLES];
+            for (int v = 0; v < NUM_VARIABLES; v++) chunk[v] = cols[v] + first;
+            size_t good = run_program_columns_to_trap(prog, chunk, out.columns[0] + first, rows);
+            mapped_close(&out);
+            fprintf(stderr, "Error: Row %llu of input: division by zero.\n", (unsigned long long)(first + good + 1));
+            exit(1);
+        }
+    }
+    uint64_t rows = in.rows;
+    mapped_close(&out);
+    mapped_close(&in);
+    return rows;
+}
+
+#endif // MPC_HAVE_THREADS
+
+// --- Streaming Evaluation ---
+
+// `interpreter --expr EXPR [--input FILE] [--output FILE] [--format F]`
+// evaluates EXPR over every row of the input and writes one result per row.
+// The input is read in blocks of STREAM_BLOCK_ROWS into two buffers: a
+// reader thread fills one while the other is evaluated and its results
+// written, so memory stays the same whatever the input size. FILE is '-' or
+// omitted for stdin/stdout. Formats:
+// - csv: one row per line of comma-separated integers, and blank lines;
+//   the results are written one per line. A first line that starts with a
+//   letter or '_' names the columns, and variables are read from the
+//   column of that name, so EXPR may use any names the header gives (see
+//   Symbol Table), each of which must be a column. Without a header the
+//   values are a, b, c and d in turn. Missing trailing values are 0.
+// - rows: little-endian int32 records of a, b, c, d; the results are
+//   little-endian int32.
+// - columns: little-endian int32 columns a[n], b[n], c[n], d[n] back to
+//   back, which must be a regular file; the results are as for rows.
+// - mapped: a mapped column file (see Memory-Mapped Columns), evaluated in
+//   place into a new mapped file rather than through the two buffers.
+// The format defaults to csv for stdin and names ending in .csv, to mapped
+// for files with a mapped-column header, and to columns otherwise. Rows are
+// evaluated by run_program_parallel_columns(), or on shares when MPC_PARTIES
+// is set; the binary formats and shares carry only a, b, c and d.
+// All diagnostics go to stderr, as stdout may carry the results. A zero
+// divisor stops the run after the results of the rows before it have been
+// written, and the error names the row.
+
+#define STREAM_BLOCK_ROWS (64 * BATCH_BLOCK)
+#define STREAM_READ_BYTES (1 << 16)
+
+typedef enum { STREAM_CSV, STREAM_ROWS, STREAM_COLUMNS, STREAM_MAPPED } StreamFormat;
+
+#ifdef MPC_HAVE_THREADS
+
+// Where the values of a csv line go: field k is stored in column
+// slot_of[k], or dropped when that is -1. Blocks have `slots` columns, one
+// for each of the program's variables; the ones no field fills stay 0.
+// Binary records fill columns 0-3.
+typedef struct {
+    int fields;
+    int* slot_of;
+    int slots;
+    bool header;  // the csv header line has been read
+} StreamLayout;
+
+typedef struct {
+    int32_t* columns[PROGRAM_MAX_REGS];
+    size_t rows;
+    bool filled;  // set by the reader, cleared once the block is written
+} StreamBlock;
+
+typedef struct {
+    FILE* file;
+    StreamFormat format;
+    const StreamLayout* layout;
+    char* text;  // csv read buffer
+    size_t pos;
+    size_t len;
+    uint64_t line;
+    uint64_t total_rows;  // columns: rows in the file
+    uint64_t next_row;
+    void* raw;            // rows: one block of records
+    StreamBlock blocks[2];
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} StreamReader;
+
+static inline uint32_t stream_le32(uint32_t value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return __builtin_bswap32(value);
+#else
+    return value;
+#endif
+}
+
+int csv_next(StreamReader* r) {
+    if (r->pos == r->len) {
+        r->len = fread(r->text, 1, STREAM_READ_BYTES, r->file);
+        r->pos = 0;
+        if (r->len == 0) return EOF;
+    }
+    return (unsigned char)r->text[r->pos++];
+}
+
+void csv_error(const StreamReader* r, const char* message) {
+    fprintf(stderr, "Error: Line %llu of input: %s.\n", (unsigned long long)r->line, message);
+    exit(1);
+}
+
+// Reads the next row into `values`, which has room for `count`; false at
+// the end of the input.
+bool csv_read_row(StreamReader* r, int32_t* values, int count) {
+    for (;;) {
+        int ch = csv_next(r);
+        if (ch == EOF) return false;
+        r->line++;
+
+        int fields = 0;
+        for (int k = 0; k < count; k++) values[k] = 0;
+        for (;;) {
+            while (ch == ' ' || ch == '\t' || ch == '\r') ch = csv_next(r);
+            if (ch == '\n' || ch == EOF) {
+                if (fields > 0) csv_error(r, "expected a number after ','");
+                break;
+            }
+
+            bool negative = ch == '-';
+            if (ch == '-' || ch == '+') ch = csv_next(r);
+            if (!isdigit(ch)) csv_error(r, "expected a number");
+            int64_t value = 0;
+            for (; isdigit(ch); ch = csv_next(r)) {
+                value = value * 10 + (ch - '0');
+                if (value > (int64_t)INT32_MAX + 1) csv_error(r, "number out of range");
+            }
+            if (negative) value = -value;
+            if (value > INT32_MAX) csv_error(r, "number out of range");
+            if (fields == count) {
+                char message[48];
+                snprintf(message, sizeof(message), "more than %d values", count);
+                csv_error(r, message);
+            }
+            values[fields++] = (int32_t)value;
+
+            while (ch == ' ' || ch == '\t' || ch == '\r') ch = csv_next(r);
+            if (ch == '\n' || ch == EOF) return true;
+            if (ch != ',') csv_error(r, "expected ',' between values");
+            ch = csv_next(r);
+        }
+        if (ch == EOF) return false;  // a blank last line
+    }
+}
+
+void stream_fill(StreamReader* r, StreamBlock* block) {
+    const StreamLayout* layout = r->layout;
+    size_t rows = 0;
+    switch (r->format) {
+        case STREAM_CSV: {
+            int32_t* values = malloc((size_t)layout->fields * sizeof(int32_t));
+            while (rows < STREAM_BLOCK_ROWS && csv_read_row(r, values, layout->fields)) {
+                for (int k = 0; k < layout->fields; k++) {
+                    if (layout->slot_of[k] >= 0) block->columns[layout->slot_of[k]][rows] = values[k];
+                }
+                rows++;
+            }
+            free(values);
+            break;
+        }
+        case STREAM_ROWS: {
+            size_t bytes = fread(r->raw, 1, STREAM_BLOCK_ROWS * NUM_VARIABLES * sizeof(int32_t), r->file);
+            if (bytes % (NUM_VARIABLES * sizeof(int32_t))) {
+                fprintf(stderr, "Error: Input ends inside a row.\n");
+                exit(1);
+            }
+            rows = bytes / (NUM_VARIABLES * sizeof(int32_t));
+            const uint32_t* records = r->raw;
+            for (size_t i = 0; i < rows; i++) {
+                for (int v = 0; v < NUM_VARIABLES; v++) {
+                    block->columns[v][i] = (int32_t)stream_le32(records[i * NUM_VARIABLES + v]);
+                }
+            }
+            break;
+        }
+        case STREAM_COLUMNS: {
+            uint64_t left = r->total_rows - r->next_row;
+            rows = left < STREAM_BLOCK_ROWS ? (size_t)left : STREAM_BLOCK_ROWS;
+            for (int v = 0; v < NUM_VARIABLES && rows > 0; v++) {
+                off_t offset = (off_t)(((uint64_t)v * r->total_rows + r->next_row) * sizeof(int32_t));
+                size_t want = rows * sizeof(int32_t), got = 0;
+                while (got < want) {
+                    ssize_t n = pread(fileno(r->file), (char*)block->columns[v] + got, want - got,
+                                      offset + (off_t)got);
+                    if (n <= 0) {
+                        fprintf(stderr, "Error: Cannot read input columns.\n");
+                        exit(1);
+                    }
+                    got += (size_t)n;
+                }
+                for (size_t i = 0; i < rows; i++) {
+                    block->columns[v][i] = (int32_t)stream_le32((uint32_t)block->columns[v][i]);
+                }
+            }
+            r->next_row += rows;
+            break;
+        }
+        case STREAM_MAPPED:  // evaluated in place by mapped_evaluate()
+            break;
+    }
+    block->rows = rows;
+}
+
+// Fills the two blocks in turn until a block comes back short of rows.
+void* stream_reader_main(void* arg) {
+    StreamReader* r = arg;
+    for (int k = 0;; k ^= 1) {
+        StreamBlock* block = &r->blocks[k];
+        pthread_mutex_lock(&r->lock);
+        while (block->filled) pthread_cond_wait(&r->changed, &r->lock);
+        pthread_mutex_unlock(&r->lock);
+
+        stream_fill(r, block);
+        bool last = block->rows < STREAM_BLOCK_ROWS;
+
+        pthread_mutex_lock(&r->lock);
+        block->filled = true;
+        pthread_cond_broadcast(&r->changed);
+        pthread_mutex_unlock(&r->lock);
+        if (last) return NULL;
+    }
+}
+
+char* format_int32(char* p, int32_t value) {
+    char digits[12];
+    int count = 0;
+    uint32_t magnitude = value < 0 ? 0u - (uint32_t)value : (uint32_t)value;
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) *p++ = '-';
+    while (count) *p++ = digits[--count];
+    *p++ = '\n';
+    return p;
+}
+
+void stream_write(FILE* out, StreamFormat format, int32_t* results, size_t rows, char* text) {
+    size_t bytes;
+    if (format == STREAM_CSV) {
+        char* end = text;
+        for (size_t i = 0; i < rows; i++) end = format_int32(end, results[i]);
+        bytes = fwrite(text, 1, (size_t)(end - text), out) - (size_t)(end - text);
+    } else {
+        for (size_t i = 0; i < rows; i++) results[i] = (int32_t)stream_le32((uint32_t)results[i]);
+        bytes = fwrite(results, sizeof(int32_t), rows, out) - rows;
+    }
+    if (bytes != 0) {
+        fprintf(stderr, "Error: Cannot write output.\n");
+        exit(1);
+    }
+}
+
+StreamFormat stream_format(const char* name, const char* path) {
+    if (name) {
+        if (strcmp(name, "csv") == 0) return STREAM_CSV;
+        if (strcmp(name, "rows") == 0) return STREAM_ROWS;
+        if (strcmp(name, "columns") == 0) return STREAM_COLUMNS;
+        if (strcmp(name, "mapped") == 0) return STREAM_MAPPED;
+        fprintf(stderr, "Error: Unknown format '%s' (use csv, rows, columns or mapped).\n", name);
+        exit(1);
+    }
+    size_t len = path ? strlen(path) : 0;
+    if (!path || strcmp(path, "-") == 0 || (len >= 4 && strcmp(path + len - 4, ".csv") == 0)) return STREAM_CSV;
+    return is_mapped_file(path) ? STREAM_MAPPED : STREAM_COLUMNS;
+}
+
+// Reads the header line, if the csv input starts with one, and returns it
+// without its line end; NULL when the first line is data.
+char* stream_read_header(FILE* in) {
+    int ch = getc(in);
+    if (ch == EOF || !(isalpha(ch) || ch == '_')) {
+        if (ch != EOF) ungetc(ch, in);
+        return NULL;
+    }
+    size_t len = 0, capacity = 256;
+    char* line = malloc(capacity);
+    for (; ch != '\n' && ch != EOF; ch = getc(in)) {
+        if (len + 1 == capacity) line = realloc(line, capacity *= 2);
+        line[len++] = (char)ch;
+    }
+    line[len] = '\0';
+    return line;
+}
+
+// Marks in `used` the slots of the variables that `node` reads.
+void mark_variables(const ExprNode* node, bool* used) {
+    if (!node) return;
+    switch (node->type) {
+        case NODE_VARIABLE:
+            if (node->slot != LOOP_STATE_SLOT) used[node->slot] = true;
+            break;
+        case NODE_OPERATOR:
+            mark_variables(node->operation.left, used);
+            mark_variables(node->operation.right, used);
+            break;
+        case NODE_FUNCTION:
+            for (int i = 0; i < node->function.argc; i++) mark_variables(node->function.args[i], used);
+            break;
+        default:
+            break;
+    }
+}
+
+// Lays out csv rows for `prog`, parsed from `ast` with `symbols`. With a
+// `header`, each column whose name the expression uses goes to that
+// variable's slot and the others are dropped; every variable the expression
+// reads must be a column. Without one the fields are a, b, c and d, which
+// is also the layout of the binary formats.
+StreamLayout stream_layout(const char* header, SymbolTable* symbols, const ExprNode* ast, const Program* prog) {
+    StreamLayout layout = { 0, NULL, prog->num_variables, header != NULL };
+    if (!header) {
+        if (prog->num_variables > NUM_VARIABLES) {
+            fprintf(stderr, "Error: Only a, b, c and d can be read from input without a header line naming "
+                            "its columns.\n");
+            exit(1);
+        }
+        layout.fields = NUM_VARIABLES;
+        layout.slot_of = malloc(NUM_VARIABLES * sizeof(int));
+        for (int k = 0; k < NUM_VARIABLES; k++) layout.slot_of[k] = k;
+        return layout;
+    }
+
+    int named = symbols->count;  // a..d and the names the expression brought in
+    for (const char* p = header;; p++) {
+        layout.fields++;
+        p = strchr(p, ',');
+        if (!p) break;
+    }
+    layout.slot_of = malloc((size_t)layout.fields * sizeof(int));
+    const char* field = header;
+    for (int k = 0; k < layout.fields; k++) {
+        const char* end = strchr(field, ',');
+        if (!end) end = field + strlen(field);
+        while (field < end && isspace((unsigned char)*field)) field++;
+        size_t len = (size_t)(end - field);
+        while (len > 0 && isspace((unsigned char)field[len - 1])) len--;
+
+        // Only a name the expression could have used takes a slot.
+        char name[32];
+        bool is_name = len > 0 && len < sizeof(name) && !isdigit((unsigned char)field[0]);
+        for (size_t i = 0; i < len && is_name; i++) is_name = isalnum((unsigned char)field[i]) || field[i] == '_';
+        layout.slot_of[k] = -1;
+        if (is_name) {
+            memcpy(name, field, len);
+            name[len] = '\0';
+            int slot = symbol_lookup(symbols, name);
+            for (int j = 0; j < k && slot >= 0; j++) {
+                if (layout.slot_of[j] == slot) {
+                    fprintf(stderr, "Error: Line 1 of input: column '%s' appears twice.\n", name);
+                    exit(1);
+                }
+            }
+            layout.slot_of[k] = slot;
+        }
+        field = *end ? end + 1 : end;
+    }
+
+    bool* used = calloc((size_t)named, sizeof(bool));
+    bool* present = calloc((size_t)named, sizeof(bool));
+    mark_variables(ast, used);
+    for (int k = 0; k < layout.fields; k++) {
+        if (layout.slot_of[k] >= 0) present[layout.slot_of[k]] = true;
+        // A variable that optimization removed has no column in the blocks.
+        if (layout.slot_of[k] >= prog->num_variables) layout.slot_of[k] = -1;
+    }
+    for (int slot = 0; slot < named; slot++) {
+        if (used[slot] && !present[slot]) {
+            fprintf(stderr, "Error: The input has no column named '%s'.\n", symbols->names[slot]);
+            exit(1);
+        }
+    }
+    free(used);
+    free(present);
+    return layout;
+}
+
+// Streams every row of `in` through `prog` into `out`, both in `format`
+// (anything but STREAM_MAPPED), with csv fields placed by `layout`; returns
+// the number of rows.
+uint64_t stream_evaluate_with(const Program* prog, int num_parties, FILE* in, FILE* out, StreamFormat format,
+                              const StreamLayout* layout) {
+    StreamReader reader = { 0 };
+    reader.file = in;
+    reader.format = format;
+    reader.layout = layout;
+    reader.line = layout->header;
+    if (format == STREAM_COLUMNS) {
+        long size = fseek(in, 0, SEEK_END) == 0 ? ftell(in) : -1;
+        if (size < 0 || size % (long)(NUM_VARIABLES * sizeof(int32_t))) {
+            fprintf(stderr, "Error: Columnar input must be a regular file of four equal int32 columns.\n");
+            exit(1);
+        }
+        reader.total_rows = (uint64_t)size / (NUM_VARIABLES * sizeof(int32_t));
+    }
+
+    int slots = layout->slots;
+    int32_t* storage = calloc((size_t)2 * slots * STREAM_BLOCK_ROWS, sizeof(int32_t));
+    for (int k = 0; k < 2; k++) {
+        for (int v = 0; v < slots; v++) {
+            reader.blocks[k].columns[v] = storage + (size_t)(k * slots + v) * STREAM_BLOCK_ROWS;
+        }
+    }
+    int32_t* results = malloc(STREAM_BLOCK_ROWS * sizeof(int32_t));
+    char* text = malloc(STREAM_BLOCK_ROWS * 12);
+    reader.text = format == STREAM_CSV ? malloc(STREAM_READ_BYTES) : NULL;
+    reader.raw = format == STREAM_ROWS ? malloc(STREAM_BLOCK_ROWS * NUM_VARIABLES * sizeof(int32_t)) : NULL;
+    pthread_mutex_init(&reader.lock, NULL);
+    pthread_cond_init(&reader.changed, NULL);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, stream_reader_main, &reader) != 0) {
+        fprintf(stderr, "Error: Cannot start reader thread.\n");
+        exit(1);
+    }
+
+    uint64_t total = 0;
+    for (int k = 0;; k ^= 1) {
+        StreamBlock* block = &reader.blocks[k];
+        pthread_mutex_lock(&reader.lock);
+        while (!block->filled) pthread_cond_wait(&reader.changed, &reader.lock);
+        pthread_mutex_unlock(&reader.lock);
+
+        size_t rows = block->rows;
+        int32_t* const* cols = block->columns;
+        batch_trapped = false;
+        if (rows > 0 && num_parties) {
+            MpcStats stats;
+            run_program_shared(prog, num_parties, cols[0], cols[1], cols[2], cols[3], results, rows, &stats);
+        } else if (rows > 0) {
+            run_program_parallel_columns(prog, (const int32_t* const*)cols, results, rows);
+        }
+        size_t good = rows;
+        if (batch_trapped) good = run_program_columns_to_trap(prog, (const int32_t* const*)cols, results, rows);
+        stream_write(out, format, results, good, text);
+        if (good < rows) {
+            fflush(out);
+            fprintf(stderr, "Error: Row %llu of input: division by zero.\n", (unsigned long long)(total + good + 1));
+            exit(1);
+        }
+        total += rows;
+
+        pthread_mutex_lock(&reader.lock);
+        block->filled = false;
+        pthread_cond_broadcast(&reader.changed);
+        pthread_mutex_unlock(&reader.lock);
+        if (rows < STREAM_BLOCK_ROWS) break;
+    }
+    pthread_join(thread, NULL);
+
+    pthread_mutex_destroy(&reader.lock);
+    pthread_cond_destroy(&reader.changed);
+    free(storage);
+    free(results);
+    free(text);
+    free(reader.text);
+    free(reader.raw);
+    return total;
+}
+
+// As stream_evaluate_with() for inputs of a, b, c and d.
+uint64_t stream_evaluate(const Program* prog, int num_parties, FILE* in, FILE* out, StreamFormat format) {
+    int slot_of[NUM_VARIABLES] = { 0, 1, 2, 3 };
+    StreamLayout layout = { NUM_VARIABLES, slot_of, NUM_VARIABLES, false };
+    require_four_variables(prog, "Streaming without a layout");
+    return stream_evaluate_with(prog, num_parties, in, out, format, &layout);
+}
+
+int stream_main(int argc, char* argv[]) {
+    const char *expression = NULL, *input_path = NULL, *output_path = NULL, *format_name = NULL;
+    for (int i = 1; i < argc; i++) {
+        const char** option = strcmp(argv[i], "--expr") == 0     ? &expression
+                              : strcmp(argv[i], "--input") == 0  ? &input_path
+                              : strcmp(argv[i], "--output") == 0 ? &output_path
+                              : strcmp(argv[i], "--format") == 0 ? &format_name
+                                                                 : NULL;
+        if (!option || i + 1 == argc) {
+            fprintf(stderr,
+                    "Usage: %s --expr EXPR [--input FILE] [--output FILE] [--format csv|rows|columns|mapped]\n",
+                    argv[0]);
+            return 1;
+        }
+        *option = argv[++i];
+    }
+
+    // Results get the real stdout; fd 1 is pointed at stderr, so that what
+    // the parser and the engines print cannot end up among them.
+    fflush(stdout);
+    int results_fd = dup(STDOUT_FILENO);
+    FILE* results = results_fd >= 0 ? fdopen(results_fd, "wb") : NULL;
+    if (!results || dup2(STDERR_FILENO, STDOUT_FILENO) < 0) {
+        fprintf(stderr, "Error: Cannot redirect stdout.\n");
+        return 1;
+    }
+    // A zero divisor flags the block instead of ending the run, so that the
+    // rows before it can still be written.
+    batch_trap_soft = true;
+
+    StreamFormat format = stream_format(format_name, input_path);
+    bool from_stdin = !input_path || strcmp(input_path, "-") == 0;
+    bool to_stdout = !output_path || strcmp(output_path, "-") == 0;
+    if (format == STREAM_MAPPED && (from_stdin || to_stdout)) {
+        fprintf(stderr, "Error: Mapped columns need an --input and an --output file.\n");
+        return 1;
+    }
+    // Opening the output truncates it, so it cannot also be the input.
+    if (!from_stdin && !to_stdout && same_file(input_path, output_path)) {
+        fprintf(stderr, "Error: '%s' is both the input and the output.\n", output_path);
+        return 1;
+    }
+    FILE* in = NULL;
+    FILE* out = NULL;
+    if (format != STREAM_MAPPED) {
+        in = from_stdin ? stdin : fopen(input_path, "rb");
+        out = to_stdout ? results : fopen(output_path, "wb");
+        if (!in || !out) {
+            fprintf(stderr, "Error: Cannot open '%s'.\n", !in ? input_path : output_path);
+            return 1;
+        }
+    }
+
+    NodeArena arena = { NULL };
+    SymbolTable symbols;
+    symbol_table_init(&symbols);
+    ExprNode* ast = parse_with_symbols(expression, &arena, &symbols, secret_variables(getenv("MPC_PUBLIC")));
+    Program* prog = compile(prepare_expression(ast, &arena));
+    const char* parties = getenv("MPC_PARTIES");
+    int num_parties = parties ? atoi(parties) : 0;
+
+    // Binary records, like csv without a header, are a, b, c and d.
+    if (format != STREAM_CSV) require_four_variables(prog, "Binary and mapped input");
+    char* header = format == STREAM_CSV ? stream_read_header(in) : NULL;
+    StreamLayout layout = stream_layout(header, &symbols, ast, prog);
+
+    double start = mpc_seconds();
+    uint64_t total = format == STREAM_MAPPED ? mapped_evaluate(prog, num_parties, input_path, output_path)
+                                             : stream_evaluate_with(prog, num_parties, in, out, format, &layout);
+    double seconds = mpc_seconds() - start;
+
+    if (out && (fflush(out) != 0 || (!to_stdout && fclose(out) != 0))) {
+        fprintf(stderr, "Error: Cannot write output.\n");
+        return 1;
+    }
+    fclose(results);
+    if (in && !from_stdin) fclose(in);
+    fprintf(stderr, "%llu rows in %.3f s (%.0f rows/s)\n", (unsigned long long)total, seconds,
+            seconds > 0 ? (double)total / seconds : 0.0);
+
+    free(layout.slot_of);
+    free(header);
+    free_program(prog);
+    symbol_table_free(&symbols);
+    arena_release(&arena);
+    return 0;
+}
+
+#else
+
+int stream_main(int argc, char* argv[]) {
+    (void)argc;
+    fprintf(stderr, "Error: %s was built without threads, which streaming needs.\n", argv[0]);
+    return 1;
+}
+
+#endif // MPC_HAVE_THREADS
+
+// --- Evaluation Server ---
+
+// `interpreter --serve SOCKET EXPR...` compiles each EXPR once and serves
+// them on a Unix domain socket; the expression id is its position in the
+// list. `interpreter --client SOCKET [...]` is a local client that drives
+// it with pipelined requests (see client_main).
+//
+// Every message is a 16-byte header followed by its payload, in the host's
+// byte order since both ends run on the same machine. A request names an
+// expression and carries `rows` tuples of its variables as int32: a, b, c
+// and d, then any other names in the order they first appear in the
+// expression, which the server lists when it starts for every expression
+// with more than those four. The response carries
+// one int32 result per row, or a non-zero status and no rows. The
+// tag is chosen by the client and echoed back. Responses on a connection
+// come back in request order, and a client may send any number of requests
+// before reading them. The id SERVER_STATS_ID with no rows asks for a
+// ServerStats payload instead.
+//
+// The server is one epoll loop; each batch runs on
+// run_program_parallel_columns().
+// A request's latency runs from the read that completed it to the write
+// that finished its response, so it includes time queued behind earlier
+// requests on the same connection.
+
+typedef struct {
+    uint32_t length;  // bytes after this field: 12 + 4 * variables * rows
+    uint32_t tag;
+    uint32_t expr_id;
+    uint32_t rows;
+} ServerRequest;
+
+typedef struct {
+    uint32_t length;  // bytes after this field: 12 + 4 * rows, or 12 + sizeof(ServerStats)
+    uint32_t tag;
+    uint32_t status;
+    uint32_t rows;
+} ServerResponse;
+
+enum { SERVER_OK, SERVER_UNKNOWN_EXPRESSION, SERVER_DIVISION_BY_ZERO, SERVER_BAD_REQUEST };
+
+typedef struct {
+    uint64_t requests;
+    uint64_t rows;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t max_ns;
+} ServerStats;
+
+#define SERVER_STATS_ID 0xFFFFFFFFu
+#define SERVER_MAX_ROWS (1 << 20)
+#define SERVER_READ_BYTES (1 << 16)
+#define SERVER_MAX_QUEUED (16 << 20)  // output bytes at which a connection stops being read
+#define SERVER_MAX_EVENTS 64
+
+// Latencies in nanoseconds, bucketed with 16 steps per power of two so any
+// percentile is within about 3% of the true value.
+
+#define LATENCY_STEPS 16
+
+typedef struct {
+    uint64_t counts[61 * LATENCY_STEPS];
+    uint64_t total;
+    uint64_t max;
+} LatencyHistogram;
+
+#ifdef MPC_HAVE_SERVER
+
+static inline int latency_bucket(uint64_t ns) {
+    if (ns < 2 * LATENCY_STEPS) return (int)ns;
+    int log = 63 - __builtin_clzll(ns);
+    return (log - 3) * LATENCY_STEPS + (int)((ns >> (log - 4)) & (LATENCY_STEPS - 1));
+}
+
+// The middle of bucket b.
+static inline uint64_t latency_value(int b) {
+    if (b < 2 * LATENCY_STEPS) return (uint64_t)b;
+    int log = b / LATENCY_STEPS + 3;
+    uint64_t width = 1ULL << (log - 4);
+    return (uint64_t)(LATENCY_STEPS + b % LATENCY_STEPS) * width + width / 2;
+}
+
+void latency_record(LatencyHistogram* h, double seconds) {
+    uint64_t ns = seconds > 0 ? (uint64_t)(seconds * 1e9) : 0;
+    h->counts[latency_bucket(ns)]++;
+    h->total++;
+    if (ns > h->max) h->max = ns;
+}
+
+uint64_t latency_percentile(const LatencyHistogram* h, double fraction) {
+    uint64_t rank = (uint64_t)(fraction * (double)h->total + 0.5), seen = 0;
+    if (rank == 0) rank = 1;
+    for (int b = 0; b < 61 * LATENCY_STEPS; b++) {
+        seen += h->counts[b];
+        if (seen >= rank) return latency_value(b) < h->max ? latency_value(b) : h->max;
+    }
+    return h->max;
+}
+
+typedef struct {
+    size_t end;  // offset in `out` just past the response
+    double start;
+} ServerPending;
+
+typedef struct ServerConnection {
+    int fd;
+    uint32_t events;  // registered with epoll
+    double arrived;   // time of the latest read
+    bool draining;    // the peer has stopped sending
+    uint8_t* in;
+    size_t in_len, in_cap;
+    uint8_t* out;
+    size_t out_len, out_sent, out_cap;
+    ServerPending* pending;
+    size_t pending_head, pending_count, pending_cap;
+    struct ServerConnection* next;
+} ServerConnection;
+
+typedef struct {
+    Program** progs;
+    int num_exprs;
+    int max_variables;  // of any expression, which bounds a request's size
+    int32_t* columns[PROGRAM_MAX_REGS];
+    size_t column_rows;
+    LatencyHistogram latency;
+    uint64_t rows;
+    ServerConnection* connections;
+} Server;
+
+static volatile sig_atomic_t server_stopping = 0;
+
+void server_stop(int sig) {
+    (void)sig;
+    server_stopping = 1;
+}
+
+// Room for `bytes` more bytes of output, moving unsent output to the front
+// first when that frees at least half the buffer.
+uint8_t* server_reserve(ServerConnection* conn, size_t bytes) {
+    if (conn->out_sent > 0 && conn->out_sent >= conn->out_len / 2) {
+        memmove(conn->out, conn->out + conn->out_sent, conn->out_len - conn->out_sent);
+        for (size_t i = 0; i < conn->pending_count; i++) {
+            conn->pending[conn->pending_head + i].end -= conn->out_sent;
+        }
+        conn->out_len -= conn->out_sent;
+        conn->out_sent = 0;
+    }
+    if (conn->out_len + bytes > conn->out_cap) {
+        conn->out_cap = (conn->out_len + bytes) * 2;
+        conn->out = realloc(conn->out, conn->out_cap);
+    }
+    return conn->out + conn->out_len;
+}
+
+// Queues a response whose `payload` bytes the caller has already written
+// after the header's place, at server_reserve() + sizeof(ServerResponse).
+void server_respond(ServerConnection* conn, uint32_t tag, uint32_t status, uint32_t rows, size_t payload) {
+    ServerResponse header = { (uint32_t)(12 + payload), tag, status, rows };
+    memcpy(server_reserve(conn, sizeof(header) + payload), &header, sizeof(header));
+    conn->out_len += sizeof(header) + payload;
+
+    if (conn->pending_head + conn->pending_count == conn->pending_cap) {
+        if (conn->pending_head > 0) {
+            memmove(conn->pending, conn->pending + conn->pending_head, conn->pending_count * sizeof(ServerPending));
+            conn->pending_head = 0;
+        } else {
+            conn->pending_cap = conn->pending_cap ? conn->pending_cap * 2 : 64;
+            conn->pending = realloc(conn->pending, conn->pending_cap * sizeof(ServerPending));
+        }
+    }
+    conn->pending[conn->pending_head + conn->pending_count++] = (ServerPending){ conn->out_len, conn->arrived };
+}
+
+void server_handle(Server* server, ServerConnection* conn, const ServerRequest* req, const uint8_t* tuples) {
+    if (req->expr_id == SERVER_STATS_ID && req->rows == 0 && req->length == 12) {
+        ServerStats stats = { server->latency.total,
+                              server->rows,
+                              latency_percentile(&server->latency, 0.50),
+                              latency_percentile(&server->latency, 0.90),
+                              latency_percentile(&server->latency, 0.99),
+                              server->latency.max };
+        memcpy(server_reserve(conn, sizeof(ServerResponse) + sizeof(stats)) + sizeof(ServerResponse), &stats,
+               sizeof(stats));
+        server_respond(conn, req->tag, SERVER_OK, 0, sizeof(stats));
+        return;
+    }
+    if (req->expr_id >= (uint32_t)server->num_exprs) {
+        server_respond(conn, req->tag, SERVER_UNKNOWN_EXPRESSION, 0, 0);
+        return;
+    }
+    const Program* prog = server->progs[req->expr_id];
+    int width = prog->num_variables;
+    if (req->length != 12 + 4 * (uint64_t)width * req->rows) {
+        server_respond(conn, req->tag, SERVER_BAD_REQUEST, 0, 0);
+        return;
+    }
+
+    size_t rows = req->rows;
+    if (rows > server->column_rows) {
+        for (int v = 0; v < server->max_variables; v++) {
+            server->columns[v] = realloc(server->columns[v], rows * sizeof(int32_t));
+        }
+        server->column_rows = rows;
+    }
+    for (size_t i = 0; i < rows; i++) {
+        for (int v = 0; v < width; v++) {
+            memcpy(&server->columns[v][i], tuples + (i * width + v) * sizeof(int32_t), sizeof(int32_t));
+        }
+    }
+
+    // Results go straight into the output buffer, which stays 4-byte
+    // aligned because every message is a multiple of 4 bytes long.
+    int32_t* results = (int32_t*)(server_reserve(conn, sizeof(ServerResponse) + rows * sizeof(int32_t)) +
+                                  sizeof(ServerResponse));
+    batch_trapped = false;
+    if (rows > 0) run_program_parallel_columns(prog, (const int32_t* const*)server->columns, results, rows);
+    if (batch_trapped) {
+        server_respond(conn, req->tag, SERVER_DIVISION_BY_ZERO, 0, 0);
+        return;
+    }
+    server_respond(conn, req->tag, SERVER_OK, (uint32_t)rows, rows * sizeof(int32_t));
+    server->rows += rows;
+}
+
+// Answers every complete request in the input buffer, stopping early while
+// too much output is queued. Returns false if the stream is unusable.
+bool server_process(Server* server, ServerConnection* conn) {
+    size_t pos = 0;
+    while (conn->in_len - pos >= sizeof(ServerRequest) && conn->out_len - conn->out_sent < SERVER_MAX_QUEUED) {
+        ServerRequest req;
+        memcpy(&req, conn->in + pos, sizeof(req));
+        if (req.length < 12 || req.length > 12 + 4 * (uint64_t)server->max_variables * SERVER_MAX_ROWS) return false;
+        if (conn->in_len - pos < 4 + (size_t)req.length) break;
+        server_handle(server, conn, &req, conn->in + pos + sizeof(req));
+        pos += 4 + (size_t)req.length;
+    }
+    memmove(conn->in, conn->in + pos, conn->in_len - pos);
+    conn->in_len -= pos;
+    return true;
+}
+
+// Reads what is available; false once the peer has gone or on error.
+bool server_read(ServerConnection* conn) {
+    for (;;) {
+        if (conn->in_cap - conn->in_len < SERVER_READ_BYTES) {
+            conn->in_cap = conn->in_cap * 2 + SERVER_READ_BYTES;
+            conn->in = realloc(conn->in, conn->in_cap);
+        }
+        ssize_t n = read(conn->fd, conn->in + conn->in_len, conn->in_cap - conn->in_len);
+        if (n > 0) {
+            conn->in_len += (size_t)n;
+            conn->arrived = mpc_seconds();
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+    }
+}
+
+// Writes queued output and records the latency of each response that is
+// now fully sent; false on error.
+bool server_flush(Server* server, ServerConnection* conn) {
+    while (conn->out_sent < conn->out_len) {
+        ssize_t n = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return false;
+        }
+        conn->out_sent += (size_t)n;
+    }
+    double now = mpc_seconds();
+    while (conn->pending_count > 0 && conn->pending[conn->pending_head].end <= conn->out_sent) {
+        latency_record(&server->latency, now - conn->pending[conn->pending_head].start);
+        conn->pending_head++;
+        conn->pending_count--;
+    }
+    if (conn->pending_count == 0) conn->pending_head = 0;
+    if (conn->out_sent == conn->out_len) conn->out_sent = conn->out_len = 0;
+    return true;
+}
+
+void server_close(Server* server, int epoll_fd, ServerConnection* conn) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    ServerConnection** link = &server->connections;
+    while (*link != conn) link = &(*link)->next;
+    *link = conn->next;
+    free(conn->in);
+    free(conn->out);
+    free(conn->pending);
+    free(conn);
+}
+
+// Reads, answers and writes for one ready connection; false to close it.
+bool server_service(Server* server, int epoll_fd, ServerConnection* conn, uint32_t events) {
+    if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !conn->draining) conn->draining = !server_read(conn);
+    for (;;) {
+        size_t before = conn->in_len;
+        if (!server_process(server, conn) || !server_flush(server, conn)) return false;
+        if (conn->in_len == before || conn->out_sent != conn->out_len) break;
+    }
+
+    // A peer that has stopped sending still gets the responses already due.
+    size_t queued = conn->out_len - conn->out_sent;
+    if (conn->draining && queued == 0) return false;
+    uint32_t wanted = (queued < SERVER_MAX_QUEUED && !conn->draining ? EPOLLIN : 0) | (queued > 0 ? EPOLLOUT : 0);
+    if (wanted != conn->events) {
+        struct epoll_event ev = { .events = wanted, .data.ptr = conn };
+        epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &ev);
+        conn->events = wanted;
+    }
+    return true;
+}
+
+int server_main(int argc, char* argv[]) {
+    const char* path = argv[2];
+    Server server = { 0 };
+    NodeArena arena = { NULL };
+    unsigned secret_vars = secret_variables(getenv("MPC_PUBLIC"));
+    server.num_exprs = argc - 3;
+    server.progs = malloc((size_t)server.num_exprs * sizeof(Program*));
+    server.max_variables = NUM_VARIABLES;
+    for (int i = 0; i < server.num_exprs; i++) {
+        SymbolTable symbols;
+        symbol_table_init(&symbols);
+        ExprNode* ast = parse_with_symbols(argv[3 + i], &arena, &symbols, secret_vars);
+        server.progs[i] = compile(prepare_expression(ast, &arena));
+        int width = server.progs[i]->num_variables;
+        if (width > server.max_variables) server.max_variables = width;
+        if (width > NUM_VARIABLES) {
+            fprintf(stderr, "Expression %d takes", i);
+            for (int v = 0; v < width; v++) fprintf(stderr, "%s %s", v ? "," : "", symbols.names[v]);
+            fprintf(stderr, "\n");
+        }
+        symbol_table_free(&symbols);
+    }
+    batch_trap_soft = true;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path '%s' is too long.\n", path);
+        return 1;
+    }
+    strcpy(addr.sun_path, path);
+    struct stat st;
+    if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);  // left by an earlier run
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (listener < 0 || epoll_fd < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listener, SOMAXCONN) != 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listener, &ev) != 0) {
+        fprintf(stderr, "Error: Cannot listen on '%s': %s.\n", path, strerror(errno));
+        return 1;
+    }
+
+    struct sigaction action = { .sa_handler = server_stop };
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    fprintf(stderr, "Serving %d expression(s) on %s\n", server.num_exprs, path);
+
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!server_stopping) {
+        int ready = epoll_wait(epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        for (int e = 0; e < ready; e++) {
+            ServerConnection* conn = events[e].data.ptr;
+            if (conn) {
+                if (!server_service(&server, epoll_fd, conn, events[e].events)) server_close(&server, epoll_fd, conn);
+                continue;
+            }
+            int fd;
+            while ((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                conn = calloc(1, sizeof(ServerConnection));
+                conn->fd = fd;
+                conn->events = EPOLLIN;
+                struct epoll_event cev = { .events = EPOLLIN, .data.ptr = conn };
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &cev);
+                conn->next = server.connections;
+                server.connections = conn;
+            }
+        }
+    }
+
+    while (server.connections) server_close(&server, epoll_fd, server.connections);
+    close(epoll_fd);
+    close(listener);
+    unlink(path);
+    fprintf(stderr, "%llu requests, %llu rows; latency p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+            (unsigned long long)server.latency.total, (unsigned long long)server.rows,
+            latency_percentile(&server.latency, 0.50) / 1e3, latency_percentile(&server.latency, 0.90) / 1e3,
+            latency_percentile(&server.latency, 0.99) / 1e3, server.latency.max / 1e3);
+
+    for (int v = 0; v < server.max_variables; v++) free(server.columns[v]);
+    for (int i = 0; i < server.num_exprs; i++) free_program(server.progs[i]);
+    free(server.progs);
+    arena_release(&arena);
+    return 0;
+}
+
+// Fills request `tag`'s `count` values; the same tag always gives the same
+// values.
+void client_rows(uint32_t tag, size_t count, int32_t* tuples) {
+    uint64_t state = 0x9E3779B97F4A7C15ULL * (tag + 1);
+    for (size_t i = 0; i < count; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        uint32_t r = (uint32_t)(state >> 16);
+        tuples[i] = (int32_t)(r >> (r % 24));
+    }
+}
+
+// `interpreter --client SOCKET [--requests N] [--rows R] [--depth D] [EXPR...]`
+// sends N requests of R random rows, keeping up to D of them in flight,
+// and prints the round-trip latency and the server's own statistics. The
+// EXPRs, when given, must match the server's list: requests then cycle
+// through them, each with as many values per row as its expression has
+// variables, and every result is checked against a local evaluation.
+// Without them every request is of a, b, c and d for expression 0.
+int client_main(int argc, char* argv[]) {
+    const char* path = argv[2];
+    uint32_t num_requests = 10000, rows = 256, depth = 16;
+    int first_expr = argc;
+    for (int i = 3; i < argc; i++) {
+        uint32_t* option = strcmp(argv[i], "--requests") == 0 ? &num_requests
+                           : strcmp(argv[i], "--rows") == 0   ? &rows
+                           : strcmp(argv[i], "--depth") == 0  ? &depth
+                                                              : NULL;
+        if (!option) {
+            first_expr = i;
+            break;
+        }
+        if (i + 1 == argc) break;
+        *option = (uint32_t)strtoul(argv[++i], NULL, 10);
+    }
+    if (rows > SERVER_MAX_ROWS || depth == 0) {
+        fprintf(stderr, "Error: --rows must be at most %d and --depth at least 1.\n", SERVER_MAX_ROWS);
+        return 1;
+    }
+
+    NodeArena arena = { NULL };
+    unsigned secret_vars = secret_variables(getenv("MPC_PUBLIC"));
+    int num_exprs = argc - first_expr;
+    Program** progs = malloc((size_t)(num_exprs > 0 ? num_exprs : 1) * sizeof(Program*));
+    int max_variables = NUM_VARIABLES;
+    for (int i = 0; i < num_exprs; i++) {
+        SymbolTable symbols;
+        symbol_table_init(&symbols);
+        progs[i] = compile(
+            prepare_expression(parse_with_symbols(argv[first_expr + i], &arena, &symbols, secret_vars), &arena));
+        symbol_table_free(&symbols);
+        if (progs[i]->num_variables > max_variables) max_variables = progs[i]->num_variables;
+    }
+    batch_trap_soft = true;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Error: Cannot connect to '%s': %s.\n", path, strerror(errno));
+        return 1;
+    }
+
+    size_t tuple_cap = (size_t)rows * max_variables;
+    size_t response_cap = sizeof(ServerResponse) + (size_t)rows * sizeof(int32_t) + sizeof(ServerStats);
+    uint8_t* out = malloc(sizeof(ServerRequest) + tuple_cap * sizeof(int32_t));
+    uint8_t* in = malloc(response_cap + SERVER_READ_BYTES);
+    int32_t* tuples = malloc(tuple_cap * sizeof(int32_t) + 1);
+    int32_t* cols[PROGRAM_MAX_REGS];
+    for (int v = 0; v < max_variables; v++) cols[v] = malloc((size_t)rows * sizeof(int32_t) + 1);
+    int32_t* expected = malloc((size_t)rows * sizeof(int32_t) + 1);
+    double* sent_at = malloc(depth * sizeof(double));
+    LatencyHistogram* latency = calloc(1, sizeof(LatencyHistogram));
+
+    uint32_t sent = 0, done = 0, mismatches = 0, errors = 0;
+    size_t out_len = 0, out_sent = 0, in_len = 0;
+    double start = mpc_seconds();
+    while (done < num_requests) {
+        if (out_sent == out_len && sent < num_requests && sent - done < depth) {
+            uint32_t expr_id = num_exprs ? sent % (uint32_t)num_exprs : 0;
+            size_t count = (size_t)rows * (num_exprs ? progs[expr_id]->num_variables : NUM_VARIABLES);
+            ServerRequest req = { (uint32_t)(12 + count * sizeof(int32_t)), sent, expr_id, rows };
+            memcpy(out, &req, sizeof(req));
+            client_rows(sent, count, tuples);
+            memcpy(out + sizeof(req), tuples, count * sizeof(int32_t));
+            out_len = sizeof(req) + count * sizeof(int32_t);
+            out_sent = 0;
+            sent_at[sent % depth] = mpc_seconds();
+            sent++;
+        }
+
+        struct pollfd pfd = { fd, POLLIN | (out_sent < out_len ? POLLOUT : 0), 0 };
+        if (poll(&pfd, 1, -1) < 0) continue;
+        if (pfd.revents & POLLOUT) {
+            ssize_t n = send(fd, out + out_sent, out_len - out_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (n > 0) out_sent += (size_t)n;
+        }
+        if (!(pfd.revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        ssize_t n = recv(fd, in + in_len, response_cap + SERVER_READ_BYTES - in_len, MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            fprintf(stderr, "Error: The server closed the connection.\n");
+            return 1;
+        }
+        if (n > 0) in_len += (size_t)n;
+
+        size_t pos = 0;
+        for (;;) {
+            ServerResponse resp;
+            if (in_len - pos < sizeof(resp)) break;
+            memcpy(&resp, in + pos, sizeof(resp));
+            if (resp.length < 12 || 4 + (size_t)resp.length > response_cap) {
+                fprintf(stderr, "Error: Malformed response from the server.\n");
+                return 1;
+            }
+            if (in_len - pos < 4 + (size_t)resp.length) break;
+            if (resp.tag != done) {
+                fprintf(stderr, "Error: Response %u arrived when %u was due.\n", resp.tag, done);
+                return 1;
+            }
+            latency_record(latency, mpc_seconds() - sent_at[done % depth]);
+            if (resp.status != SERVER_OK) errors++;
+            if (num_exprs) {
+                const Program* prog = progs[resp.tag % (uint32_t)num_exprs];
+                int width = prog->num_variables;
+                client_rows(resp.tag, (size_t)rows * width, tuples);
+                for (uint32_t i = 0; i < rows; i++) {
+                    for (int v = 0; v < width; v++) cols[v][i] = tuples[(size_t)i * width + v];
+                }
+                batch_trapped = false;
+                if (rows > 0) run_program_columns(prog, (const int32_t* const*)cols, expected, rows);
+                if (batch_trapped) {
+                    mismatches += resp.status != SERVER_DIVISION_BY_ZERO;
+                } else if (resp.status != SERVER_OK || resp.rows != rows ||
+                           memcmp(in + pos + sizeof(resp), expected, (size_t)rows * sizeof(int32_t)) != 0) {
+                    mismatches++;
+                }
+            }
+            pos += 4 + resp.length;
+            done++;
+        }
+        memmove(in, in + pos, in_len - pos);
+        in_len -= pos;
+    }
+    double seconds = mpc_seconds() - start;
+
+    // Ask for the server's statistics once everything is answered.
+    ServerRequest req = { 12, num_requests, SERVER_STATS_ID, 0 };
+    ServerResponse resp;
+    ServerStats stats = { 0 };
+    if (send(fd, &req, sizeof(req), MSG_NOSIGNAL) != (ssize_t)sizeof(req) ||
+        recv(fd, &resp, sizeof(resp), MSG_WAITALL) != (ssize_t)sizeof(resp) ||
+        recv(fd, &stats, sizeof(stats), MSG_WAITALL) != (ssize_t)sizeof(stats)) {
+        fprintf(stderr, "Error: Cannot read the server's statistics.\n");
+        return 1;
+    }
+    close(fd);
+
+    printf("%u requests of %u rows in %.3f s (%.0f requests/s, %.0f rows/s), depth %u\n", num_requests, rows,
+           seconds, num_requests / seconds, (double)num_requests * rows / seconds, depth);
+    printf("Round trip: p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+           latency_percentile(latency, 0.50) / 1e3, latency_percentile(latency, 0.90) / 1e3,
+           latency_percentile(latency, 0.99) / 1e3, latency->max / 1e3);
+    printf("Server: %llu requests, %llu rows; p50 %.1f us, p90 %.1f us, p99 %.1f us, max %.1f us\n",
+           (unsigned long long)stats.requests, (unsigned long long)stats.rows, stats.p50_ns / 1e3,
+           stats.p90_ns / 1e3, stats.p99_ns / 1e3, stats.max_ns / 1e3);
+    if (num_exprs) printf("%u mismatch(es), %u error response(s)\n", mismatches, errors);
+
+    for (int i = 0; i < num_exprs; i++) free_program(progs[i]);
+    for (int v = 0; v < max_variables; v++) free(cols[v]);
+    free(progs);
+    free(out);
+    free(in);
+    free(tuples);
+    free(expected);
+    free(sent_at);
+    free(latency);
+    arena_release(&arena);
+    return mismatches ? 1 : 0;
+}
+
+#else
+
+int server_main(int argc, char* argv[]) {
+    (void)argc;
+    fprintf(stderr, "Error: %s was built without epoll, which the server needs.\n", argv[0]);
+    return 1;
+}
+
+int client_main(int argc, char* argv[]) {
+    return server_main(argc, argv);
+}
+
+#endif // MPC_HAVE_SERVER
+
+// --- Main Program ---
+
+// Helper function to read an integer safely
+int read_int_input(const char* prompt) {
+    char buffer[100];
+    int value;
+    while (1) {
+        printf("%s", prompt);
+        if (fgets(buffer, sizeof(buffer), stdin) == NULL) {
+            printf("Error reading input. Exiting.\n");
+            exit(1);
+        }
+        if (sscanf(buffer, "%d", &value) == 1) {
+            return value;
+        } else {
+            printf("Invalid input. Please enter an integer.\n");
+        }
+    }
+}
+
+void print_usage() {
+    printf("MPC Expression Interpreter\n");
+    printf("Available variables: a, b, c, d here; --expr and --serve also take any other names, such as price\n");
+    printf("Available functions: max(x, y), min(x, y), equal(x, y), greater_than(x, y),\n");
+    printf("                     ifelse(condition, true_val, false_val), absolute(x)\n");
+    printf("Oblivious loop: while(cond, body, n) starts x at 0 and sets it to body while cond holds, n times\n");
+    printf("Available operators: +, -, *, /\n");
+    printf("Example: max(a * b, c + 5)\n");
+    printf("Variables are secret unless listed in MPC_PUBLIC (e.g. MPC_PUBLIC=ab)\n");
+    printf("Set MPC_PARTIES=N to evaluate on additive shares among N parties\n");
+    printf("MPC_POOL_ITEMS and MPC_SPILL_BYTES size its preprocessing pool\n");
+    printf("Run with --expr EXPR [--input FILE] [--output FILE] to evaluate EXPR over every row of FILE;\n");
+    printf("  a CSV header line names the columns, and EXPR reads variables from the columns of their names\n");
+    printf("Run with --serve SOCKET EXPR... to serve EXPRs on a Unix socket, and --client SOCKET to drive it\n");
+    printf("Enter 'stats' for expression cache statistics, 'quit' to exit\n\n");
+}
+
+// `interpreter --emit-c EXPR [NAME]` prints EXPR as a standalone C function.
+int emit_c_main(int argc, char* argv[]) {
+    NodeArena arena = { NULL };
+    unsigned secret_vars = secret_variables(getenv("MPC_PUBLIC"));
+    ExprNode* ast = prepare_expression(parse_with_secrecy(argv[2], &arena, secret_vars), &arena);
+    Program* prog = compile(ast);
+    emit_c_function(stdout, prog, argc > 3 ? argv[3] : "mpc_expr", argv[2]);
+    free_program(prog);
+    arena_release(&arena);
+    return 0;
+}
+
+// `interpreter --emit-bristol EXPR [gates|depth]` prints EXPR as a Bristol
+// Fashion netlist, built for the fewest ANDs or the least AND depth and
+// then optimized, and its gate counts before and after on stderr.
+int emit_bristol_main(int argc, char* argv[]) {
+    NodeArena arena = { NULL };
+    Program* prog = compile(prepare_expression(parse(argv[2], &arena), &arena));
+    Netlist* lowered = build_netlist(prog, argc > 3 && strcmp(argv[3], "depth") == 0);
+    Netlist* net = optimize_netlist(lowered);
+    write_bristol(stdout, net);
+    NetlistStats before = netlist_stats(lowered);
+    NetlistStats stats = netlist_stats(net);
+    fprintf(stderr, "%d AND gates (%d before optimization), AND depth %d (%d), %d XOR gates, %d INV gates, %d wires\n",
+            stats.and_gates, before.and_gates, stats.and_depth, before.and_depth, stats.xor_gates,
+            stats.inv_gates, net->num_wires);
+    free_netlist(lowered);
+    free_netlist(net);
+    free_program(prog);
+    arena_release(&arena);
+    return 0;
+}
+
+#ifndef MPC_INTERPRETER_NO_MAIN
+int main(int argc, char* argv[]) {
+    if (argc >= 3 && strcmp(argv[1], "--emit-c") == 0) {
+        return emit_c_main(argc, argv);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--emit-bristol") == 0) {
+        return emit_bristol_main(argc, argv);
+    }
+    if (argc >= 4 && strcmp(argv[1], "--serve") == 0) {
+        return server_main(argc, argv);
+    }
+    if (argc >= 3 && strcmp(argv[1], "--client") == 0) {
+        return client_main(argc, argv);
+    }
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--expr") == 0) return stream_main(argc, argv);
+    }
+
+    print_usage();
+    
+    char input[256];
+    int a, b, c, d;
+    ExprCache cache;
+    const char* cache_bytes = getenv("MPC_CACHE_BYTES");
+    expr_cache_init(&cache, cache_bytes ? strtoull(cache_bytes, NULL, 10) : EXPR_CACHE_DEFAULT_BYTES);
+    unsigned secret_vars = secret_variables(getenv("MPC_PUBLIC"));
+    const char* parties = getenv("MPC_PARTIES");
+    int num_parties = parties ? atoi(parties) : 0;
+    
+    a = read_int_input("Enter value for a: ");
+    b = read_int_input("Enter value for b: ");
+    c = read_int_input("Enter value for c: ");
+    d = read_int_input("Enter value for d: ");
+    
+    printf("\nVariables: a=%d, b=%d, c=%d, d=%d\n\n", a, b, c, d);
+    
+    while (1) {
+        printf("Enter expression: ");
+        if (fgets(input, sizeof(input), stdin) == NULL) {
+            printf("Error reading input. Exiting.\n");
+            break;
+        }
+        
+        input[strcspn(input, "\n")] = 0;
+        
+        if (strcmp(input, "quit") == 0) {
+            break;
+        }
+
+        if (strcmp(input, "stats") == 0) {
+            print_cache_stats(&cache);
+            printf("\n");
+            continue;
+        }
+        
+        if (input[0] == '\0') {
+            printf("Empty expression. Please enter a valid expression or 'quit'.\n\n");
+            continue;
+        }
+
+        CacheEntry* entry = NULL;
+        int result = 0;
+        
+        printf("Parsing and evaluating...\n");
+        entry = expr_cache_get(&cache, input, secret_vars);
+        if (num_parties) {
+            MpcStats stats;
+            run_program_shared(entry->prog, num_parties, &a, &b, &c, &d, &result, 1, &stats);
+            print_mpc_stats(&stats);
+        } else {
+            result = entry->jit ? run_jit(entry->jit, a, b, c, d) : run_program(entry->prog, a, b, c, d);
+        }
+        
+        printf("Result: %d\n\n", result);
     }
     
+    expr_cache_clear(&cache);
     printf("Goodbye!\n");
     return 0;
 }
+#endif // MPC_INTERPRETER_NO_MAIN
@@ -0,0 +1,225 @@
+// Checks the Bristol Fashion netlists against evaluate(). Each expression is
+// lowered with ripple and with prefix words, each netlist is also run
+// through optimize_netlist(), and all four are written with write_bristol(),
+// read back and simulated on random rows, 64 rows to a word. Rows that
+// divide by zero are skipped because evaluate() aborts on them.
+//
+// Usage: netlist_check [EXPR...]
+
+#define MPC_INTERPRETER_NO_MAIN
+#include "interpreter.c"
+
+#define NETLIST_CHECK_ROWS 20000
+
+static const char* default_expressions[] = {
+    "max(a * b, c + 5)",
+    "ifelse(greater_than(a * b, c), a * b, c)",
+    "min(absolute(a - b), d) * 3",
+    "a / b + c / 8 - d * 16",
+    "equal(a, b) + greater_than(c, d) * 2",
+    "max(min(a, b), min(c, d)) / absolute(d)",
+    "a * b * c * d - (a - b) * 4",
+    "while(greater_than(a, x * x), x + 1, 16) + d",
+};
+
+uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+int32_t random_value(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    // Mix full-range values with small ones so comparisons and divisions
+    // see both overflowing and ordinary operands.
+    switch (rng_state % 4) {
+        case 0: return (int32_t)(rng_state >> 32);
+        case 1: return (int32_t)((rng_state >> 32) % 2001) - 1000;
+        case 2: return (int32_t)((rng_state >> 32) % 17) - 8;
+        default: return (rng_state >> 40) & 1 ? INT32_MIN : INT32_MAX;
+    }
+}
+
+typedef struct {
+    int num_gates;
+    int num_wires;
+    int num_inputs;
+    int* gates;         // four ints per gate: type, two inputs, output
+} BristolCircuit;
+
+// Reads back what write_bristol() wrote: four 32-bit inputs, one 32-bit
+// output on the last wires.
+BristolCircuit read_bristol(FILE* in) {
+    BristolCircuit circuit = { 0 };
+    int num_values, num_outputs, output_bits;
+    if (fscanf(in, "%d %d %d", &circuit.num_gates, &circuit.num_wires, &num_values) != 3 ||
+        num_values != NUM_VARIABLES) {
+        printf("Error: Bad Bristol header.\n");
+        exit(1);
+    }
+    for (int v = 0; v < num_values; v++) {
+        int bits;
+        if (fscanf(in, "%d", &bits) != 1 || bits != WORD_BITS) {
+            printf("Error: Bad Bristol input width.\n");
+            exit(1);
+        }
+        circuit.num_inputs += bits;
+    }
+    if (fscanf(in, "%d %d", &num_outputs, &output_bits) != 2 || num_outputs != 1 || output_bits != WORD_BITS) {
+        printf("Error: Bad Bristol output width.\n");
+        exit(1);
+    }
+
+    circuit.gates = malloc((size_t)circuit.num_gates * 4 * sizeof(int));
+    for (int k = 0; k < circuit.num_gates; k++) {
+        int* g = &circuit.gates[4 * k];
+        int arity, outputs;
+        char name[8];
+        if (fscanf(in, "%d %d", &arity, &outputs) != 2 || outputs != 1 || arity < 1 || arity > 2) {
+            printf("Error: Bad Bristol gate %d.\n", k);
+            exit(1);
+        }
+        g[2] = -1;
+        if (arity == 1 ? fscanf(in, "%d %d %7s", &g[1], &g[3], name) != 3
+                       : fscanf(in, "%d %d %d %7s", &g[1], &g[2], &g[3], name) != 4) {
+            printf("Error: Bad Bristol gate %d.\n", k);
+            exit(1);
+        }
+        g[0] = strcmp(name, "AND") == 0 ? GATE_AND : strcmp(name, "XOR") == 0 ? GATE_XOR : GATE_INV;
+        if ((g[0] == GATE_INV) != (arity == 1) || (g[0] == GATE_INV && strcmp(name, "INV") != 0)) {
+            printf("Error: Bad Bristol gate %d: %s.\n", k, name);
+            exit(1);
+        }
+    }
+    return circuit;
+}
+
+// Runs 64 rows through the circuit, bit i of each wire word being row i.
+void simulate_bristol(const BristolCircuit* circuit, uint64_t* wires, const int32_t* const* inputs,
+                      int32_t* out, size_t rows) {
+    for (int v = 0; v < NUM_VARIABLES; v++) {
+        for (int bit = 0; bit < WORD_BITS; bit++) {
+            uint64_t word = 0;
+            for (size_t i = 0; i < rows; i++) word |= (uint64_t)(((uint32_t)inputs[v][i] >> bit) & 1) << i;
+            wires[v * WORD_BITS + bit] = word;
+        }
+    }
+    for (int k = 0; k < circuit->num_gates; k++) {
+        const int* g = &circuit->gates[4 * k];
+        switch (g[0]) {
+            case GATE_AND: wires[g[3]] = wires[g[1]] & wires[g[2]]; break;
+            case GATE_XOR: wires[g[3]] = wires[g[1]] ^ wires[g[2]]; break;
+            default: wires[g[3]] = ~wires[g[1]]; break;
+        }
+    }
+    int first_output = circuit->num_wires - WORD_BITS;
+    for (size_t i = 0; i < rows; i++) {
+        uint32_t value = 0;
+        for (int bit = 0; bit < WORD_BITS; bit++) value |= (uint32_t)((wires[first_output + bit] >> i) & 1) << bit;
+        out[i] = (int32_t)value;
+    }
+}
+
+// Compares one netlist with the expected results, skipping rows flagged in
+// `skip`.
+bool check_netlist(const char* expression, const char* label, const Netlist* net, const int32_t* const* cols,
+                   const int32_t* expected, const bool* skip) {
+    FILE* text = tmpfile();
+    if (!text) {
+        printf("Error: Cannot create a temporary file.\n");
+        exit(1);
+    }
+    write_bristol(text, net);
+    rewind(text);
+    BristolCircuit circuit = read_bristol(text);
+    fclose(text);
+
+    uint64_t* wires = malloc((size_t)circuit.num_wires * sizeof(uint64_t));
+    int32_t got[64];
+    size_t mismatches = 0;
+    for (size_t start = 0; start < NETLIST_CHECK_ROWS; start += 64) {
+        size_t rows = NETLIST_CHECK_ROWS - start < 64 ? NETLIST_CHECK_ROWS - start : 64;
+        const int32_t* inputs[NUM_VARIABLES];
+        for (int v = 0; v < NUM_VARIABLES; v++) inputs[v] = cols[v] + start;
+        simulate_bristol(&circuit, wires, inputs, got, rows);
+        for (size_t i = 0; i < rows; i++) {
+            size_t row = start + i;
+            if (skip[row] || got[i] == expected[row]) continue;
+            if (mismatches++ < 5) {
+                printf("  %s mismatch at a=%d b=%d c=%d d=%d: expected %d, got %d\n", label, cols[0][row],
+                       cols[1][row], cols[2][row], cols[3][row], expected[row], got[i]);
+            }
+        }
+    }
+
+    NetlistStats stats = netlist_stats(net);
+    char name[128];
+    snprintf(name, sizeof(name), "%s | %s", expression, label);
+    printf("%-64s %s (%d ANDs, AND depth %d)\n", name, mismatches ? "FAIL" : "ok", stats.and_gates,
+           stats.and_depth);
+    free(wires);
+    free(circuit.gates);
+    return mismatches == 0;
+}
+
+bool check_expression(const char* expression) {
+    NodeArena arena = { NULL };
+    ExprNode* ast = parse(expression, &arena);
+    Program* prog = compile(prepare_expression(parse(expression, &arena), &arena));
+
+    int32_t* data = malloc((NUM_VARIABLES + 1) * NETLIST_CHECK_ROWS * sizeof(int32_t));
+    bool* skip = calloc(NETLIST_CHECK_ROWS, sizeof(bool));
+    const int32_t* cols[NUM_VARIABLES];
+    int32_t* expected = data + NUM_VARIABLES * NETLIST_CHECK_ROWS;
+    for (int v = 0; v < NUM_VARIABLES; v++) {
+        int32_t* col = data + (size_t)v * NETLIST_CHECK_ROWS;
+        for (size_t i = 0; i < NETLIST_CHECK_ROWS; i++) col[i] = random_value();
+        cols[v] = col;
+    }
+
+    // The batch engine's soft trap finds the rows that divide by zero
+    // without ending the process.
+    size_t skipped = 0;
+    batch_trap_soft = true;
+    for (size_t i = 0; i < NETLIST_CHECK_ROWS; i++) {
+        const int32_t* row[NUM_VARIABLES] = { cols[0] + i, cols[1] + i, cols[2] + i, cols[3] + i };
+        int32_t ignored;
+        batch_trapped = false;
+        run_program_columns(prog, row, &ignored, 1);
+        skip[i] = batch_trapped;
+        skipped += skip[i];
+        if (!skip[i]) expected[i] = evaluate(ast, cols[0][i], cols[1][i], cols[2][i], cols[3][i]);
+    }
+    batch_trap_soft = false;
+
+    bool ok = true;
+    for (int prefix = 0; prefix <= 1; prefix++) {
+        Netlist* net = build_netlist_with(prog, prefix);
+        Netlist* optimized = optimize_netlist(net);
+        char label[32];
+        snprintf(label, sizeof(label), "%s", prefix ? "prefix" : "ripple");
+        ok &= check_netlist(expression, label, net, cols, expected, skip);
+        snprintf(label, sizeof(label), "%s optimized", prefix ? "prefix" : "ripple");
+        ok &= check_netlist(expression, label, optimized, cols, expected, skip);
+        free_netlist(optimized);
+        free_netlist(net);
+    }
+    printf("%-64s %d rows, %zu skipped for division by zero\n", expression, NETLIST_CHECK_ROWS, skipped);
+
+    free(data);
+    free(skip);
+    free_program(prog);
+    arena_release(&arena);
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    const char** expressions = default_expressions;
+    int count = (int)(sizeof(default_expressions) / sizeof(default_expressions[0]));
+    if (argc > 1) {
+        expressions = (const char**)&argv[1];
+        count = argc - 1;
+    }
+
+    bool all_ok = true;
+    for (int i = 0; i < count; i++) all_ok &= check_expression(expressions[i]);
+    return all_ok ? 0 : 1;
+}
@@ -1,85 +1,86 @@
 #include <stdint.h>
 #include <stdio.h>
 
-#define MAX_ITER 32
+// An oblivious "while": the body runs a fixed number of times, and each step
+// keeps its result only while the condition holds, so the running time and
+// memory trace never depend on the state.
+//
+// STATIC_WHILE_STATE(State, FIELDS) declares the state struct, where FIELDS
+// is an X-macro that invokes its argument as F(type, name) for each integer
+// field. STATIC_WHILE(name, State, FIELDS, BOUND, CONDITION, BODY) then
+// defines
+//
+//     State name(State s);
+//
+// which applies BODY to s while CONDITION holds, at most BOUND times.
+// CONDITION maps a state to 0 or 1 and BODY maps it to the next state; both
+// are named directly rather than passed as pointers, so the compiler
+// inlines them and can fuse the unrolled steps.
 
-// State structure (customize as needed)
-typedef struct {
-    int32_t x;
-} State;
+#if defined(__GNUC__) && !defined(__clang__)
+#define STATIC_WHILE_UNROLL _Pragma("GCC unroll 64")
+#elif defined(__clang__)
+#define STATIC_WHILE_UNROLL _Pragma("clang loop unroll(full)")
+#else
+#define STATIC_WHILE_UNROLL
+#endif
 
-// Function pointer types
-typedef int (*ConditionFunc)(State);
-typedef State (*BodyFunc)(State);
+#define STATIC_WHILE_FIELD(type, name) type name;
+#define STATIC_WHILE_SELECT(type, name) next.name = (type)((next.name & (type)mask) | (s.name & (type)~mask));
 
-// Bit-masking conditional select (simulates if)
-int32_t select(int cond, int32_t a, int32_t b) {
-    return (cond * a) | ((1 - cond) * b);
-}
+#define STATIC_WHILE_STATE(State, FIELDS) \
+    typedef struct {                      \
+        FIELDS(STATIC_WHILE_FIELD)        \
+    } State;
 
-// Simulate one iteration statically
-State step(State s, ConditionFunc condition, BodyFunc body) {
-    int cond = condition(s);
-    State updated = body(s);
+#define STATIC_WHILE(name, State, FIELDS, BOUND, CONDITION, BODY) \
+    static inline State name##_step(State s) {                    \
+        int64_t mask = -(int64_t)(CONDITION(s) & 1);              \
+        State next = BODY(s);                                     \
+        FIELDS(STATIC_WHILE_SELECT)                               \
+        return next;                                              \
+    }                                                             \
+                                                                  \
+    static inline State name(State s) {                           \
+        STATIC_WHILE_UNROLL                                       \
+        for (int i = 0; i < (BOUND); i++) s = name##_step(s);     \
+        return s;                                                 \
+    }
 
-    State result;
-    result.x = select(cond, updated.x, s.x);
-    return result;
-}
+// Example: count x up to 10.
 
-// Fully unrolled "static while"
-State static_while(State s, ConditionFunc condition, BodyFunc body) {
-    s = step(s, condition, body); // Iteration 1
-    s = step(s, condition, body); // Iteration 2
-    s = step(s, condition, body); // Iteration 3
-    s = step(s, condition, body); // Iteration 4
-    s = step(s, condition, body); // Iteration 5
-    s = step(s, condition, body); // Iteration 6
-    s = step(s, condition, body); // Iteration 7
-    s = step(s, condition, body); // Iteration 8
-    s = step(s, condition, body); // Iteration 9
-    s = step(s, condition, body); // Iteration 10
-    s = step(s, condition, body); // Iteration 11
-    s = step(s, condition, body); // Iteration 12
-    s = step(s, condition, body); // Iteration 13
-    s = step(s, condition, body); // Iteration 14
-    s = step(s, condition, body); // Iteration 15
-    s = step(s, condition, body); // Iteration 16
-    s = step(s, condition, body); // Iteration 17
-    s = step(s, condition, body); // Iteration 18
-    s = step(s, condition, body); // Iteration 19
-    s = step(s, condition, body); // Iteration 20
-    s = step(s, condition, body); // Iteration 21
-    s = step(s, condition, body); // Iteration 22
-    s = step(s, condition, body); // Iteration 23
-    s = step(s, condition, body); // Iteration 24
-    s = step(s, condition, body); // Iteration 25
-    s = step(s, condition, body); // Iteration 26
-    s = step(s, condition, body); // Iteration 27
-    s = step(s, condition, body); // Iteration 28
-    s = step(s, condition, body); // Iteration 29
-    s = step(s, condition, body); // Iteration 30
-    s = step(s, condition, body); // Iteration 31
-    s = step(s, condition, body); // Iteration 32
-    return s;
-}
+#define COUNTER_FIELDS(F) F(int32_t, x)
+STATIC_WHILE_STATE(CounterState, COUNTER_FIELDS)
+
+#define COUNTER_BELOW_10(s) ((int)((((s).x - 10) >> 31) & 1))
+#define COUNTER_INCREMENT(s) ((CounterState){ (s).x + 1 })
+
+STATIC_WHILE(counter, CounterState, COUNTER_FIELDS, 32, COUNTER_BELOW_10, COUNTER_INCREMENT)
 
-// Example condition: x < 10
-int cond_less_than_10(State s) {
-    return ((s.x - 10) >> 31) & 1;
+// Example: the number of Collatz steps from n down to 1, with a two-field
+// state and a branch-free body.
+
+#define COLLATZ_FIELDS(F) F(int32_t, n) F(int32_t, steps)
+STATIC_WHILE_STATE(CollatzState, COLLATZ_FIELDS)
+
+static inline int collatz_running(CollatzState s) {
+    return (int)(((uint32_t)(s.n ^ 1) | (uint32_t)-(s.n ^ 1)) >> 31);
 }
 
-// Example body: x++
-State body_increment(State s) {
-    State result;
-    result.x = s.x + 1;
-    return result;
+static inline CollatzState collatz_next(CollatzState s) {
+    int32_t odd = -(s.n & 1);
+    CollatzState next = { ((3 * s.n + 1) & odd) | ((s.n >> 1) & ~odd), s.steps + 1 };
+    return next;
 }
 
+STATIC_WHILE(collatz, CollatzState, COLLATZ_FIELDS, 128, collatz_running, collatz_next)
+
 // Main entry point
 int main() {
-    State s = { .x = 0 };
-    State final = static_while(s, cond_less_than_10, body_increment);
+    CounterState final = counter((CounterState){ .x = 0 });
     printf("Final x = %d\n", final.x);  // Should print 10
+
+    CollatzState path = collatz((CollatzState){ .n = 27, .steps = 0 });
+    printf("Collatz steps from 27 = %d\n", path.steps);  // Should print 111
     return 0;
 }
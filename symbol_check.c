@@ -0,0 +1,315 @@
+// Checks expressions over named variables. Each expression is parsed with a
+// symbol table, and the compiled program is run by run_program_row(),
+// run_program_columns() and run_program_parallel_columns() and compared with
+// evaluate_row() on random rows. The rows are also written as csv under a
+// header that lists the columns in another order, with some the expression
+// does not use, and streamed through stream_evaluate_with(). Besides the
+// sample expressions, random ones are drawn over RANDOM_NAMES names.
+// Finally the interpreter binary ($INTERPRETER, or ./interpreter) is run
+// with --expr on csv, rows, columns and mapped input, so that each format
+// is checked end to end through stream_main().
+//
+// Usage: symbol_check [COUNT]   (COUNT random expressions, default 200)
+
+#define MPC_INTERPRETER_NO_MAIN
+#include "interpreter.c"
+
+#define SYMBOL_CHECK_ROWS 5000
+#define RANDOM_NAMES 24
+#define CLI_CHECK_ROWS (STREAM_BLOCK_ROWS + 4321)  // more than one stream block
+
+static const char* default_expressions[] = {
+    "price * qty + tax - discount",
+    "max(feature_1 * weight, bias + a) - d",
+    "ifelse(greater_than(income, limit), income - limit, 0) / 4 + e",
+    "while(greater_than(target, x * step), x + 1, 20) * f + g",
+    "absolute(alpha - beta) * gamma + min(delta, epsilon)",
+    "equal(c, b) + greater_than(_tmp2, a) * 2 - d * Zeta",
+};
+
+static const char* cli_expressions[] = {
+    "max(a * b, c + 5) - d",
+    "ifelse(greater_than(a, b), a / 8, c * d)",
+};
+
+uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+uint32_t random_bits(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)(rng_state >> 32);
+}
+
+int32_t random_value(void) {
+    uint32_t r = random_bits();
+    switch (r % 4) {
+        case 0: return (int32_t)random_bits();
+        case 1: return (int32_t)(random_bits() % 2001) - 1000;
+        case 2: return (int32_t)(random_bits() % 17) - 8;
+        default: return r & 4 ? INT32_MIN : INT32_MAX;
+    }
+}
+
+char random_names[RANDOM_NAMES][16];
+
+// Writes a random expression of at most 3^(3 - depth) leaves, which keeps
+// it within the tokenizer's limit.
+void random_expression(char* out, size_t size, int depth) {
+    char left[2048], right[2048], third[2048];
+    int kind = depth >= 3 ? (int)(random_bits() % 3) : (int)(random_bits() % 9);
+    if (kind >= 3) random_expression(left, sizeof(left), depth + 1);
+    if (kind >= 4 && kind != 6) random_expression(right, sizeof(right), depth + 1);
+    switch (kind) {
+        case 0: snprintf(out, size, "%s", random_names[random_bits() % RANDOM_NAMES]); break;
+        case 1: snprintf(out, size, "%d", (int)(random_bits() % 200) - 100); break;
+        case 2: snprintf(out, size, "%c", "abcd"[random_bits() % 4]); break;
+        case 3: snprintf(out, size, "absolute(%s)", left); break;
+        case 4: snprintf(out, size, "(%s %c %s)", left, "+-*"[random_bits() % 3], right); break;
+        case 5: snprintf(out, size, "max(%s, %s)", left, right); break;
+        case 6: snprintf(out, size, "%s / %d", left, 1 << (random_bits() % 5)); break;
+        case 7: snprintf(out, size, "while(greater_than(%s, x), x + 1, 3) - %s", left, right); break;
+        default:
+            random_expression(third, sizeof(third), depth + 1);
+            snprintf(out, size, "ifelse(greater_than(%s, 0), %s, %s)", left, right, third);
+            break;
+    }
+}
+
+// Streams the rows through `prog` as csv, the columns in reverse slot order
+// behind one that no variable reads; returns the number of mismatches.
+// Names the program does not read after optimization get a column of 0s.
+size_t check_stream(const Program* prog, SymbolTable* symbols, const ExprNode* ast, int32_t* const* cols,
+                    const int32_t* expected) {
+#ifdef MPC_HAVE_THREADS
+    FILE* in = tmpfile();
+    FILE* out = tmpfile();
+    if (!in || !out) {
+        printf("Error: Cannot create a temporary file.\n");
+        exit(1);
+    }
+    int width = prog->num_variables;
+    fprintf(in, "unused column");
+    for (int v = symbols->count - 1; v >= 0; v--) fprintf(in, ", %s", symbols->names[v]);
+    fprintf(in, "\n");
+    for (size_t i = 0; i < SYMBOL_CHECK_ROWS; i++) {
+        fprintf(in, "%d", (int)(i % 7));
+        for (int v = symbols->count - 1; v >= 0; v--) fprintf(in, ",%d", v < width ? cols[v][i] : 0);
+        fprintf(in, "\n");
+    }
+    rewind(in);
+
+    char* header = stream_read_header(in);
+    StreamLayout layout = stream_layout(header, symbols, ast, prog);
+    uint64_t rows = stream_evaluate_with(prog, 0, in, out, STREAM_CSV, &layout);
+    rewind(out);
+    size_t mismatches = rows != SYMBOL_CHECK_ROWS;
+    for (size_t i = 0; i < SYMBOL_CHECK_ROWS; i++) {
+        int value;
+        if (fscanf(out, "%d", &value) != 1 || value != expected[i]) mismatches++;
+    }
+    free(layout.slot_of);
+    free(header);
+    fclose(in);
+    fclose(out);
+    return mismatches;
+#else
+    (void)prog, (void)symbols, (void)ast, (void)cols, (void)expected;
+    return 0;
+#endif
+}
+
+bool check_expression(const char* expression, bool verbose) {
+    NodeArena arena = { NULL };
+    SymbolTable symbols;
+    symbol_table_init(&symbols);
+    ExprNode* ast = parse_with_symbols(expression, &arena, &symbols, ALL_VARIABLES_SECRET);
+    Program* prog = compile(prepare_expression(ast, &arena));
+    int width = prog->num_variables;
+
+    int32_t* data = malloc((size_t)(width + 3) * SYMBOL_CHECK_ROWS * sizeof(int32_t));
+    int32_t* cols[PROGRAM_MAX_REGS];
+    for (int v = 0; v < width; v++) {
+        cols[v] = data + (size_t)v * SYMBOL_CHECK_ROWS;
+        for (size_t i = 0; i < SYMBOL_CHECK_ROWS; i++) cols[v][i] = random_value();
+    }
+    int32_t* expected = data + (size_t)width * SYMBOL_CHECK_ROWS;
+    int32_t* batch = expected + SYMBOL_CHECK_ROWS;
+    int32_t* parallel = batch + SYMBOL_CHECK_ROWS;
+    run_program_columns(prog, (const int32_t* const*)cols, batch, SYMBOL_CHECK_ROWS);
+    run_program_parallel_columns(prog, (const int32_t* const*)cols, parallel, SYMBOL_CHECK_ROWS);
+
+    size_t mismatches = 0;
+    for (size_t i = 0; i < SYMBOL_CHECK_ROWS; i++) {
+        int32_t row[PROGRAM_MAX_REGS] = { 0 };  // 0 for names optimization removed, as in check_stream()
+        for (int v = 0; v < width; v++) row[v] = cols[v][i];
+        expected[i] = evaluate_row(ast, row);
+        int32_t by_row = run_program_row(prog, row);
+        if (by_row == expected[i] && batch[i] == expected[i] && parallel[i] == expected[i]) continue;
+        if (mismatches++ < 5) {
+            printf("  mismatch at row %zu: evaluate_row %d, run_program_row %d, columns %d, parallel %d\n", i,
+                   expected[i], by_row, batch[i], parallel[i]);
+        }
+    }
+    size_t stream_mismatches = check_stream(prog, &symbols, ast, cols, expected);
+    if (stream_mismatches) printf("  %zu stream mismatch(es)\n", stream_mismatches);
+
+    bool ok = mismatches == 0 && stream_mismatches == 0;
+    if (verbose || !ok) printf("%-64.64s %s (%d variables)\n", expression, ok ? "ok" : "FAIL", width);
+
+    free(data);
+    free_program(prog);
+    symbol_table_free(&symbols);
+    arena_release(&arena);
+    return ok;
+}
+
+#ifdef MPC_HAVE_THREADS
+
+// Runs `interpreter` with --expr on `format` input (NULL: the default for a
+// file, columns) written from `cols`; true when every result matches
+// `expected`.
+bool check_cli_format(const char* interpreter, const char* expression, const char* format, int32_t* const* cols,
+                      const int32_t* expected) {
+    const char* dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char input[512], output[512], command[2048];
+    snprintf(input, sizeof(input), "%s/mpc_symbol_check_%d.in", dir, (int)getpid());
+    snprintf(output, sizeof(output), "%s/mpc_symbol_check_%d.out", dir, (int)getpid());
+    bool csv = format && strcmp(format, "csv") == 0;
+    bool mapped = format && strcmp(format, "mapped") == 0;
+
+    if (mapped) {
+        MappedColumns m = mapped_create(input, CLI_CHECK_ROWS, NUM_VARIABLES);
+        for (int v = 0; v < NUM_VARIABLES; v++) memcpy(m.columns[v], cols[v], CLI_CHECK_ROWS * sizeof(int32_t));
+        mapped_close(&m);
+    } else {
+        FILE* f = fopen(input, "wb");
+        if (!f) {
+            printf("Error: Cannot create '%s'.\n", input);
+            exit(1);
+        }
+        // csv and rows hold a, b, c and d of each row in turn; columns hold
+        // all of a, then all of b, and so on.
+        for (size_t k = 0; k < NUM_VARIABLES * (size_t)CLI_CHECK_ROWS; k++) {
+            int v = format ? (int)(k % NUM_VARIABLES) : (int)(k / CLI_CHECK_ROWS);
+            size_t i = format ? k / NUM_VARIABLES : k % CLI_CHECK_ROWS;
+            if (csv) {
+                fprintf(f, v == NUM_VARIABLES - 1 ? "%d\n" : "%d,", cols[v][i]);
+            } else {
+                uint32_t le = stream_le32((uint32_t)cols[v][i]);
+                fwrite(&le, sizeof(le), 1, f);
+            }
+        }
+        fclose(f);
+    }
+
+    snprintf(command, sizeof(command), "%s --expr '%s' --input %s --output %s%s%s 2>/dev/null", interpreter,
+             expression, input, output, format ? " --format " : "", format ? format : "");
+    bool ok = system(command) == 0;
+    size_t mismatches = 0;
+    if (ok && mapped) {
+        MappedColumns m = mapped_open(output);
+        ok = m.rows == CLI_CHECK_ROWS;
+        for (size_t i = 0; ok && i < CLI_CHECK_ROWS; i++) mismatches += m.columns[0][i] != expected[i];
+        mapped_close(&m);
+    } else if (ok) {
+        FILE* f = fopen(output, "rb");
+        for (size_t i = 0; f && i < CLI_CHECK_ROWS; i++) {
+            int value;
+            uint32_t le;
+            if (csv ? fscanf(f, "%d", &value) != 1 : fread(&le, sizeof(le), 1, f) != 1) {
+                ok = false;
+                break;
+            }
+            if (!csv) value = (int32_t)stream_le32(le);
+            mismatches += value != expected[i];
+        }
+        int extra;
+        ok &= f && (csv ? fscanf(f, "%d", &extra) == EOF : fgetc(f) == EOF);
+        if (f) fclose(f);
+    }
+    remove(input);
+    remove(output);
+
+    char name[128];
+    snprintf(name, sizeof(name), "%s | --format %s", expression, format ? format : "(columns)");
+    ok &= mismatches == 0;
+    printf("%-64s %s (%zu mismatches)\n", name, ok ? "ok" : "FAIL", mismatches);
+    return ok;
+}
+
+// True when the interpreter refuses to write a mapped file over itself and
+// leaves it as it was.
+bool check_cli_in_place(const char* interpreter, int32_t* const* cols) {
+    const char* dir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+    char path[512], command[2048];
+    snprintf(path, sizeof(path), "%s/mpc_symbol_check_%d.mapped", dir, (int)getpid());
+    MappedColumns m = mapped_create(path, CLI_CHECK_ROWS, NUM_VARIABLES);
+    for (int v = 0; v < NUM_VARIABLES; v++) memcpy(m.columns[v], cols[v], CLI_CHECK_ROWS * sizeof(int32_t));
+    mapped_close(&m);
+
+    snprintf(command, sizeof(command), "%s --expr 'a + b' --input %s --output %s 2>/dev/null", interpreter, path,
+             path);
+    bool ok = system(command) != 0;
+    m = mapped_open(path);
+    ok &= m.rows == CLI_CHECK_ROWS && memcmp(m.columns[3], cols[3], CLI_CHECK_ROWS * sizeof(int32_t)) == 0;
+    mapped_close(&m);
+    remove(path);
+    printf("%-64s %s\n", "mapped input written over itself is refused", ok ? "ok" : "FAIL");
+    return ok;
+}
+
+// Runs each of cli_expressions through the interpreter binary in every
+// input format and compares the results with evaluate().
+bool check_cli(void) {
+    const char* interpreter = getenv("INTERPRETER") ? getenv("INTERPRETER") : "./interpreter";
+    int32_t* data = malloc((NUM_VARIABLES + 1) * CLI_CHECK_ROWS * sizeof(int32_t));
+    int32_t* cols[NUM_VARIABLES];
+    for (int v = 0; v < NUM_VARIABLES; v++) {
+        cols[v] = data + (size_t)v * CLI_CHECK_ROWS;
+        for (size_t i = 0; i < CLI_CHECK_ROWS; i++) cols[v][i] = random_value();
+    }
+    int32_t* expected = data + NUM_VARIABLES * CLI_CHECK_ROWS;
+
+    bool ok = true;
+    for (size_t e = 0; e < sizeof(cli_expressions) / sizeof(cli_expressions[0]); e++) {
+        NodeArena arena = { NULL };
+        ExprNode* ast = parse(cli_expressions[e], &arena);
+        for (size_t i = 0; i < CLI_CHECK_ROWS; i++) {
+            expected[i] = evaluate(ast, cols[0][i], cols[1][i], cols[2][i], cols[3][i]);
+        }
+        const char* formats[] = { "csv", "rows", NULL, "mapped" };
+        for (int f = 0; f < 4; f++) {
+            ok &= check_cli_format(interpreter, cli_expressions[e], formats[f], cols, expected);
+        }
+        arena_release(&arena);
+    }
+    ok &= check_cli_in_place(interpreter, cols);
+    free(data);
+    return ok;
+}
+
+#endif // MPC_HAVE_THREADS
+
+int main(int argc, char* argv[]) {
+    int count = argc > 1 ? atoi(argv[1]) : 200;
+    for (int k = 0; k < RANDOM_NAMES; k++) {
+        snprintf(random_names[k], sizeof(random_names[k]), "%s%d", k % 2 ? "col_" : "Value", k);
+    }
+
+    bool all_ok = true;
+    for (size_t i = 0; i < sizeof(default_expressions) / sizeof(default_expressions[0]); i++) {
+        all_ok &= check_expression(default_expressions[i], true);
+    }
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        char expression[8192];
+        random_expression(expression, sizeof(expression), 0);
+        if (!check_expression(expression, false)) failed++;
+    }
+    printf("%d random expression(s) over %d names, %d failed\n", count, RANDOM_NAMES, failed);
+#ifdef MPC_HAVE_THREADS
+    all_ok &= check_cli();
+#endif
+    return all_ok && failed == 0 ? 0 : 1;
+}